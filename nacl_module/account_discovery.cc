@@ -0,0 +1,180 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "account_discovery.h"
+
+#include <memory>
+
+#include "base58.h"
+#include "blockchain.h"
+#include "node.h"
+#include "node_factory.h"
+#include "worker_pool.h"
+
+static const uint32_t BIP0044_PURPOSE = 0x8000002C;  // 44'
+static const uint32_t HARDENED = 0x80000000;
+static const uint32_t DEFAULT_ADDRESS_GAP = 20;
+static const size_t DEFAULT_ACCOUNT_CONCURRENCY = 4;
+
+bool BlockchainHistoryOracle::HasHistory(const bytes_t& hash160) {
+  return blockchain_->GetAddressTxCount(hash160) > 0;
+}
+
+namespace {
+
+// One chain of one account. Indexes below checked_count have been
+// looked up; used_count is one past the highest that had history.
+struct ChainScan {
+  explicit ChainScan(const Node& node)
+    : chain_node(node), checked_count(0), used_count(0) {}
+
+  Node chain_node;
+  uint32_t checked_count;
+  uint32_t used_count;
+};
+
+struct ScanItem {
+  size_t scan;
+  uint32_t index;
+};
+
+class ScanTask : public ParallelTask {
+ public:
+  ScanTask(const std::vector<ChainScan>& scans,
+           const std::vector<ScanItem>& items,
+           std::vector<bytes_t>& hash160s)
+    : scans_(scans), items_(items), hash160s_(hash160s) {
+  }
+
+  void Run(size_t index) {
+    const Node& chain_node = scans_[items_[index].scan].chain_node;
+    Node child_node(chain_node);
+    if (NodeFactory::DeriveChildNode(chain_node, items_[index].index,
+                                     child_node)) {
+      hash160s_[index] = child_node.hex_id();
+    }
+  }
+
+ private:
+  const std::vector<ChainScan>& scans_;
+  const std::vector<ScanItem>& items_;
+  std::vector<bytes_t>& hash160s_;
+};
+
+}  // namespace
+
+AccountDiscovery::AccountDiscovery(const Node& master_node,
+                                   HistoryOracle* oracle)
+  : master_node_(master_node), oracle_(oracle), coin_type_(0),
+    address_gap_(DEFAULT_ADDRESS_GAP),
+    account_concurrency_(DEFAULT_ACCOUNT_CONCURRENCY), thread_count_(0) {
+}
+
+bool AccountDiscovery::Discover(discovered_accounts_t& accounts) {
+  accounts.clear();
+  if (!master_node_.is_private()) {
+    return false;
+  }
+  const DerivationPath coin_path(DerivationPath().
+                                 Child(BIP0044_PURPOSE).
+                                 Child(HARDENED | coin_type_));
+  std::auto_ptr<Node>
+    coin_node(NodeFactory::DeriveChildNodeWithPath(master_node_, coin_path));
+  if (!coin_node.get()) {
+    return false;
+  }
+
+  WorkerPool pool(thread_count_);
+  for (uint32_t first_account = 0;
+       first_account < HARDENED;
+       first_account += account_concurrency_) {
+    // Set up the next window of accounts. The chain nodes are shared
+    // by the workers, so their lazy parts are filled in here.
+    std::vector<ChainScan> scans;
+    std::vector<std::string> ext_pubs;
+    for (uint32_t account = first_account;
+         account < first_account + account_concurrency_ &&
+           account < HARDENED;
+         ++account) {
+      Node account_node(*coin_node);
+      if (!NodeFactory::DeriveChildNode(*coin_node, HARDENED | account,
+                                        account_node)) {
+        return false;
+      }
+      for (uint32_t chain = 0; chain < 2; ++chain) {
+        Node chain_node(account_node);
+        if (!NodeFactory::DeriveChildNode(account_node, chain, chain_node)) {
+          return false;
+        }
+        chain_node.fingerprint();
+        scans.push_back(ChainScan(chain_node));
+      }
+      ext_pubs.push_back(Base58::toBase58Check(account_node.
+                                               toSerializedPublic()));
+    }
+
+    // Keep every chain address_gap_ addresses past its last use.
+    while (true) {
+      std::vector<ScanItem> items;
+      for (size_t i = 0; i < scans.size(); ++i) {
+        ScanItem item;
+        item.scan = i;
+        for (item.index = scans[i].checked_count;
+             item.index < scans[i].used_count + address_gap_;
+             ++item.index) {
+          items.push_back(item);
+        }
+      }
+      if (items.empty()) {
+        break;
+      }
+      std::vector<bytes_t> hash160s(items.size());
+      ScanTask task(scans, items, hash160s);
+      pool.Run(&task, items.size());
+
+      for (size_t i = 0; i < items.size(); ++i) {
+        ChainScan& scan = scans[items[i].scan];
+        const uint32_t next_index = items[i].index + 1;
+        if (!hash160s[i].empty() && oracle_->HasHistory(hash160s[i]) &&
+            next_index > scan.used_count) {
+          scan.used_count = next_index;
+        }
+        if (next_index > scan.checked_count) {
+          scan.checked_count = next_index;
+        }
+      }
+    }
+
+    for (size_t i = 0; i < ext_pubs.size(); ++i) {
+      const ChainScan& external = scans[i * 2];
+      const ChainScan& internal = scans[i * 2 + 1];
+      if (external.used_count == 0) {
+        return true;
+      }
+      accounts.push_back(DiscoveredAccount(first_account + i,
+                                           ext_pubs[i],
+                                           external.used_count,
+                                           internal.used_count));
+    }
+  }
+  return true;
+}
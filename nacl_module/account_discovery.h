@@ -0,0 +1,113 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__ACCOUNT_DISCOVERY_H__)
+#define __ACCOUNT_DISCOVERY_H__
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+class Blockchain;
+class Node;
+
+// Tells AccountDiscovery whether an address has ever been used.
+// Called only on the thread running Discover().
+class HistoryOracle {
+ public:
+  virtual ~HistoryOracle() {}
+  virtual bool HasHistory(const bytes_t& hash160) = 0;
+};
+
+// Answers from whatever transactions a Blockchain has been given.
+class BlockchainHistoryOracle : public HistoryOracle {
+ public:
+  explicit BlockchainHistoryOracle(Blockchain* blockchain)
+    : blockchain_(blockchain) {}
+  virtual bool HasHistory(const bytes_t& hash160);
+
+ private:
+  Blockchain* blockchain_;
+};
+
+class DiscoveredAccount {
+ public:
+  DiscoveredAccount(uint32_t account,
+                    const std::string& ext_pub_b58,
+                    uint32_t external_count,
+                    uint32_t internal_count)
+    : account_(account), ext_pub_b58_(ext_pub_b58),
+      external_count_(external_count), internal_count_(internal_count) {}
+
+  // The k in m/44'/coin'/k'.
+  uint32_t account() const { return account_; }
+  const std::string& ext_pub_b58() const { return ext_pub_b58_; }
+
+  // One past the highest used index on each chain, i.e., how many
+  // addresses a wallet must watch to see all of the history.
+  uint32_t external_count() const { return external_count_; }
+  uint32_t internal_count() const { return internal_count_; }
+
+ private:
+  uint32_t account_;
+  std::string ext_pub_b58_;
+  uint32_t external_count_;
+  uint32_t internal_count_;
+};
+typedef std::vector<DiscoveredAccount> discovered_accounts_t;
+
+// BIP 0044 account discovery. Accounts m/44'/coin'/k' are examined
+// account_concurrency at a time: both chains of each are scanned in
+// rounds, with every round's addresses derived on a WorkerPool and
+// then checked against the oracle, until each chain has address_gap
+// unused addresses past its last used one. An account whose external
+// chain is unused ends discovery, as BIP 0044 specifies.
+class AccountDiscovery {
+ public:
+  // master_node must be private, since account nodes are hardened.
+  AccountDiscovery(const Node& master_node, HistoryOracle* oracle);
+
+  void set_coin_type(uint32_t coin_type) { coin_type_ = coin_type; }
+  // BIP 0044 says 20.
+  void set_address_gap(uint32_t gap) { address_gap_ = gap > 0 ? gap : 1; }
+  void set_account_concurrency(size_t count) {
+    account_concurrency_ = count > 0 ? count : 1;
+  }
+  void set_thread_count(size_t count) { thread_count_ = count; }
+
+  // Fills accounts with the used accounts, in order. Returns false if
+  // any account or chain node couldn't be derived.
+  bool Discover(discovered_accounts_t& accounts);
+
+ private:
+  const Node& master_node_;
+  HistoryOracle* oracle_;
+  uint32_t coin_type_;
+  uint32_t address_gap_;
+  size_t account_concurrency_;
+  size_t thread_count_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(AccountDiscovery);
+};
+
+#endif  // #if !defined(__ACCOUNT_DISCOVERY_H__)
@@ -0,0 +1,136 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <memory>
+#include <set>
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+#include "account_discovery.h"
+#include "base58.h"
+#include "blockchain.h"
+#include "node.h"
+#include "node_factory.h"
+#include "tx.h"
+#include "types.h"
+
+class SetHistoryOracle : public HistoryOracle {
+ public:
+  SetHistoryOracle() : lookups_(0) {}
+  virtual bool HasHistory(const bytes_t& hash160) {
+    ++lookups_;
+    return used_.count(hash160) != 0;
+  }
+
+  std::set<bytes_t> used_;
+  int lookups_;
+};
+
+static bytes_t AddressFor(const Node& master_node,
+                          uint32_t account, uint32_t chain, uint32_t index) {
+  std::stringstream path;
+  path << "m/44'/0'/" << account << "'/" << chain << "/" << index;
+  std::auto_ptr<Node> node(NodeFactory::DeriveChildNodeWithPath(master_node,
+                                                                path.str()));
+  return node->hex_id();
+}
+
+static Node* CreateMasterNode() {
+  const bytes_t seed(unhexlify("000102030405060708090a0b0c0d0e0f"));
+  return NodeFactory::CreateNodeFromSeed(seed);
+}
+
+TEST(AccountDiscoveryTest, FindsAccountsAndGaps) {
+  std::auto_ptr<Node> master_node(CreateMasterNode());
+  SetHistoryOracle oracle;
+  // Each use is within the gap of the previous one.
+  oracle.used_.insert(AddressFor(*master_node, 0, 0, 0));
+  oracle.used_.insert(AddressFor(*master_node, 0, 0, 15));
+  oracle.used_.insert(AddressFor(*master_node, 0, 0, 30));
+  oracle.used_.insert(AddressFor(*master_node, 0, 1, 3));
+  oracle.used_.insert(AddressFor(*master_node, 1, 0, 5));
+  // Account 2 is unused, so account 3 is never reached.
+  oracle.used_.insert(AddressFor(*master_node, 3, 0, 0));
+
+  AccountDiscovery discovery(*master_node, &oracle);
+  discovery.set_account_concurrency(2);
+  discovery.set_thread_count(3);
+  discovered_accounts_t accounts;
+  EXPECT_TRUE(discovery.Discover(accounts));
+  ASSERT_EQ(2, accounts.size());
+
+  EXPECT_EQ(0, accounts[0].account());
+  EXPECT_EQ(31, accounts[0].external_count());
+  EXPECT_EQ(4, accounts[0].internal_count());
+  std::auto_ptr<Node>
+    account_node(NodeFactory::DeriveChildNodeWithPath(*master_node,
+                                                      "m/44'/0'/0'"));
+  EXPECT_EQ(Base58::toBase58Check(account_node->toSerializedPublic()),
+            accounts[0].ext_pub_b58());
+
+  EXPECT_EQ(1, accounts[1].account());
+  EXPECT_EQ(6, accounts[1].external_count());
+  EXPECT_EQ(0, accounts[1].internal_count());
+
+  // Nothing past the gap. Account 3 shares a window with account 2,
+  // so it's scanned even though it isn't reported.
+  EXPECT_EQ(51 + 24 +  // account 0
+            26 + 20 +  // account 1
+            20 + 20 +  // account 2
+            21 + 20,   // account 3
+            oracle.lookups_);
+}
+
+TEST(AccountDiscoveryTest, NothingUsed) {
+  std::auto_ptr<Node> master_node(CreateMasterNode());
+  SetHistoryOracle oracle;
+  AccountDiscovery discovery(*master_node, &oracle);
+  discovery.set_address_gap(5);
+  discovered_accounts_t accounts;
+  EXPECT_TRUE(discovery.Discover(accounts));
+  EXPECT_TRUE(accounts.empty());
+
+  // Public nodes can't derive hardened accounts.
+  std::auto_ptr<Node>
+    public_node(NodeFactory::CreateNodeFromExtended(master_node->
+                                                    toSerializedPublic()));
+  AccountDiscovery public_discovery(*public_node, &oracle);
+  EXPECT_FALSE(public_discovery.Discover(accounts));
+}
+
+TEST(AccountDiscoveryTest, BlockchainOracle) {
+  std::auto_ptr<Node> master_node(CreateMasterNode());
+  std::auto_ptr<Blockchain> b(new Blockchain);
+  Transaction tx;
+  tx.Add(TxIn("account discovery test"));
+  tx.Add(TxOut(100000, AddressFor(*master_node, 0, 0, 2)));
+  b->AddTransaction(tx.Serialize());
+
+  BlockchainHistoryOracle oracle(b.get());
+  AccountDiscovery discovery(*master_node, &oracle);
+  discovery.set_address_gap(5);
+  discovered_accounts_t accounts;
+  EXPECT_TRUE(discovery.Discover(accounts));
+  ASSERT_EQ(1, accounts.size());
+  EXPECT_EQ(3, accounts[0].external_count());
+}
@@ -0,0 +1,133 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "address_pool.h"
+
+#include "node_factory.h"
+#include "worker_pool.h"
+
+AddressPool::AddressPool(const Node& chain_node,
+                         uint32_t next_index,
+                         size_t depth)
+  : chain_node_(chain_node), depth_(depth), has_thread_(false),
+    should_stop_(false), next_index_(next_index), generation_(0) {
+  // Fill in the lazily computed parts of the node while it's still
+  // ours alone.
+  chain_node_.fingerprint();
+
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&wake_worker_, NULL);
+  pthread_cond_init(&address_ready_, NULL);
+  if (depth_ > 0) {
+    WorkerPool::EnableOpenSSLThreading();
+    has_thread_ = pthread_create(&thread_, NULL, ThreadMain, this) == 0;
+  }
+}
+
+AddressPool::~AddressPool() {
+  pthread_mutex_lock(&mutex_);
+  should_stop_ = true;
+  pthread_cond_signal(&wake_worker_);
+  pthread_mutex_unlock(&mutex_);
+  if (has_thread_) {
+    pthread_join(thread_, NULL);
+  }
+  pthread_cond_destroy(&address_ready_);
+  pthread_cond_destroy(&wake_worker_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+bool AddressPool::Take(uint32_t index, bytes_t& hash160) {
+  pthread_mutex_lock(&mutex_);
+  const bool is_ready = !ready_.empty() && next_index_ == index;
+  if (is_ready) {
+    hash160.swap(ready_.front());
+    ready_.pop_front();
+    ++next_index_;
+    pthread_cond_signal(&wake_worker_);
+  }
+  pthread_mutex_unlock(&mutex_);
+  return is_ready;
+}
+
+void AddressPool::Restart(uint32_t next_index) {
+  pthread_mutex_lock(&mutex_);
+  if (next_index_ != next_index) {
+    next_index_ = next_index;
+    ready_.clear();
+    ++generation_;
+    pthread_cond_signal(&wake_worker_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+size_t AddressPool::ready_count() {
+  pthread_mutex_lock(&mutex_);
+  const size_t count = ready_.size();
+  pthread_mutex_unlock(&mutex_);
+  return count;
+}
+
+void AddressPool::WaitUntilFull() {
+  pthread_mutex_lock(&mutex_);
+  while (has_thread_ && ready_.size() < depth_) {
+    pthread_cond_wait(&address_ready_, &mutex_);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+void* AddressPool::ThreadMain(void* arg) {
+  static_cast<AddressPool*>(arg)->WorkerLoop();
+  return NULL;
+}
+
+void AddressPool::WorkerLoop() {
+  pthread_mutex_lock(&mutex_);
+  while (true) {
+    while (!should_stop_ && ready_.size() >= depth_) {
+      pthread_cond_wait(&wake_worker_, &mutex_);
+    }
+    if (should_stop_) {
+      break;
+    }
+    const uint32_t index = next_index_ + ready_.size();
+    const uint32_t generation = generation_;
+    pthread_mutex_unlock(&mutex_);
+
+    // The slow part runs unlocked so Take() never waits on it.
+    Node child_node(chain_node_);
+    bytes_t hash160;
+    if (NodeFactory::DeriveChildNode(chain_node_, index, child_node)) {
+      hash160 = child_node.hex_id();
+    }
+
+    pthread_mutex_lock(&mutex_);
+    if (generation == generation_ &&
+        index == next_index_ + ready_.size()) {
+      // An underivable index is queued empty, so the caller can skip
+      // it just as it would have when deriving it in place.
+      ready_.push_back(hash160);
+      pthread_cond_broadcast(&address_ready_);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
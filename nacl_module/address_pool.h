@@ -0,0 +1,89 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__ADDRESS_POOL_H__)
+#define __ADDRESS_POOL_H__
+
+#include <pthread.h>
+
+#include <deque>
+
+#include "node.h"
+#include "types.h"
+
+// Keeps the hash160s of the next few addresses on one BIP 0032 chain
+// (e.g., m/0) derived ahead of time on a background thread, so that
+// a wallet crossing its address gap can pick them up without doing
+// any EC math on the caller's thread.
+//
+// The pool expects to be drained in index order. A caller that gets
+// a miss derives the address itself and tells the pool with
+// Restart() where to pick up.
+class AddressPool {
+ public:
+  // Only non-hardened children are derived, so chain_node can be
+  // public. The background thread starts right away unless depth is
+  // zero.
+  AddressPool(const Node& chain_node, uint32_t next_index, size_t depth);
+  ~AddressPool();
+
+  // If the hash160 for index is ready, hands it over in O(1) and
+  // returns true. Returns false without blocking otherwise. The
+  // hash160 is empty for the rare index that can't be derived.
+  bool Take(uint32_t index, bytes_t& hash160);
+
+  // Discards anything queued and starts over from next_index, unless
+  // that's where the pool already is.
+  void Restart(uint32_t next_index);
+
+  size_t ready_count();
+
+  // Blocks until depth addresses are ready. For tests.
+  void WaitUntilFull();
+
+ private:
+  static void* ThreadMain(void* arg);
+  void WorkerLoop();
+
+  const Node chain_node_;
+  const size_t depth_;
+
+  // Everything below is guarded by mutex_.
+  pthread_mutex_t mutex_;
+  pthread_cond_t wake_worker_;
+  pthread_cond_t address_ready_;
+  pthread_t thread_;
+  bool has_thread_;
+  bool should_stop_;
+
+  // ready_ holds hash160s for next_index_, next_index_ + 1, ...
+  uint32_t next_index_;
+  std::deque<bytes_t> ready_;
+
+  // Bumped by Restart() so the worker can tell its in-flight result
+  // has gone stale.
+  uint32_t generation_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(AddressPool);
+};
+
+#endif  // #if !defined(__ADDRESS_POOL_H__)
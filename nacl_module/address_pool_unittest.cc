@@ -0,0 +1,89 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <memory>
+
+#include "gtest/gtest.h"
+
+#include "address_pool.h"
+#include "node.h"
+#include "node_factory.h"
+#include "types.h"
+
+static Node* CreateChainNode() {
+  const bytes_t seed(unhexlify("000102030405060708090a0b0c0d0e0f"));
+  std::auto_ptr<Node> root(NodeFactory::CreateNodeFromSeed(seed));
+  return NodeFactory::DeriveChildNodeWithPath(*root, "m/0");
+}
+
+static bytes_t ExpectedHash160(const Node& chain_node, uint32_t index) {
+  std::auto_ptr<Node> node(NodeFactory::DeriveChildNode(chain_node, index));
+  return node->hex_id();
+}
+
+TEST(AddressPoolTest, TakeInOrder) {
+  std::auto_ptr<Node> chain_node(CreateChainNode());
+  AddressPool pool(*chain_node, 3, 5);
+  pool.WaitUntilFull();
+  EXPECT_EQ(5, pool.ready_count());
+
+  // Only the next index is ever handed out.
+  bytes_t hash160;
+  EXPECT_FALSE(pool.Take(4, hash160));
+  EXPECT_TRUE(pool.Take(3, hash160));
+  EXPECT_EQ(ExpectedHash160(*chain_node, 3), hash160);
+  EXPECT_TRUE(pool.Take(4, hash160));
+  EXPECT_EQ(ExpectedHash160(*chain_node, 4), hash160);
+
+  // The worker tops it back up.
+  pool.WaitUntilFull();
+  EXPECT_EQ(5, pool.ready_count());
+  for (uint32_t i = 5; i < 10; ++i) {
+    EXPECT_TRUE(pool.Take(i, hash160));
+    EXPECT_EQ(ExpectedHash160(*chain_node, i), hash160);
+  }
+}
+
+TEST(AddressPoolTest, Restart) {
+  std::auto_ptr<Node> chain_node(CreateChainNode());
+  AddressPool pool(*chain_node, 0, 3);
+  pool.WaitUntilFull();
+
+  // Same place: nothing's thrown away.
+  pool.Restart(0);
+  EXPECT_EQ(3, pool.ready_count());
+
+  pool.Restart(100);
+  pool.WaitUntilFull();
+  bytes_t hash160;
+  EXPECT_FALSE(pool.Take(0, hash160));
+  EXPECT_TRUE(pool.Take(100, hash160));
+  EXPECT_EQ(ExpectedHash160(*chain_node, 100), hash160);
+}
+
+TEST(AddressPoolTest, ZeroDepth) {
+  std::auto_ptr<Node> chain_node(CreateChainNode());
+  AddressPool pool(*chain_node, 0, 0);
+  pool.WaitUntilFull();
+  bytes_t hash160;
+  EXPECT_FALSE(pool.Take(0, hash160));
+}
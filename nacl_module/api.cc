@@ -43,9 +43,14 @@
 #include "node.h"
 #include "encrypting_node_factory.h"
 #include "tx.h"
+#include "tx_view.h"
 #include "types.h"
 #include "wallet.h"
 
+// Enough for a few gap crossings between reports without any
+// derivation on the message thread.
+const size_t ADDRESS_LOOK_AHEAD_DEPTH = 16;
+
 // echo -n "Happynine Copyright 2014 Mike Tsao." | sha256sum
 const std::string PASSPHRASE_CHECK_HEX =
   "df3bc110ce022d64a20503502a9edfd8acda8a39868e5dff6601c0bb9b6f9cf9";
@@ -328,8 +333,11 @@ bool API::HandleRestoreNode(const Json::Value& args, Json::Value& result) {
     ext_prv_enc_ = ext_prv_enc;
     GenerateMasterNode();
   } else {
+    // Optional; lets a returning wallet skip deriving its addresses.
+    const bytes_t address_cache(unhexlify(args["address_cache"].asString()));
     wallet_.reset(new Wallet(blockchain_, credentials_,
-                             ext_pub_b58, ext_prv_enc));
+                             ext_pub_b58, ext_prv_enc, address_cache));
+    wallet_->set_look_ahead_depth(ADDRESS_LOOK_AHEAD_DEPTH);
     result["wallet"] = wallet_.get();
   }
   GenerateNodeResponse(result, node.get(), ext_prv_enc, false);
@@ -375,6 +383,19 @@ bool API::HandleGetAddresses(const Json::Value& /*args*/,
   return true;
 }
 
+bool API::HandleGetAddressCache(const Json::Value& /*args*/,
+                                Json::Value& result) {
+  if (!wallet_.get()) {
+    SetError(result, ERROR_MISSING_CHILD_NODE, "No child node set");
+    return true;
+  }
+
+  bytes_t address_cache;
+  wallet_->ExportAddressCache(address_cache);
+  result["address_cache"] = to_hex(address_cache);
+  return true;
+}
+
 bool API::HandleGetHistory(const Json::Value& /*args*/,
                            Json::Value& result) {
   if (!wallet_.get()) {
@@ -417,29 +438,93 @@ bool API::HandleReportTxs(const Json::Value& args, Json::Value& /*result*/) {
   return true;
 }
 
-bool API::HandleCreateTx(const Json::Value& args, Json::Value& result) {
-  const bool should_sign = args["sign"].asBool();
-  const uint64_t fee = args["fee"].asUInt64();
-
-  tx_outs_t recipient_txos;
-  for (unsigned int i = 0; i < args["recipients"].size(); ++i) {
-    Json::Value recipient = args["recipients"][i];
+static void ParseRecipients(const Json::Value& recipients,
+                            tx_outs_t& recipient_txos) {
+  for (unsigned int i = 0; i < recipients.size(); ++i) {
+    Json::Value recipient = recipients[i];
     const std::string address(recipient["addr_b58"].asString());
     const bytes_t recipient_addr_b58(Base58::fromAddress(address));
     uint64_t value = recipient["value"].asUInt64();
     TxOut recipient_txo(value, recipient_addr_b58);
     recipient_txos.push_back(recipient_txo);
   }
+}
+
+// The hash of a raw tx in the byte order release-tx expects.
+static std::string TxHashHex(const bytes_t& tx) {
+  TxView view;
+  if (!view.Parse(tx)) {
+    return std::string();
+  }
+  return to_hex(view.hash());
+}
+
+bool API::HandleCreateTx(const Json::Value& args, Json::Value& result) {
+  const bool should_sign = args["sign"].asBool();
+  const uint64_t fee = args["fee"].asUInt64();
+  const uint64_t fee_rate = args["fee_rate"].asUInt64();
+
+  tx_outs_t recipient_txos;
+  ParseRecipients(args["recipients"], recipient_txos);
 
   bytes_t tx;
-  if (wallet_->CreateTx(recipient_txos, fee, should_sign, tx)) {
+  if (wallet_->CreateTx(recipient_txos, fee, fee_rate, should_sign, tx)) {
     result["tx"] = to_hex(tx);
+    result["tx_hash"] = TxHashHex(tx);
+  } else {
+    SetError(result, ERROR_TRANSACTION_FAILED, "Transaction creation failed.");
+  }
+  return true;
+}
+
+bool API::HandleCreateTxBatch(const Json::Value& args, Json::Value& result) {
+  if (!wallet_.get()) {
+    SetError(result, ERROR_MISSING_CHILD_NODE, "No child node set");
+    return true;
+  }
+
+  const uint64_t fee = args["fee"].asUInt64();
+  const uint64_t fee_rate = args["fee_rate"].asUInt64();
+  const size_t max_tx_size = args["max_tx_size"].asUInt();
+
+  // Either explicit groups, or one big list for max_tx_size to split.
+  std::vector<tx_outs_t> recipient_groups;
+  if (args.isMember("groups")) {
+    for (unsigned int i = 0; i < args["groups"].size(); ++i) {
+      recipient_groups.push_back(tx_outs_t());
+      ParseRecipients(args["groups"][i], recipient_groups.back());
+    }
+  } else {
+    recipient_groups.push_back(tx_outs_t());
+    ParseRecipients(args["recipients"], recipient_groups.back());
+  }
+
+  std::vector<bytes_t> txs;
+  if (wallet_->CreateTxBatch(recipient_groups, fee, fee_rate, max_tx_size,
+                             txs)) {
+    result["txs"] = Json::Value(Json::arrayValue);
+    result["tx_hashes"] = Json::Value(Json::arrayValue);
+    for (size_t i = 0; i < txs.size(); ++i) {
+      result["txs"].append(to_hex(txs[i]));
+      result["tx_hashes"].append(TxHashHex(txs[i]));
+    }
   } else {
     SetError(result, ERROR_TRANSACTION_FAILED, "Transaction creation failed.");
   }
   return true;
 }
 
+bool API::HandleReleaseTx(const Json::Value& args, Json::Value& result) {
+  if (!wallet_.get()) {
+    SetError(result, ERROR_MISSING_CHILD_NODE, "No child node set");
+    return true;
+  }
+
+  const bytes_t tx_hash(unhexlify(args["tx_hash"].asString()));
+  result["released"] = wallet_->ReleaseTx(tx_hash);
+  return true;
+}
+
 bool API::HandleConfirmBlock(const Json::Value& args,
                              Json::Value& /*result*/) {
   const uint64_t block_height = args["block_height"].asUInt64();
@@ -83,6 +83,8 @@ class API {
   // Addresses
   bool HandleGetAddresses(const Json::Value& args, Json::Value& result);
 
+  bool HandleGetAddressCache(const Json::Value& args, Json::Value& result);
+
   // Transactions
   bool HandleGetHistory(const Json::Value& args, Json::Value& result);
 
@@ -92,6 +94,14 @@ class API {
 
   bool HandleCreateTx(const Json::Value& args, Json::Value& result);
 
+  // Several txs at once: "groups" of recipients, or a single
+  // "recipients" list split under "max_tx_size".
+  bool HandleCreateTxBatch(const Json::Value& args, Json::Value& result);
+
+  // For a created tx that won't be broadcast: frees its inputs and
+  // change address for the next one.
+  bool HandleReleaseTx(const Json::Value& args, Json::Value& result);
+
   // Blocks
   bool HandleConfirmBlock(const Json::Value& args, Json::Value& result);
 
@@ -32,6 +32,7 @@
 #include "jsoncpp/json/writer.h"
 #include "mnemonic.h"
 #include "test_constants.h"
+#include "tx_view.h"
 #include "types.h"
 #include "wallet.h"
 
@@ -54,6 +55,17 @@ static void Spend(API* api,
   EXPECT_TRUE(api->DidResponseSucceed(response));
   EXPECT_TRUE(response["tx"].asString().size() > 0);
   const bytes_t tx(unhexlify(response["tx"].asString()));
+  TxView view;
+  ASSERT_TRUE(view.Parse(tx));
+  EXPECT_EQ(to_hex(view.hash()), response["tx_hash"].asString());
+
+  // The reported hash is the one release-tx takes. Releasing doesn't
+  // stop the tx from being reported below.
+  request = Json::Value();
+  request["tx_hash"] = response["tx_hash"];
+  response = Json::Value();
+  EXPECT_TRUE(api->HandleReleaseTx(request, response));
+  EXPECT_TRUE(response["released"].asBool());
 
   // Broadcast the transaction (no code, pretend).
 #if defined(BE_LOUD)
@@ -285,6 +297,24 @@ TEST(ApiTest, HappyPath) {
   EXPECT_TRUE(GetHistoryResponseContains(response, ADDR_1Guw_B58, -28070));
 }
 
+TEST(ApiTest, SpendWithoutWallet) {
+  std::auto_ptr<Blockchain> b(new Blockchain);
+  std::auto_ptr<Credentials> c(new Credentials);
+  std::auto_ptr<Mnemonic> m(new Mnemonic);
+  std::auto_ptr<API> api(new API(b.get(), c.get(), m.get()));
+  Json::Value request;
+  Json::Value response;
+
+  // No master node has been set up, so there's no wallet to spend from or
+  // release txs back into.
+  EXPECT_TRUE(api->HandleCreateTxBatch(request, response));
+  EXPECT_EQ(ERROR_MISSING_CHILD_NODE, api->GetErrorCode(response));
+
+  response = Json::Value();
+  EXPECT_TRUE(api->HandleReleaseTx(request, response));
+  EXPECT_EQ(ERROR_MISSING_CHILD_NODE, api->GetErrorCode(response));
+}
+
 TEST(ApiTest, BadExtPrvB58) {
   std::auto_ptr<Blockchain> b(new Blockchain);
   std::auto_ptr<Credentials> c(new Credentials);
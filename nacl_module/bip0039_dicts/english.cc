@@ -1,3 +1,4 @@
+// Generated by generate_wordlist_initializer.py. Sorted; see mnemonic.cc.
 static const char* static_words[] = {
 "abandon",
 "ability",
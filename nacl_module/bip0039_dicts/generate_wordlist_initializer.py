@@ -20,9 +20,20 @@
 # CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
-quoted_words = ['"%s"' % w.strip() for w in
-                open('english.txt', 'r').readlines()]
+import sys
 
+words = [w.strip() for w in open('english.txt', 'r').readlines()]
+
+# Mnemonic looks words up by binary search, so the table must already
+# be in strcmp() order. BIP 0039 wordlists are published sorted, but
+# check rather than silently emit a table that lookups would miss.
+if words != sorted(words):
+  sys.stderr.write("english.txt is not sorted\n")
+  sys.exit(1)
+
+quoted_words = ['"%s"' % w for w in words]
+
+print "// Generated by generate_wordlist_initializer.py. Sorted; see mnemonic.cc."
 print "static const char* static_words[] = {"
 print ',\n'.join(quoted_words)
 print "};"
@@ -23,9 +23,9 @@
 #include "blockchain.h"
 
 #include <cstdlib>
-#include <istream>
+#include <iostream>  // cerr
+#include <map>
 #include <memory>
-#include <sstream>
 
 #include "debug.h"
 
@@ -39,62 +39,59 @@ HistoryItem::HistoryItem(const bytes_t& tx_hash,
     value_(value), fee_(fee), inputs_are_known_(inputs_are_known) {
   }
 
+// Outputs whose scripts we can't read pay no address at all.
+static bool PaysAddress(const TxStore& tx_store, uint32_t output) {
+  return tx_store.output_script_type(output) != SCRIPT_TYPE_UNKNOWN;
+}
+
+static bool PaysAddressIn(const TxStore& tx_store, uint32_t output,
+                          const Blockchain::address_set_t& addresses) {
+  return PaysAddress(tx_store, output) &&
+    addresses.count(tx_store.output_key(output)) != 0;
+}
+
 Blockchain::Blockchain()
   : max_block_height_(0) {
 }
 
 Blockchain::~Blockchain() {
-  for (transaction_map_t::const_iterator i = transactions_.begin();
-       i != transactions_.end();
-       ++i) {
-    delete i->second;
-  }
 }
 
+// Far beyond any real chain, but small enough that a bogus height
+// can't make block_timestamps_ eat all our memory.
+static const uint64_t MAX_BLOCK_HEIGHT = 16 * 1024 * 1024;
+
 void Blockchain::ConfirmBlock(uint64_t height, uint64_t timestamp) {
+  if (height > MAX_BLOCK_HEIGHT) {
+    std::cerr << "rejecting block height " << height << std::endl;
+    return;
+  }
+  if (height >= block_timestamps_.size()) {
+    block_timestamps_.resize(height + 1, 0);
+  }
   block_timestamps_[height] = timestamp;
   if (height > max_block_height_) {
     max_block_height_ = height;
   }
 }
 
-Transaction* Blockchain::GetTransaction(const tx_hash_t& tx_hash) {
-  if (transactions_.count(tx_hash) == 0) {
-    return NULL;
-  }
-  return transactions_[tx_hash];
-}
-
 void Blockchain::MarkSpentTxos() {
   // Check every input to see which output it spends, and if we know
   // about that output, mark it spent.
-  for (transaction_map_t::const_iterator i = transactions_.begin();
-       i != transactions_.end();
-       ++i) {
-    for (tx_ins_t::const_iterator j = i->second->inputs().begin();
-         j != i->second->inputs().end();
-         ++j) {
-      if (GetTransaction(j->prev_txo_hash()) != NULL) {
-        Transaction* affected_tx = GetTransaction(j->prev_txo_hash());
-        affected_tx->MarkOutputSpent(j->prev_txo_index());
-      }
+  for (uint32_t i = 0; i < tx_store_.input_count(); ++i) {
+    uint32_t output;
+    if (tx_store_.FindSpentOutput(i, output)) {
+      tx_store_.MarkSpent(output);
     }
   }
 }
 
 void Blockchain::CalculateUnspentTxos() {
-  unspent_txos_.clear();
+  unspent_outputs_.clear();
 
-  for (transaction_map_t::const_iterator i = transactions_.begin();
-       i != transactions_.end();
-       ++i) {
-    for (tx_outs_t::const_iterator j = i->second->outputs().begin();
-         j != i->second->outputs().end();
-         ++j) {
-      if (!j->is_spent()) {
-        unspent_txos_.push_back(TxOut(j->value(), j->script(),
-                                      j->tx_output_n(), i->first));
-      }
+  for (uint32_t i = 0; i < tx_store_.output_count(); ++i) {
+    if (!tx_store_.is_spent(i)) {
+      unspent_outputs_.push_back(i);
     }
   }
 }
@@ -102,37 +99,37 @@ void Blockchain::CalculateUnspentTxos() {
 void Blockchain::CalculateBalances() {
   balances_.clear();
 
-  for (tx_outs_t::const_iterator i = unspent_txos_.begin();
-       i != unspent_txos_.end();
+  for (std::vector<uint32_t>::const_iterator i = unspent_outputs_.begin();
+       i != unspent_outputs_.end();
        ++i) {
-    balances_[i->GetSigningAddress()] += i->value();
+    if (PaysAddress(tx_store_, *i)) {
+      balances_[tx_store_.output_key(*i)] += tx_store_.output_value(*i);
+    }
   }
 }
 
 void Blockchain::CalculateTransactionCounts() {
   tx_counts_.clear();
 
-  for (transaction_map_t::const_iterator txh = transactions_.begin();
-       txh != transactions_.end();
-       ++txh) {
-    const Transaction* tx = txh->second;
-
+  for (uint32_t tx = 0; tx < tx_store_.tx_count(); ++tx) {
     // Check the inputs.
-    for (tx_ins_t::const_iterator i = tx->inputs().begin();
-         i != tx->inputs().end();
+    for (uint32_t i = tx_store_.inputs_begin(tx);
+         i != tx_store_.inputs_end(tx);
          ++i) {
-      if (GetTransaction(i->prev_txo_hash())) {
-        Transaction* affected_tx = GetTransaction(i->prev_txo_hash());
-        const TxOut *txo = &affected_tx->outputs()[i->prev_txo_index()];
-        ++tx_counts_[txo->GetSigningAddress()];
+      uint32_t output;
+      if (tx_store_.FindSpentOutput(i, output) &&
+          PaysAddress(tx_store_, output)) {
+        ++tx_counts_[tx_store_.output_key(output)];
       }
     }
 
     // Check the outputs.
-    for (tx_outs_t::const_iterator i = tx->outputs().begin();
-         i != tx->outputs().end();
+    for (uint32_t i = tx_store_.outputs_begin(tx);
+         i != tx_store_.outputs_end(tx);
          ++i) {
-      ++tx_counts_[i->GetSigningAddress()];
+      if (PaysAddress(tx_store_, i)) {
+        ++tx_counts_[tx_store_.output_key(i)];
+      }
     }
   }
 }
@@ -145,93 +142,108 @@ void Blockchain::UpdateDerivedInformation() {
 }
 
 void Blockchain::AddTransaction(const tx_t& transaction) {
-  std::istringstream is;
-  const char* p = reinterpret_cast<const char*>(&transaction[0]);
-  is.rdbuf()->pubsetbuf(const_cast<char*>(p), transaction.size());
-  Transaction* tx = new Transaction(is);
-  transactions_[tx->hash()] = tx;
+  uint32_t tx;
+  if (!tx_store_.Add(transaction, tx)) {
+    std::cerr << "rejecting malformed tx" << std::endl;
+    return;
+  }
 
   UpdateDerivedInformation();
 }
 
 void Blockchain::ConfirmTransaction(const tx_hash_t& tx_hash,
                                     uint64_t height) {
-  tx_heights_[tx_hash] = height;
+  if (tx_hash.size() == Hash256::SIZE) {
+    tx_heights_[Hash256(tx_hash)] = height;
+  }
 }
 
 void Blockchain::GetUnspentTxos(const address_set_t& addresses,
                                 tx_outs_t& unspent_txos) {
+  // Pick the outputs first, so that only those get copied out, into
+  // a vector that's sized once.
+  std::vector<uint32_t> outputs;
+  if (addresses.empty()) {
+    outputs = unspent_outputs_;
+  } else {
+    for (std::vector<uint32_t>::const_iterator i = unspent_outputs_.begin();
+         i != unspent_outputs_.end();
+         ++i) {
+      if (PaysAddressIn(tx_store_, *i, addresses)) {
+        outputs.push_back(*i);
+      }
+    }
+  }
+
   unspent_txos.clear();
-  for (tx_outs_t::const_iterator i = unspent_txos_.begin();
-       i != unspent_txos_.end();
+  unspent_txos.reserve(outputs.size());
+  for (std::vector<uint32_t>::const_iterator i = outputs.begin();
+       i != outputs.end();
        ++i) {
-    if (addresses.empty() ||
-        addresses.count(i->GetSigningAddress()) != 0) {
-      unspent_txos.push_back(*i);
-    }
+    unspent_txos.push_back(TxOut(tx_store_.output_value(*i),
+                                 tx_store_.output_script(*i),
+                                 tx_store_.output_n(*i),
+                                 tx_store_.hash(tx_store_.output_tx(*i)),
+                                 tx_store_.output_script_type(*i),
+                                 tx_store_.output_signing_address(*i)));
   }
 }
 
+bool Blockchain::HasTransaction(const tx_hash_t& tx_hash) const {
+  uint32_t tx;
+  return tx_store_.Find(tx_hash, tx);
+}
+
 uint64_t Blockchain::GetTransactionHeight(const tx_hash_t& tx_hash) {
-  return tx_heights_[tx_hash];
+  const uint64_t* height = tx_heights_.Find(Hash256(tx_hash));
+  return height ? *height : 0;
 }
 
 uint64_t Blockchain::GetTransactionTimestamp(const tx_hash_t& tx_hash) {
-  if (tx_heights_.count(tx_hash) == 0) {
-    return 0;
-  }
-  return GetBlockTimestamp(tx_heights_[tx_hash]);
+  const uint64_t* height = tx_heights_.Find(Hash256(tx_hash));
+  return height ? GetBlockTimestamp(*height) : 0;
 }
 
 uint64_t Blockchain::GetBlockTimestamp(uint64_t height) {
-  if (block_timestamps_.count(height) != 0) {
+  if (height < block_timestamps_.size()) {
     return block_timestamps_[height];
   }
   return 0;
 }
 
 uint64_t Blockchain::GetAddressBalance(const Blockchain::address_t& address) {
-  if (balances_.count(address) != 0) {
-    return balances_[address];
-  }
-  return 0;
+  const uint64_t* balance = balances_.Find(Hash160(address));
+  return balance ? *balance : 0;
 }
 
 uint64_t Blockchain::GetAddressTxCount(const Blockchain::address_t& address) {
-  if (tx_counts_.count(address) != 0) {
-    return tx_counts_[address];
-  }
-  return 0;
+  const uint64_t* tx_count = tx_counts_.Find(Hash160(address));
+  return tx_count ? *tx_count : 0;
 }
 
 void Blockchain::
 GetTransactionsForAddresses(const address_set_t& addresses,
-                            std::vector<const Transaction*>& transactions) {
-  transactions.clear();
-  for (transaction_map_t::const_iterator txh = transactions_.begin();
-       txh != transactions_.end();
-       ++txh) {
-    const Transaction* tx = txh->second;
+                            std::vector<tx_hash_t>& tx_hashes) {
+  tx_hashes.clear();
+  for (uint32_t tx = 0; tx < tx_store_.tx_count(); ++tx) {
     bool is_in_address_set = false;
 
-    for (tx_ins_t::const_iterator i = tx->inputs().begin();
-         i != tx->inputs().end();
+    for (uint32_t i = tx_store_.inputs_begin(tx);
+         i != tx_store_.inputs_end(tx);
          ++i) {
-      if (GetTransaction(i->prev_txo_hash())) {
-        Transaction* source_tx = GetTransaction(i->prev_txo_hash());
-        const TxOut *txo = &source_tx->outputs()[i->prev_txo_index()];
-        if (addresses.count(txo->GetSigningAddress()) != 0) {
-          is_in_address_set = true;
-          break;
-        }
+      uint32_t output;
+      if (tx_store_.FindSpentOutput(i, output) &&
+          PaysAddressIn(tx_store_, output, addresses)) {
+        is_in_address_set = true;
+        break;
       }
     }
 
     if (!is_in_address_set) {
-      for (tx_outs_t::const_iterator i = tx->outputs().begin();
-           i != tx->outputs().end();
+      for (uint32_t i = tx_store_.outputs_begin(tx);
+           i != tx_store_.outputs_end(tx);
            ++i) {
-        if (addresses.count(i->GetSigningAddress()) != 0) {
+        if (PaysAddressIn(tx_store_, i, addresses)) {
           is_in_address_set = true;
           break;
         }
@@ -239,29 +251,34 @@ GetTransactionsForAddresses(const address_set_t& addresses,
     }
 
     if (is_in_address_set) {
-      transactions.push_back(tx);
+      tx_hashes.push_back(tx_store_.hash(tx));
     }
   }
 }
 
 HistoryItem Blockchain::
 TransactionToHistoryItem(const address_set_t& addresses,
-                         const Transaction* transaction) {
-  std::map<address_t, int64_t> balances;
+                         const tx_hash_t& tx_hash) {
+  std::map<Hash160, int64_t> balances;
   int64_t all_txin = 0;
   int64_t all_txo = 0;
   bool inputs_are_known = true;
 
+  uint32_t tx;
+  if (!tx_store_.Find(tx_hash, tx)) {
+    return HistoryItem(tx_hash, address_t(), 0, 0, 0, false);
+  }
+
   // Tally up all inputs, mapped to addresses we care about.
-  for (tx_ins_t::const_iterator i = transaction->inputs().begin();
-       i != transaction->inputs().end();
+  for (uint32_t i = tx_store_.inputs_begin(tx);
+       i != tx_store_.inputs_end(tx);
        ++i) {
-    if (GetTransaction(i->prev_txo_hash())) {
-      Transaction* source_tx = GetTransaction(i->prev_txo_hash());
-      const TxOut *txo = &source_tx->outputs()[i->prev_txo_index()];
-      all_txin -= txo->value();
-      if (addresses.count(txo->GetSigningAddress()) != 0) {
-        balances[txo->GetSigningAddress()] -= txo->value();
+    uint32_t output;
+    if (tx_store_.FindSpentOutput(i, output)) {
+      const uint64_t value = tx_store_.output_value(output);
+      all_txin -= value;
+      if (PaysAddressIn(tx_store_, output, addresses)) {
+        balances[tx_store_.output_key(output)] -= value;
       }
     } else {
       inputs_are_known = false;
@@ -269,12 +286,13 @@ TransactionToHistoryItem(const address_set_t& addresses,
   }
 
   // Same with outputs.
-  for (tx_outs_t::const_iterator i = transaction->outputs().begin();
-       i != transaction->outputs().end();
+  for (uint32_t i = tx_store_.outputs_begin(tx);
+       i != tx_store_.outputs_end(tx);
        ++i) {
-    all_txo += i->value();
-    if (addresses.count(i->GetSigningAddress()) != 0) {
-      balances[i->GetSigningAddress()] += i->value();
+    const uint64_t value = tx_store_.output_value(i);
+    all_txo += value;
+    if (PaysAddressIn(tx_store_, i, addresses)) {
+      balances[tx_store_.output_key(i)] += value;
     }
   }
 
@@ -286,18 +304,18 @@ TransactionToHistoryItem(const address_set_t& addresses,
   int64_t net_to_wallet = 0;
   address_t most_affected_address;
   int64_t biggest_effect = 0;
-  for (std::map<address_t, int64_t>::const_iterator i = balances.begin();
+  for (std::map<Hash160, int64_t>::const_iterator i = balances.begin();
        i != balances.end();
        ++i) {
     if (abs(i->second) > biggest_effect) {
       biggest_effect = abs(i->second);
-      most_affected_address = i->first;
+      most_affected_address = i->first.bytes();
     }
     net_to_wallet += i->second;
   }
-  return HistoryItem(transaction->hash(),
+  return HistoryItem(tx_hash,
                      most_affected_address,
-                     GetTransactionTimestamp(transaction->hash()),
+                     GetTransactionTimestamp(tx_hash),
                      net_to_wallet,
                      fee,
                      inputs_are_known);
@@ -23,10 +23,12 @@
 #if !defined(__BLOCKCHAIN_H__)
 #define __BLOCKCHAIN_H__
 
-#include <map>
 #include <set>
 
+#include "fixed_bytes.h"
+#include "flat_hash_map.h"
 #include "tx.h"
+#include "tx_store.h"
 #include "types.h"
 
 class HistoryItem {
@@ -67,7 +69,7 @@ class Blockchain {
   typedef bytes_t tx_t;
   typedef bytes_t tx_hash_t;
   typedef bytes_t address_t;
-  typedef std::set<address_t> address_set_t;
+  typedef std::set<Hash160> address_set_t;
 
   // Blocks
   uint64_t max_block_height() const { return max_block_height_; }
@@ -77,38 +79,38 @@ class Blockchain {
   // Transactions
   void AddTransaction(const tx_t& transaction);
   void ConfirmTransaction(const tx_hash_t& tx_hash, uint64_t height);
+  bool HasTransaction(const tx_hash_t& tx_hash) const;
   void GetUnspentTxos(const address_set_t& addresses, tx_outs_t& unspent_txos);
   uint64_t GetTransactionHeight(const tx_hash_t& tx_hash);
   uint64_t GetTransactionTimestamp(const tx_hash_t& tx_hash);
   void GetTransactionsForAddresses(const address_set_t& addresses,
-                                   std::vector<const Transaction*>&
-                                   transactions);
+                                   std::vector<tx_hash_t>& tx_hashes);
   HistoryItem TransactionToHistoryItem(const address_set_t& addresses,
-                                       const Transaction* transaction);
+                                       const tx_hash_t& tx_hash);
 
   // Addresses
   uint64_t GetAddressBalance(const address_t& address);
   uint64_t GetAddressTxCount(const address_t& address);
 
  private:
-  Transaction* GetTransaction(const tx_hash_t& tx_hash);
   void UpdateDerivedInformation();
   void MarkSpentTxos();
   void CalculateUnspentTxos();
   void CalculateBalances();
   void CalculateTransactionCounts();
 
-  typedef std::map<tx_hash_t, Transaction*> transaction_map_t;
-
   uint64_t max_block_height_;
-  std::map<uint64_t, uint64_t> block_timestamps_;
-  std::map<tx_hash_t, uint64_t> tx_heights_;
-  transaction_map_t transactions_;
+  // Indexed by height; zero for blocks we haven't heard about.
+  std::vector<uint64_t> block_timestamps_;
+  FlatHashMap<Hash256, uint64_t> tx_heights_;
+  TxStore tx_store_;
 
-  std::map<address_t, uint64_t> balances_;
-  std::map<address_t, uint64_t> tx_counts_;
+  FlatHashMap<Hash160, uint64_t> balances_;
+  FlatHashMap<Hash160, uint64_t> tx_counts_;
 
-  tx_outs_t unspent_txos_;
+  // Indexes into tx_store_. Outputs are only copied out into TxOuts
+  // when someone asks for them.
+  std::vector<uint32_t> unspent_outputs_;
 
   DISALLOW_EVIL_CONSTRUCTORS(Blockchain);
 };
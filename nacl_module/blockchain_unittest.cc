@@ -22,38 +22,35 @@
 
 #include "blockchain.h"
 
+#include <algorithm>
 #include <memory>
 
 #include "gtest/gtest.h"
 #include "test_constants.h"
+#include "tx_store.h"
+#include "tx_view.h"
 
-static bool TransactionsContain(const std::vector<const Transaction*>&
+static bool TransactionsContain(const std::vector<Blockchain::tx_hash_t>&
                                 transactions,
                                 const bytes_t& tx_hash) {
 #if defined(BE_LOUD)
   std::cerr << "---->" << std::endl;
-  for (std::vector<const Transaction*>::const_iterator
+  for (std::vector<Blockchain::tx_hash_t>::const_iterator
          i = transactions.begin();
        i != transactions.end(); ++i) {
-    std::cerr << to_hex((*i)->hash()) << std::endl;
+    std::cerr << to_hex(*i) << std::endl;
   }
   std::cerr << "<----" << std::endl;
 #endif
 
-  for (std::vector<const Transaction*>::const_iterator
-         i = transactions.begin();
-       i != transactions.end(); ++i) {
-    if ((*i)->hash() == tx_hash) {
-      return true;
-    }
-  }
-  return false;
+  return std::find(transactions.begin(), transactions.end(), tx_hash) !=
+    transactions.end();
 }
 
 TEST(BlockchainTest, HappyPath) {
   std::auto_ptr<Blockchain> blockchain(new Blockchain);
   Blockchain::address_set_t address_set;
-  std::vector<const Transaction*> transactions;
+  std::vector<Blockchain::tx_hash_t> transactions;
   history_t history;
 
   EXPECT_EQ(0, blockchain->max_block_height());
@@ -80,12 +77,12 @@ TEST(BlockchainTest, HappyPath) {
   EXPECT_EQ(1, unspent_txos.size());
 
   // Get a filtered unspent txo list that should be the null set.
-  address_filter.insert(ADDR_1A1z);
+  address_filter.insert(Hash160(ADDR_1A1z));
   blockchain->GetUnspentTxos(address_filter, unspent_txos);
   EXPECT_EQ(0, unspent_txos.size());
 
   // Get a filtered unspent txo list that should be just one item.
-  address_filter.insert(ADDR_12c6);
+  address_filter.insert(Hash160(ADDR_12c6));
   blockchain->GetUnspentTxos(address_filter, unspent_txos);
   EXPECT_EQ(1, unspent_txos.size());
 
@@ -113,7 +110,7 @@ TEST(BlockchainTest, HappyPath) {
 
   // History
   address_set.clear();
-  address_set.insert(ADDR_1Guw);
+  address_set.insert(Hash160(ADDR_1Guw));
   blockchain->GetTransactionsForAddresses(address_set, transactions);
   EXPECT_EQ(2, transactions.size());
   EXPECT_TRUE(TransactionsContain(transactions, TX_100D_HASH));
@@ -136,12 +133,12 @@ TEST(BlockchainTest, OutOfOrder) {
 TEST(BlockchainTest, History) {
   std::auto_ptr<Blockchain> blockchain(new Blockchain);
   Blockchain::address_set_t address_set;
-  std::vector<const Transaction*> transactions;
+  std::vector<Blockchain::tx_hash_t> transactions;
 
   blockchain->AddTransaction(TX_100D);
 
   address_set.clear();
-  address_set.insert(ADDR_1Guw);
+  address_set.insert(Hash160(ADDR_1Guw));
   blockchain->GetTransactionsForAddresses(address_set, transactions);
   HistoryItem history_item =
     blockchain->TransactionToHistoryItem(address_set,
@@ -163,7 +160,7 @@ TEST(BlockchainTest, History) {
   blockchain->AddTransaction(TX_76D8);
 
   address_set.clear();
-  address_set.insert(ADDR_1CMX);
+  address_set.insert(Hash160(ADDR_1CMX));
   blockchain->GetTransactionsForAddresses(address_set, transactions);
   history_item = blockchain->TransactionToHistoryItem(address_set,
                                                       transactions[0]);
@@ -171,3 +168,119 @@ TEST(BlockchainTest, History) {
   EXPECT_EQ(54754, history_item.value());
   EXPECT_FALSE(history_item.inputs_are_known());
 }
+
+TEST(BlockchainTest, BlockTimestamps) {
+  std::auto_ptr<Blockchain> blockchain(new Blockchain);
+  EXPECT_EQ(0, blockchain->GetBlockTimestamp(0));
+  blockchain->ConfirmBlock(300000, 1399703554);
+  blockchain->ConfirmBlock(12, 1231475020);
+  EXPECT_EQ(300000, blockchain->max_block_height());
+  EXPECT_EQ(1399703554, blockchain->GetBlockTimestamp(300000));
+  EXPECT_EQ(1231475020, blockchain->GetBlockTimestamp(12));
+  EXPECT_EQ(0, blockchain->GetBlockTimestamp(13));
+  EXPECT_EQ(0, blockchain->GetBlockTimestamp(300001));
+
+  // Nonsense heights don't get a slot.
+  blockchain->ConfirmBlock(1ULL << 40, 1);
+  EXPECT_EQ(0, blockchain->GetBlockTimestamp(1ULL << 40));
+  EXPECT_EQ(300000, blockchain->max_block_height());
+}
+
+TEST(TxStoreTest, Basics) {
+  TxStore store;
+  uint32_t tx_100d, tx_1bcb, tx;
+
+  EXPECT_FALSE(store.Add(bytes_t(TX_100D.begin(), TX_100D.end() - 1), tx));
+  EXPECT_EQ(0, store.tx_count());
+
+  ASSERT_TRUE(store.Add(TX_100D, tx_100d));
+  EXPECT_EQ(TX_100D_HASH, store.hash(tx_100d));
+  EXPECT_EQ(TX_100D, store.raw(tx_100d));
+  EXPECT_FALSE(store.Find(TX_1BCB_HASH, tx));
+
+  // TX_100D spends an output of TX_1BCB, which we don't have yet.
+  uint32_t output;
+  ASSERT_EQ(1, store.inputs_end(tx_100d) - store.inputs_begin(tx_100d));
+  EXPECT_FALSE(store.FindSpentOutput(store.inputs_begin(tx_100d), output));
+
+  ASSERT_TRUE(store.Add(TX_1BCB, tx_1bcb));
+  ASSERT_TRUE(store.Find(TX_1BCB_HASH, tx));
+  EXPECT_EQ(tx_1bcb, tx);
+  ASSERT_TRUE(store.FindSpentOutput(store.inputs_begin(tx_100d), output));
+  EXPECT_EQ(tx_1bcb, store.output_tx(output));
+  EXPECT_FALSE(store.is_spent(output));
+  store.MarkSpent(output);
+  EXPECT_TRUE(store.is_spent(output));
+
+  // Adding it again changes nothing.
+  ASSERT_TRUE(store.Add(TX_100D, tx));
+  EXPECT_EQ(tx_100d, tx);
+  EXPECT_EQ(2, store.tx_count());
+
+  // Outputs carry what a Transaction would have told us.
+  TxView view;
+  ASSERT_TRUE(view.Parse(TX_100D));
+  Transaction transaction(view);
+  for (uint32_t i = store.outputs_begin(tx_100d);
+       i != store.outputs_end(tx_100d);
+       ++i) {
+    const TxOut& txo = transaction.outputs()[store.output_n(i)];
+    EXPECT_EQ(txo.value(), store.output_value(i));
+    EXPECT_EQ(txo.script(), store.output_script(i));
+    EXPECT_EQ(txo.GetSigningAddress(), store.output_signing_address(i));
+  }
+}
+
+TEST(TxStoreTest, LookupHeavyIngest) {
+  // A long chain of txs, each spending the one before, so that every
+  // input resolves through the tx index.
+  const uint32_t CHAIN_LENGTH = 20000;
+  const bytes_t recipient(unhexlify("62e907b15cbf27d5425399ebf6f0fb50ebb88f18"));
+  std::vector<bytes_t> raws;
+  std::vector<bytes_t> hashes;
+  {
+    Transaction coinbase;
+    coinbase.Add(TxIn("lookup heavy ingest"));
+    coinbase.Add(TxOut(CHAIN_LENGTH * 2, recipient));
+    coinbase.Add(TxOut(1, recipient));
+    raws.push_back(coinbase.Serialize());
+    hashes.push_back(coinbase.hash());
+  }
+  for (uint32_t i = 1; i < CHAIN_LENGTH; ++i) {
+    Transaction transaction;
+    transaction.Add(TxIn(hashes.back(), 0, bytes_t(), recipient));
+    transaction.Add(TxOut((CHAIN_LENGTH - i) * 2, recipient));
+    transaction.Add(TxOut(1, recipient));
+    raws.push_back(transaction.Serialize());
+    hashes.push_back(transaction.hash());
+  }
+
+  // Newest first, so that no input can be resolved until its tx's
+  // parent finally arrives.
+  TxStore store;
+  for (uint32_t i = CHAIN_LENGTH; i > 0; --i) {
+    uint32_t tx;
+    ASSERT_TRUE(store.Add(raws[i - 1], tx));
+    ASSERT_EQ(CHAIN_LENGTH - i, tx);
+  }
+  ASSERT_EQ(CHAIN_LENGTH, store.tx_count());
+
+  for (uint32_t i = 0; i < CHAIN_LENGTH; ++i) {
+    uint32_t tx;
+    ASSERT_TRUE(store.Find(hashes[i], tx));
+    EXPECT_EQ(CHAIN_LENGTH - 1 - i, tx);
+  }
+  // Three passes over the inputs, as UpdateDerivedInformation() makes.
+  for (int pass = 0; pass < 3; ++pass) {
+    for (uint32_t i = 0; i < store.input_count(); ++i) {
+      uint32_t output;
+      const bool is_coinbase = i == store.input_count() - 1;
+      ASSERT_EQ(!is_coinbase, store.FindSpentOutput(i, output));
+      if (!is_coinbase) {
+        // Input i belongs to tx i, whose parent was added next.
+        EXPECT_EQ(i + 1, store.output_tx(output));
+        EXPECT_EQ(0, store.output_n(output));
+      }
+    }
+  }
+}
@@ -0,0 +1,225 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "coin_selector.h"
+
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <utility>
+
+static const uint32_t DEFAULT_MAX_TRIES = 100000;
+
+namespace {
+
+class IsMoreValuable {
+ public:
+  explicit IsMoreValuable(const tx_outs_t& txos) : txos_(txos) {}
+
+  bool operator()(size_t a, size_t b) const {
+    return txos_[a].value() > txos_[b].value();
+  }
+
+ private:
+  const tx_outs_t& txos_;
+};
+
+}  // namespace
+
+CoinSelector::CoinSelector(const tx_outs_t* unspent_txos)
+  : unspent_txos_(unspent_txos), pool_(unspent_txos->size()),
+    usable_count_(0), input_cost_(0), cost_of_change_(0),
+    max_tries_(DEFAULT_MAX_TRIES) {
+  for (size_t i = 0; i < pool_.size(); ++i) {
+    pool_[i] = i;
+  }
+  std::stable_sort(pool_.begin(), pool_.end(),
+                   IsMoreValuable(*unspent_txos_));
+  UpdateEffectiveValues();
+}
+
+void CoinSelector::set_input_cost(uint64_t input_cost) {
+  input_cost_ = input_cost;
+  UpdateEffectiveValues();
+}
+
+void CoinSelector::UpdateEffectiveValues() {
+  effective_values_.clear();
+  for (std::vector<size_t>::const_iterator i = pool_.begin();
+       i != pool_.end() && (*unspent_txos_)[*i].value() > input_cost_;
+       ++i) {
+    effective_values_.push_back((*unspent_txos_)[*i].value() - input_cost_);
+  }
+  usable_count_ = effective_values_.size();
+}
+
+void CoinSelector::Remove(const tx_ins_t& inputs) {
+  typedef std::pair<bytes_t, uint32_t> outpoint_t;
+  std::set<outpoint_t> spent;
+  for (tx_ins_t::const_iterator i = inputs.begin(); i != inputs.end(); ++i) {
+    spent.insert(outpoint_t(i->prev_txo_hash(), i->prev_txo_index()));
+  }
+  std::vector<size_t> kept;
+  kept.reserve(pool_.size());
+  for (std::vector<size_t>::const_iterator i = pool_.begin();
+       i != pool_.end();
+       ++i) {
+    const TxOut& txo = (*unspent_txos_)[*i];
+    if (spent.count(outpoint_t(txo.tx_hash(), txo.tx_output_n())) == 0) {
+      kept.push_back(*i);
+    }
+  }
+  pool_.swap(kept);
+  UpdateEffectiveValues();
+}
+
+bool CoinSelector::Select(uint64_t target,
+                          tx_outs_t& selected,
+                          uint64_t& change_value) {
+  selected.clear();
+  change_value = 0;
+
+  std::vector<size_t> picks;
+  bool is_changeless = SelectBranchAndBound(target, picks);
+  if (!is_changeless && !SelectFewestInputs(target, picks)) {
+    return false;
+  }
+
+  uint64_t total = 0;
+  selected.reserve(picks.size());
+  for (std::vector<size_t>::const_iterator i = picks.begin();
+       i != picks.end();
+       ++i) {
+    selected.push_back((*unspent_txos_)[pool_[*i]]);
+    total += effective_values_[*i];
+  }
+  if (!is_changeless) {
+    change_value = total - target;
+  }
+  return true;
+}
+
+bool CoinSelector::SelectBranchAndBound(uint64_t target,
+                                        std::vector<size_t>& picks) {
+  const size_t n = usable_count_;
+
+  // remaining[i] is the most that outputs i and later could add.
+  std::vector<uint64_t> remaining(n + 1, 0);
+  for (size_t i = n; i > 0; --i) {
+    remaining[i - 1] = remaining[i] + effective_values_[i - 1];
+  }
+  if (remaining[0] < target) {
+    return false;
+  }
+
+  std::vector<bool> included(n, false);
+  std::vector<bool> best;
+  uint64_t best_excess = 0;
+  uint64_t current = 0;
+  size_t depth = 0;
+
+  for (uint32_t tries = 0; tries < max_tries_; ++tries) {
+    bool should_backtrack = false;
+    if (current + remaining[depth] < target) {
+      // Even taking everything left won't get there.
+      should_backtrack = true;
+    } else if (current > target + cost_of_change_) {
+      // Overshot. Anything more only overshoots further.
+      should_backtrack = true;
+    } else if (current >= target) {
+      if (best.empty() || current - target < best_excess) {
+        best = included;
+        best_excess = current - target;
+        if (best_excess == 0) {
+          break;
+        }
+      }
+      should_backtrack = true;
+    }
+
+    if (should_backtrack) {
+      // Un-take the most recently taken output and try without it.
+      while (depth > 0 && !included[depth - 1]) {
+        --depth;
+      }
+      if (depth == 0) {
+        break;  // searched everything
+      }
+      --depth;
+      included[depth] = false;
+      current -= effective_values_[depth];
+      ++depth;
+      continue;
+    }
+
+    // Take this output, unless we just tried without an output of the
+    // same value, in which case taking this one instead would only
+    // repeat that search.
+    if (depth > 0 && !included[depth - 1] &&
+        effective_values_[depth] == effective_values_[depth - 1]) {
+      included[depth] = false;
+    } else {
+      included[depth] = true;
+      current += effective_values_[depth];
+    }
+    ++depth;
+  }
+
+  if (best.empty()) {
+    return false;
+  }
+  picks.clear();
+  for (size_t i = 0; i < n; ++i) {
+    if (best[i]) {
+      picks.push_back(i);
+    }
+  }
+  return true;
+}
+
+bool CoinSelector::SelectFewestInputs(uint64_t target,
+                                      std::vector<size_t>& picks) {
+  picks.clear();
+  uint64_t total = 0;
+  size_t count = 0;
+  while (total < target && count < usable_count_) {
+    total += effective_values_[count++];
+  }
+  if (total < target) {
+    return false;
+  }
+
+  // The first count - 1 outputs are unavoidable. For the last one,
+  // take the smallest output that still reaches the target.
+  total -= effective_values_[count - 1];
+  const uint64_t needed = target - total;
+  std::vector<uint64_t>::const_iterator last =
+    std::upper_bound(effective_values_.begin() + count - 1,
+                     effective_values_.end(),
+                     needed,
+                     std::greater<uint64_t>());
+  for (size_t i = 0; i + 1 < count; ++i) {
+    picks.push_back(i);
+  }
+  picks.push_back(last - effective_values_.begin() - 1);
+  return true;
+}
@@ -0,0 +1,93 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__COIN_SELECTOR_H__)
+#define __COIN_SELECTOR_H__
+
+#include <vector>
+
+#include "tx.h"
+#include "types.h"
+
+// Decides which unspent outputs fund a spend. Outputs are sorted by
+// value once, at construction, so a selector can answer several
+// Select() calls over the same pool. The selector sorts indexes, not
+// the outputs themselves, and copies out only the ones it selects;
+// the caller's vector isn't owned, and must outlive the selector and
+// stay unchanged meanwhile.
+//
+// Select() first runs a depth-first branch-and-bound search for a
+// set of outputs that lands within cost_of_change of the target, so
+// the spend needs no change output at all. The search gives up after
+// max_tries steps. Failing that, it takes the fewest outputs that
+// cover the target, largest first, and then swaps the last of them
+// for the smallest output that still covers what's left. That keeps
+// both the input count and the change as small as they can be.
+class CoinSelector {
+ public:
+  explicit CoinSelector(const tx_outs_t* unspent_txos);
+
+  // The fee it costs to spend one more input. Each output counts for
+  // its value minus this, and outputs worth no more than it are never
+  // selected. Zero by default.
+  void set_input_cost(uint64_t input_cost);
+
+  // How far past the target a changeless selection may land. The
+  // excess goes to the miner, so this should be about what a change
+  // output would cost to create and later spend. Zero by default,
+  // meaning only exact matches are changeless.
+  void set_cost_of_change(uint64_t cost_of_change) {
+    cost_of_change_ = cost_of_change;
+  }
+
+  void set_max_tries(uint32_t max_tries) { max_tries_ = max_tries; }
+
+  // Drops the outputs that inputs spend from the pool, so that a
+  // series of Select() calls never picks the same output twice.
+  void Remove(const tx_ins_t& inputs);
+
+  // Picks outputs whose values, less input costs, cover target. Sets
+  // change_value to what's left over, or to zero if the selection is
+  // changeless. Returns false if the pool can't cover target.
+  bool Select(uint64_t target,
+              tx_outs_t& selected,
+              uint64_t& change_value);
+
+ private:
+  // Return indexes into the sorted pool.
+  bool SelectBranchAndBound(uint64_t target, std::vector<size_t>& picks);
+  bool SelectFewestInputs(uint64_t target, std::vector<size_t>& picks);
+
+  void UpdateEffectiveValues();
+
+  const tx_outs_t* unspent_txos_;
+  std::vector<size_t> pool_;  // into unspent_txos_, descending by value
+  std::vector<uint64_t> effective_values_;  // value less input_cost_
+  size_t usable_count_;  // how many have a positive effective value
+  uint64_t input_cost_;
+  uint64_t cost_of_change_;
+  uint32_t max_tries_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(CoinSelector);
+};
+
+#endif  // #if !defined(__COIN_SELECTOR_H__)
@@ -0,0 +1,156 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "gtest/gtest.h"
+
+#include "coin_selector.h"
+#include "tx.h"
+#include "types.h"
+
+static const bytes_t ADDR(unhexlify("62e907b15cbf27d5425399ebf6f0fb50ebb88f18"));
+
+static tx_outs_t MakePool(const uint64_t* values, size_t count) {
+  tx_outs_t pool;
+  for (size_t i = 0; i < count; ++i) {
+    pool.push_back(TxOut(values[i], ADDR));
+  }
+  return pool;
+}
+
+static uint64_t SumValues(const tx_outs_t& txos) {
+  uint64_t sum = 0;
+  for (tx_outs_t::const_iterator i = txos.begin(); i != txos.end(); ++i) {
+    sum += i->value();
+  }
+  return sum;
+}
+
+TEST(CoinSelectorTest, ExactMatch) {
+  const uint64_t VALUES[] = { 1000, 20000, 2000, 5000, 10000 };
+  const tx_outs_t pool(MakePool(VALUES, 5));
+  CoinSelector selector(&pool);
+  tx_outs_t selected;
+  uint64_t change_value;
+
+  ASSERT_TRUE(selector.Select(17000, selected, change_value));
+  EXPECT_EQ(3, selected.size());
+  EXPECT_EQ(17000, SumValues(selected));
+  EXPECT_EQ(0, change_value);
+
+  // One output is better than several.
+  ASSERT_TRUE(selector.Select(20000, selected, change_value));
+  EXPECT_EQ(1, selected.size());
+  EXPECT_EQ(0, change_value);
+
+  // The selector sorted its own indexes, not the caller's outputs.
+  for (size_t i = 0; i < pool.size(); ++i) {
+    EXPECT_EQ(VALUES[i], pool[i].value());
+  }
+}
+
+TEST(CoinSelectorTest, WithinCostOfChange) {
+  const uint64_t VALUES[] = { 10000, 6000, 5000 };
+  const tx_outs_t pool(MakePool(VALUES, 3));
+  CoinSelector selector(&pool);
+  tx_outs_t selected;
+  uint64_t change_value;
+
+  selector.set_cost_of_change(200);
+  ASSERT_TRUE(selector.Select(10900, selected, change_value));
+  EXPECT_EQ(2, selected.size());
+  EXPECT_EQ(11000, SumValues(selected));
+  EXPECT_EQ(0, change_value);
+}
+
+TEST(CoinSelectorTest, FewestInputsFallback) {
+  const uint64_t VALUES[] = { 1000, 50000, 20000, 30000 };
+  const tx_outs_t pool(MakePool(VALUES, 4));
+  CoinSelector selector(&pool);
+  tx_outs_t selected;
+  uint64_t change_value;
+
+  // Nothing adds up exactly, so take one output, and the smallest one
+  // that's big enough.
+  ASSERT_TRUE(selector.Select(25000, selected, change_value));
+  ASSERT_EQ(1, selected.size());
+  EXPECT_EQ(30000, selected[0].value());
+  EXPECT_EQ(5000, change_value);
+
+  // Two outputs are needed. The second is the smallest that finishes
+  // the job.
+  ASSERT_TRUE(selector.Select(70500, selected, change_value));
+  ASSERT_EQ(2, selected.size());
+  EXPECT_EQ(50000, selected[0].value());
+  EXPECT_EQ(30000, selected[1].value());
+  EXPECT_EQ(9500, change_value);
+
+  EXPECT_FALSE(selector.Select(101001, selected, change_value));
+}
+
+TEST(CoinSelectorTest, InputCost) {
+  const uint64_t VALUES[] = { 1000, 500, 100 };
+  const tx_outs_t pool(MakePool(VALUES, 3));
+  CoinSelector selector(&pool);
+  tx_outs_t selected;
+  uint64_t change_value;
+
+  // The 100 output isn't worth spending, and the others count for
+  // 900 and 400.
+  selector.set_input_cost(100);
+  ASSERT_TRUE(selector.Select(1300, selected, change_value));
+  EXPECT_EQ(2, selected.size());
+  EXPECT_EQ(0, change_value);
+  ASSERT_TRUE(selector.Select(1000, selected, change_value));
+  EXPECT_EQ(2, selected.size());
+  EXPECT_EQ(300, change_value);
+  EXPECT_FALSE(selector.Select(1301, selected, change_value));
+}
+
+TEST(CoinSelectorTest, LargePool) {
+  // A merchant wallet's worth of small deposits.
+  const size_t POOL_SIZE = 100000;
+  std::vector<uint64_t> values;
+  uint32_t seed = 1;
+  for (size_t i = 0; i < POOL_SIZE; ++i) {
+    seed = seed * 1103515245 + 12345;
+    values.push_back(10000 + (seed >> 8) % 1000000);
+  }
+  const tx_outs_t pool(MakePool(&values[0], values.size()));
+  CoinSelector selector(&pool);
+  tx_outs_t selected;
+  uint64_t change_value;
+
+  // Walking the pool in order would take around a hundred of these
+  // deposits to reach 0.5 BTC. Barely more than fifty of the largest
+  // will do.
+  const uint64_t TARGET = SATOSHIS_IN_BTC / 2;
+  selector.set_cost_of_change(1000);
+  ASSERT_TRUE(selector.Select(TARGET, selected, change_value));
+  EXPECT_GE(51, selected.size());
+  const uint64_t total = SumValues(selected);
+  EXPECT_LE(TARGET, total);
+  if (change_value == 0) {
+    EXPECT_GE(TARGET + 1000, total);
+  } else {
+    EXPECT_EQ(total - TARGET, change_value);
+  }
+}
@@ -22,6 +22,7 @@
 
 #include "credentials.h"
 
+#include <algorithm>
 #include <iostream>  // cerr
 
 #include "crypto.h"
@@ -117,5 +118,24 @@ bool Credentials::Unlock(const std::string& passphrase) {
 
 bool Credentials::Lock() {
   ephemeral_key_.clear();
+  for (std::vector<CredentialsObserver*>::const_iterator i =
+         observers_.begin();
+       i != observers_.end();
+       ++i) {
+    (*i)->OnCredentialsLocked();
+  }
   return true;
 }
+
+void Credentials::AddObserver(CredentialsObserver* observer) {
+  if (std::find(observers_.begin(), observers_.end(), observer) ==
+      observers_.end()) {
+    observers_.push_back(observer);
+  }
+}
+
+void Credentials::RemoveObserver(CredentialsObserver* observer) {
+  observers_.erase(std::remove(observers_.begin(), observers_.end(),
+                               observer),
+                   observers_.end());
+}
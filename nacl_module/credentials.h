@@ -24,9 +24,18 @@
 #define __CREDENTIALS_H__
 
 #include <string>
+#include <vector>
 
 #include "types.h"
 
+// Implemented by anything that holds key material derived while the
+// credentials were unlocked and must drop it when they lock.
+class CredentialsObserver {
+ public:
+  virtual ~CredentialsObserver() {}
+  virtual void OnCredentialsLocked() = 0;
+};
+
 class Credentials {
  public:
   Credentials();
@@ -46,11 +55,17 @@ class Credentials {
 
   const bytes_t& ephemeral_key() { return ephemeral_key_; }
 
+  // Observers aren't owned, and must remove themselves before they're
+  // destroyed.
+  void AddObserver(CredentialsObserver* observer);
+  void RemoveObserver(CredentialsObserver* observer);
+
  private:
   bytes_t salt_;
   bytes_t check_;
   bytes_t encrypted_ephemeral_key_;
   bytes_t ephemeral_key_;
+  std::vector<CredentialsObserver*> observers_;
 
   DISALLOW_EVIL_CONSTRUCTORS(Credentials);
 };
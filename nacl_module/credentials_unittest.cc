@@ -80,3 +80,32 @@ TEST(CredentialsTest, HappyPath) {
   EXPECT_TRUE(c.Unlock(PP2));
   EXPECT_FALSE(c.isLocked());
 }
+
+class LockObserver : public CredentialsObserver {
+ public:
+  LockObserver() : lock_count_(0) {}
+  virtual void OnCredentialsLocked() { ++lock_count_; }
+  int lock_count() const { return lock_count_; }
+
+ private:
+  int lock_count_;
+};
+
+TEST(CredentialsTest, LockNotifiesObservers) {
+  bytes_t salt;
+  bytes_t check;
+  bytes_t encrypted_ephemeral_key;
+
+  Credentials c;
+  LockObserver observer;
+  c.AddObserver(&observer);
+  c.AddObserver(&observer);  // no double registration
+  EXPECT_TRUE(c.SetPassphrase(PP1, salt, check, encrypted_ephemeral_key));
+  EXPECT_TRUE(c.Lock());
+  EXPECT_EQ(1, observer.lock_count());
+
+  c.RemoveObserver(&observer);
+  EXPECT_TRUE(c.Unlock(PP1));
+  EXPECT_TRUE(c.Lock());
+  EXPECT_EQ(1, observer.lock_count());
+}
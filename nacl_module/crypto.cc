@@ -194,12 +194,17 @@ bytes_t Crypto::SHA256(const bytes_t& input) {
 }
 
 bytes_t Crypto::DoubleSHA256(const bytes_t& input) {
+  return DoubleSHA256(input.empty() ? NULL : &input[0], input.size());
+}
+
+bytes_t Crypto::DoubleSHA256(const unsigned char* input,
+                             size_t input_size) {
   bytes_t digest;
   digest.resize(SHA256_DIGEST_LENGTH);
 
   SHA256_CTX sha256;
   SHA256_Init(&sha256);
-  SHA256_Update(&sha256, &input[0], input.size());
+  SHA256_Update(&sha256, input, input_size);
   SHA256_Final(&digest[0], &sha256);
   SHA256_Init(&sha256);
   SHA256_Update(&sha256, &digest[0], digest.capacity());
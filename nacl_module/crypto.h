@@ -58,5 +58,6 @@ class Crypto {
 
   static bytes_t SHA256(const bytes_t& input);
   static bytes_t DoubleSHA256(const bytes_t& input);
+  static bytes_t DoubleSHA256(const unsigned char* input, size_t input_size);
   static bytes_t SHA256ThenRIPE(const bytes_t& input);
 };
@@ -100,6 +100,9 @@ public:
     if (method == "get-addresses") {
       handled = api_->HandleGetAddresses(params, result);
     }
+    if (method == "get-address-cache") {
+      handled = api_->HandleGetAddressCache(params, result);
+    }
     if (method == "report-tx-statuses") {
       handled = api_->HandleReportTxStatuses(params, result);
     }
@@ -109,6 +112,12 @@ public:
     if (method == "create-tx") {
       handled = api_->HandleCreateTx(params, result);
     }
+    if (method == "create-tx-batch") {
+      handled = api_->HandleCreateTxBatch(params, result);
+    }
+    if (method == "release-tx") {
+      handled = api_->HandleReleaseTx(params, result);
+    }
     if (method == "get-history") {
       handled = api_->HandleGetHistory(params, result);
     }
@@ -35,6 +35,7 @@ typedef enum {
   ERROR_TRANSACTION_FAILED,
   ERROR_UNKNOWN_METHOD,
   ERROR_CREDENTIALS_NOT_AVAILABLE,
+  ERROR_TRANSACTION_TOO_LARGE,
   ERROR_NONE = 0
 } Error;
 
@@ -0,0 +1,115 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__FIXED_BYTES_H__)
+#define __FIXED_BYTES_H__
+
+#include <cstring>
+#include <string>
+
+#include "types.h"
+
+// N bytes held inline. Meant for keys that are always the same size,
+// like tx hashes and hash160s, where a bytes_t would cost an
+// allocation per key and a pointer chase per comparison. Copying,
+// comparing and hashing are all plain memory operations.
+template <size_t N>
+class FixedBytes {
+ public:
+  enum { SIZE = N };
+
+  // All zeroes.
+  FixedBytes() { memset(data_, 0, N); }
+
+  // Copies N bytes from data.
+  explicit FixedBytes(const unsigned char* data) { memcpy(data_, data, N); }
+
+  // All zeroes unless bytes is exactly N long.
+  explicit FixedBytes(const bytes_t& bytes) {
+    if (bytes.size() == N) {
+      memcpy(data_, &bytes[0], N);
+    } else {
+      memset(data_, 0, N);
+    }
+  }
+
+  // Returns false, leaving result alone, unless hex is 2 * N hex
+  // digits.
+  static bool FromHex(const std::string& hex, FixedBytes& result) {
+    unsigned char data[N];
+    if (hex.size() != N * 2 || !unhexlify(hex.data(), hex.size(), data)) {
+      return false;
+    }
+    memcpy(result.data_, data, N);
+    return true;
+  }
+
+  const unsigned char* data() const { return data_; }
+  unsigned char* data() { return data_; }
+  size_t size() const { return N; }
+  const unsigned char* begin() const { return data_; }
+  const unsigned char* end() const { return data_ + N; }
+
+  bytes_t bytes() const { return bytes_t(data_, data_ + N); }
+  std::string hex() const {
+    std::string result(N * 2, '0');
+    to_hex(data_, N, &result[0]);
+    return result;
+  }
+
+  bool is_zero() const {
+    for (size_t i = 0; i < N; ++i) {
+      if (data_[i] != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Everything these hold is a digest or a curve point, so the bytes
+  // are already well mixed. The trailing word makes a fine hash (the
+  // leading byte of a public key is just its parity).
+  size_t Hash() const {
+    size_t hash;
+    memcpy(&hash, data_ + N - sizeof(hash), sizeof(hash));
+    return hash;
+  }
+
+  bool operator==(const FixedBytes& other) const {
+    return memcmp(data_, other.data_, N) == 0;
+  }
+  bool operator!=(const FixedBytes& other) const {
+    return !(*this == other);
+  }
+  bool operator<(const FixedBytes& other) const {
+    return memcmp(data_, other.data_, N) < 0;
+  }
+
+ private:
+  unsigned char data_[N];
+};
+
+typedef FixedBytes<32> Hash256;
+typedef FixedBytes<20> Hash160;
+typedef FixedBytes<33> PubKey33;
+
+#endif  // #if !defined(__FIXED_BYTES_H__)
@@ -0,0 +1,77 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "gtest/gtest.h"
+
+#include <set>
+
+#include "fixed_bytes.h"
+#include "types.h"
+
+TEST(FixedBytesTest, Basics) {
+  const bytes_t bytes(unhexlify("62e907b15cbf27d5425399ebf6f0fb50ebb88f18"));
+  const Hash160 hash160(bytes);
+  EXPECT_EQ(20, hash160.size());
+  EXPECT_FALSE(hash160.is_zero());
+  EXPECT_EQ(bytes, hash160.bytes());
+  EXPECT_EQ("62e907b15cbf27d5425399ebf6f0fb50ebb88f18", hash160.hex());
+  EXPECT_EQ(hash160, Hash160(&bytes[0]));
+
+  // The wrong size gives all zeroes.
+  EXPECT_TRUE(Hash160(bytes_t(19, 1)).is_zero());
+  EXPECT_TRUE(Hash256().is_zero());
+
+  Hash160 parsed;
+  EXPECT_TRUE(Hash160::FromHex("62E907B15CBF27D5425399EBF6F0FB50EBB88F18",
+                               parsed));
+  EXPECT_EQ(hash160, parsed);
+  EXPECT_FALSE(Hash160::FromHex("62e907", parsed));
+  EXPECT_FALSE(Hash160::FromHex("zze907b15cbf27d5425399ebf6f0fb50ebb88f18",
+                                parsed));
+  EXPECT_EQ(hash160, parsed);
+}
+
+TEST(FixedBytesTest, Ordering) {
+  // Same order as the bytes_t keys they replace.
+  const bytes_t a(unhexlify("0001ff"));
+  const bytes_t b(unhexlify("0100ff"));
+  const bytes_t c(unhexlify("010100"));
+  typedef FixedBytes<3> Key;
+  EXPECT_TRUE(Key(a) < Key(b));
+  EXPECT_TRUE(Key(b) < Key(c));
+  EXPECT_FALSE(Key(c) < Key(c));
+  EXPECT_TRUE(Key(a) != Key(b));
+
+  std::set<Key> keys;
+  keys.insert(Key(c));
+  keys.insert(Key(a));
+  keys.insert(Key(b));
+  keys.insert(Key(a));
+  ASSERT_EQ(3, keys.size());
+  EXPECT_EQ(a, keys.begin()->bytes());
+
+  // Equal keys hash equally; different digests almost never collide.
+  EXPECT_EQ(Hash256(bytes_t(32, 7)).Hash(), Hash256(bytes_t(32, 7)).Hash());
+  bytes_t digest(32, 7);
+  digest[31] = 8;
+  EXPECT_NE(Hash256(bytes_t(32, 7)).Hash(), Hash256(digest).Hash());
+}
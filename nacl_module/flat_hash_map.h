@@ -0,0 +1,139 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__FLAT_HASH_MAP_H__)
+#define __FLAT_HASH_MAP_H__
+
+#include <cstddef>
+#include <vector>
+
+#include "types.h"
+
+// An open-addressing hash table with linear probing, for the big
+// indexes keyed by FixedBytes hashes. Keys and values sit in flat
+// arrays, so a lookup is a hash, a masked index and usually a single
+// key comparison, with no per-entry allocation. K needs Hash() and
+// operator==; both K and V need default constructors.
+//
+// Entries can be added and changed but not removed, which is all the
+// append-only blockchain needs, and keeps probing free of tombstones.
+// The table doubles before it gets more than half full.
+template <class K, class V>
+class FlatHashMap {
+ public:
+  FlatHashMap() : size_(0) {}
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Drops every entry but keeps the table, for indexes that are
+  // rebuilt from scratch at the same size each time.
+  void clear() {
+    if (size_ != 0) {
+      used_.assign(used_.size(), false);
+      size_ = 0;
+    }
+  }
+
+  // Makes room for count entries without rehashing along the way.
+  void reserve(size_t count) {
+    size_t capacity = MIN_CAPACITY;
+    while (capacity < count * 2) {
+      capacity *= 2;
+    }
+    if (capacity > used_.size()) {
+      Rehash(capacity);
+    }
+  }
+
+  // NULL if key isn't present.
+  const V* Find(const K& key) const {
+    if (size_ == 0) {
+      return NULL;
+    }
+    const size_t slot = FindSlot(key);
+    return used_[slot] ? &values_[slot] : NULL;
+  }
+  V* Find(const K& key) {
+    if (size_ == 0) {
+      return NULL;
+    }
+    const size_t slot = FindSlot(key);
+    return used_[slot] ? &values_[slot] : NULL;
+  }
+
+  // Adds key with a default value if it isn't present.
+  V& operator[](const K& key) {
+    if ((size_ + 1) * 2 > used_.size()) {
+      Rehash(used_.empty() ? MIN_CAPACITY : used_.size() * 2);
+    }
+    const size_t slot = FindSlot(key);
+    if (!used_[slot]) {
+      used_[slot] = true;
+      keys_[slot] = key;
+      values_[slot] = V();
+      ++size_;
+    }
+    return values_[slot];
+  }
+
+ private:
+  static const size_t MIN_CAPACITY = 16;
+
+  // The slot holding key, or the empty one where it would go. The
+  // capacity is a power of two and never more than half used, so the
+  // probe always ends.
+  size_t FindSlot(const K& key) const {
+    const size_t mask = used_.size() - 1;
+    size_t slot = key.Hash() & mask;
+    while (used_[slot] && !(keys_[slot] == key)) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  void Rehash(size_t capacity) {
+    std::vector<K> keys(capacity);
+    std::vector<V> values(capacity);
+    std::vector<bool> used(capacity, false);
+    keys_.swap(keys);
+    values_.swap(values);
+    used_.swap(used);
+    for (size_t i = 0; i < used.size(); ++i) {
+      if (used[i]) {
+        const size_t slot = FindSlot(keys[i]);
+        used_[slot] = true;
+        keys_[slot] = keys[i];
+        values_[slot] = values[i];
+      }
+    }
+  }
+
+  std::vector<K> keys_;
+  std::vector<V> values_;
+  std::vector<bool> used_;
+  size_t size_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(FlatHashMap);
+};
+
+#endif  // #if !defined(__FLAT_HASH_MAP_H__)
@@ -0,0 +1,89 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "gtest/gtest.h"
+
+#include "fixed_bytes.h"
+#include "flat_hash_map.h"
+
+// Stands in for a digest: every byte depends on n.
+static bytes_t MakeDigest(uint32_t n, size_t size) {
+  bytes_t bytes(size);
+  uint32_t seed = n;
+  for (size_t i = 0; i < size; ++i) {
+    seed = seed * 1103515245 + 12345;
+    bytes[i] = seed >> 16;
+  }
+  return bytes;
+}
+
+static Hash256 MakeKey(uint32_t n) {
+  return Hash256(MakeDigest(n, 32));
+}
+
+TEST(FlatHashMapTest, Basics) {
+  FlatHashMap<Hash256, uint64_t> map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.Find(MakeKey(1)) == NULL);
+
+  map[MakeKey(1)] = 100;
+  map[MakeKey(2)] += 5;
+  map[MakeKey(2)] += 5;
+  EXPECT_EQ(2, map.size());
+  ASSERT_TRUE(map.Find(MakeKey(1)) != NULL);
+  EXPECT_EQ(100, *map.Find(MakeKey(1)));
+  EXPECT_EQ(10, *map.Find(MakeKey(2)));
+  EXPECT_TRUE(map.Find(MakeKey(3)) == NULL);
+
+  *map.Find(MakeKey(1)) = 7;
+  EXPECT_EQ(7, map[MakeKey(1)]);
+  EXPECT_EQ(2, map.size());
+
+  map.clear();
+  EXPECT_TRUE(map.empty());
+  EXPECT_TRUE(map.Find(MakeKey(1)) == NULL);
+  EXPECT_EQ(0, map[MakeKey(1)]);
+}
+
+TEST(FlatHashMapTest, Growth) {
+  // Everything survives the table doubling under it many times over.
+  const uint32_t COUNT = 100000;
+  FlatHashMap<Hash256, uint32_t> map;
+  for (uint32_t i = 0; i < COUNT; ++i) {
+    map[MakeKey(i * 2)] = i;
+  }
+  EXPECT_EQ(COUNT, map.size());
+  for (uint32_t i = 0; i < COUNT; ++i) {
+    const uint32_t* value = map.Find(MakeKey(i * 2));
+    ASSERT_TRUE(value != NULL);
+    EXPECT_EQ(i, *value);
+    EXPECT_TRUE(map.Find(MakeKey(i * 2 + 1)) == NULL);
+  }
+
+  FlatHashMap<Hash160, uint32_t> reserved;
+  reserved.reserve(1000);
+  for (uint32_t i = 0; i < 1000; ++i) {
+    reserved[Hash160(MakeDigest(i, 20))] = i;
+  }
+  EXPECT_EQ(1000, reserved.size());
+  EXPECT_EQ(999, *reserved.Find(Hash160(MakeDigest(999, 20))));
+}
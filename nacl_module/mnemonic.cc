@@ -21,55 +21,58 @@
 // SOFTWARE.
 
 #include <algorithm>
+#include <cstring>
 #include <iostream>  // cerr
-#include <sstream>
 
-#include <openssl/bn.h>
-
-#include "bigint.h"
 #include "crypto.h"
 #include "mnemonic.h"
 #include "errors.h"
 
 #include "bip0039_dicts/english.cc"
 
+// The longest code is 24 words of 11 bits each.
+static const size_t MAX_CODE_WORDS = 24;
+static const size_t MAX_PACKED_BYTES = (MAX_CODE_WORDS * 11 + 7) / 8;
+
+static bool IsWordBefore(const char* a, const char* b) {
+  return strcmp(a, b) < 0;
+}
+
+static bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
 Mnemonic::Mnemonic() {
-  for (size_t i = 0; i < sizeof(static_words) / sizeof(char*); ++i) {
-    words_.push_back(static_words[i]);
-  }
-  if (words_.size() != BIP_0039_DICTIONARY_SIZE) {
+  if (sizeof(static_words) / sizeof(char*) != BIP_0039_DICTIONARY_SIZE) {
     std::cerr << "Unexpected dictionary size: " <<
-      words_.size() << std::endl;
+      sizeof(static_words) / sizeof(char*) << std::endl;
   }
 }
 
 Mnemonic::~Mnemonic() {
 }
 
-bool Mnemonic::CodeToEntropy(const std::string& code,
-                             bytes_t& entropy) {
-  std::vector<int> indexes;
-  {
-    std::istringstream iss(code);
-
-    do {
-      std::string word;
-      iss >> word;
-      if (word.empty()) {
-        continue;
-      }
+int Mnemonic::WordToIndex(const std::string& word) {
+  const char** first = static_words;
+  const char** last = static_words + BIP_0039_DICTIONARY_SIZE;
+  const char** found = std::lower_bound(first, last, word.c_str(),
+                                        IsWordBefore);
+  if (found == last || word != *found) {
+    return -1;
+  }
+  return found - first;
+}
 
-      std::vector<std::string>::iterator word_ptr = std::find(words_.begin(),
-                                                              words_.end(),
-                                                              word);
-      if (word_ptr == words_.end()) {
-        std::cerr << "code word " << word << " not in dictionary" << std::endl;
-        return false;
-      }
-      size_t index = std::distance(words_.begin(), word_ptr);
-      indexes.push_back(index);
-    } while (iss);
+const char* Mnemonic::IndexToWord(int index) {
+  if (index < 0 || index >= BIP_0039_DICTIONARY_SIZE) {
+    return NULL;
   }
+  return static_words[index];
+}
+
+bool Mnemonic::IndexesToEntropy(const std::vector<int>& indexes,
+                                bytes_t& entropy) {
+  entropy.clear();
 
   // ENT in BIP
   const size_t entropy_length_bits = indexes.size() * 32 * 11 / 33;
@@ -77,49 +80,112 @@ bool Mnemonic::CodeToEntropy(const std::string& code,
   // CS in BIP
   const size_t checksum_length_bits = entropy_length_bits / 32;
 
-  if (entropy_length_bits < 128 || entropy_length_bits > 256) {
-    std::cerr << "unexpected entropy size: " <<
-      entropy_length_bits << std::endl;
+  if (indexes.size() % 3 != 0 ||
+      entropy_length_bits < 128 || entropy_length_bits > 256) {
     return false;
   }
 
-  BigInt bi_entropy;
-
-  for (size_t i = 0; i < entropy_length_bits + checksum_length_bits; i += 11) {
-    // Make room for incoming word index.
-    bi_entropy <<= 11;
+  // Pack the 11-bit indexes MSB-first. ENT + CS is always a multiple
+  // of 11, so the checksum lands in the top bits of the byte after
+  // the entropy.
+  unsigned char packed[MAX_PACKED_BYTES];
+  size_t packed_len = 0;
+  uint32_t accumulator = 0;
+  size_t accumulated_bits = 0;
+  for (size_t i = 0; i < indexes.size(); ++i) {
+    const int index = indexes[i];
+    if (index < 0 || index >= BIP_0039_DICTIONARY_SIZE) {
+      return false;
+    }
+    accumulator = (accumulator << 11) | index;
+    accumulated_bits += 11;
+    while (accumulated_bits >= 8) {
+      accumulated_bits -= 8;
+      packed[packed_len++] = (accumulator >> accumulated_bits) & 0xff;
+    }
+  }
+  if (accumulated_bits > 0) {
+    packed[packed_len++] = (accumulator << (8 - accumulated_bits)) & 0xff;
+  }
 
-    // Convert the next word index into a BigInt.
-    BigInt bi_index = indexes[i / 11];
+  const size_t entropy_length = entropy_length_bits / 8;
+  const unsigned char checksum =
+    packed[entropy_length] >> (8 - checksum_length_bits);
 
-    // Add the word index into the running number.
-    bi_entropy += bi_index;
+  entropy.assign(packed, packed + entropy_length);
+  const bytes_t entropy_hashed(Crypto::SHA256(entropy));
+  if (checksum != entropy_hashed[0] >> (8 - checksum_length_bits)) {
+    entropy.clear();
+    return false;
   }
+  return true;
+}
 
-  // Isolate the checksum and copy to bytes.
-  BigInt bi_checksum(bi_entropy);
-  bi_checksum.maskBits(checksum_length_bits);
-  bytes_t checksum_bytes(bi_checksum.getBytes());
-  checksum_bytes.resize((checksum_length_bits + 7) / 8);
-
-  // Strip the checksum from the entropy, then copy entropy to bytes.
-  bi_entropy >>= checksum_length_bits;
-  entropy = bi_entropy.getBytes();
-  entropy.resize((entropy_length_bits + 7) / 8);
-
-  // Verify the checksum.
-  bytes_t entropy_hashed(Crypto::SHA256(entropy));
-  unsigned char checksum(checksum_bytes[0]);
-  unsigned char calculated_checksum(entropy_hashed[0]);
-  calculated_checksum >>= 8 - checksum_length_bits;
-  if (checksum != calculated_checksum) {
-    std::cerr << "checksum failed: expected " << std::hex << int(checksum) <<
-      " but got " << int(calculated_checksum) <<
-      checksum_length_bits << std::endl;
-    entropy.clear();
+bool Mnemonic::EntropyToCode(const bytes_t& entropy, std::string& code) {
+  code.clear();
+  if (entropy.size() % 4 != 0 || entropy.size() < 16 || entropy.size() > 32) {
     return false;
   }
 
+  // CS in BIP
+  const size_t checksum_length_bits = entropy.size() * 8 / 32;
+  const bytes_t entropy_hashed(Crypto::SHA256(entropy));
+
+  // Feed entropy and then checksum bits through an accumulator,
+  // emitting a word for every 11 bits.
+  uint32_t accumulator = 0;
+  size_t accumulated_bits = 0;
+  for (size_t i = 0; i <= entropy.size(); ++i) {
+    if (i < entropy.size()) {
+      accumulator = (accumulator << 8) | entropy[i];
+      accumulated_bits += 8;
+    } else {
+      accumulator = (accumulator << checksum_length_bits) |
+        (entropy_hashed[0] >> (8 - checksum_length_bits));
+      accumulated_bits += checksum_length_bits;
+    }
+    while (accumulated_bits >= 11) {
+      accumulated_bits -= 11;
+      if (!code.empty()) {
+        code += ' ';
+      }
+      code += static_words[(accumulator >> accumulated_bits) & 0x7ff];
+    }
+  }
+  return true;
+}
+
+bool Mnemonic::CodeToEntropy(const std::string& code,
+                             bytes_t& entropy) {
+  std::vector<int> indexes;
+  indexes.reserve(MAX_CODE_WORDS);
+
+  std::string::const_iterator i = code.begin();
+  while (i != code.end()) {
+    if (IsSpace(*i)) {
+      ++i;
+      continue;
+    }
+    std::string::const_iterator word_end = i;
+    while (word_end != code.end() && !IsSpace(*word_end)) {
+      ++word_end;
+    }
+    const std::string word(i, word_end);
+    i = word_end;
+
+    const int index = WordToIndex(word);
+    if (index < 0) {
+      std::cerr << "code word " << word << " not in dictionary" << std::endl;
+      return false;
+    }
+    indexes.push_back(index);
+  }
+
+  if (!IndexesToEntropy(indexes, entropy)) {
+    std::cerr << "code of " << indexes.size() <<
+      " words has bad length or checksum" << std::endl;
+    return false;
+  }
   return true;
 }
 
@@ -40,9 +40,26 @@ class Mnemonic {
                   const std::string& passphrase,
                   bytes_t& seed);
 
- private:
-  std::vector<std::string> words_;
+  // The inverse of CodeToEntropy(). Entropy must be 16 to 32 bytes in
+  // steps of 4. Returns false otherwise.
+  static bool EntropyToCode(const bytes_t& entropy, std::string& code);
+
+  // Returns the dictionary index of word, or -1 if it isn't a BIP
+  // 0039 word. Binary search over the static table; no allocation.
+  static int WordToIndex(const std::string& word);
+
+  // The inverse of WordToIndex(). Returns NULL for an out-of-range
+  // index.
+  static const char* IndexToWord(int index);
 
+  // Packs 11-bit word indexes into entropy and verifies the trailing
+  // checksum. Returns false (with entropy cleared) if the word count
+  // is invalid or the checksum doesn't match. Doesn't log, so it's
+  // cheap enough to call on many candidate codes.
+  static bool IndexesToEntropy(const std::vector<int>& indexes,
+                               bytes_t& entropy);
+
+ private:
   DISALLOW_EVIL_CONSTRUCTORS(Mnemonic);
 };
 
@@ -0,0 +1,326 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "mnemonic_recovery.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <memory>
+
+#include "crypto.h"
+#include "mnemonic.h"
+#include "node.h"
+#include "node_factory.h"
+#include "worker_pool.h"
+
+const char MnemonicRecovery::UNKNOWN_WORD[] = "?";
+
+// BIP 0039 words are unique in their first four letters, so that's all
+// a user needs to have gotten right.
+static const size_t UNIQUE_PREFIX_LENGTH = 4;
+
+static const size_t DEFAULT_BATCH_SIZE = 256;
+
+namespace {
+
+std::string IndexesToCode(const int* indexes, size_t word_count) {
+  std::string code;
+  for (size_t i = 0; i < word_count; ++i) {
+    if (i != 0) {
+      code += ' ';
+    }
+    code += Mnemonic::IndexToWord(indexes[i]);
+  }
+  return code;
+}
+
+class DerivationTask : public ParallelTask {
+ public:
+  enum { NOT_DERIVED = 0, DERIVED, MATCHED };
+
+  DerivationTask(const std::vector<int>& batch,
+                 size_t word_count,
+                 const std::string& passphrase,
+                 const std::string& path,
+                 const bytes_t& target_hash160,
+                 bool stop_at_first_match,
+                 SharedFlag* cancelled,
+                 SharedFlag* found)
+    : batch_(batch), word_count_(word_count), passphrase_(passphrase),
+      path_(path), target_hash160_(target_hash160),
+      stop_at_first_match_(stop_at_first_match),
+      cancelled_(cancelled), found_(found),
+      results_(batch.size() / word_count, NOT_DERIVED) {
+  }
+
+  size_t size() const { return results_.size(); }
+  char result(size_t index) const { return results_[index]; }
+
+  void Run(size_t index) {
+    const std::string code(IndexesToCode(&batch_[index * word_count_],
+                                         word_count_));
+    results_[index] = DERIVED;
+    bytes_t seed;
+    if (!Crypto::DeriveBIP0039Seed(code, passphrase_, seed)) {
+      return;
+    }
+    std::auto_ptr<Node> master_node(NodeFactory::CreateNodeFromSeed(seed));
+    if (!master_node.get()) {
+      return;
+    }
+    std::auto_ptr<Node> node(NodeFactory::
+                             DeriveChildNodeWithPath(*master_node, path_));
+    if (node.get() && node->hex_id() == target_hash160_) {
+      results_[index] = MATCHED;
+      found_->Set();
+    }
+  }
+
+  bool ShouldStop() {
+    return cancelled_->IsSet() ||
+      (stop_at_first_match_ && found_->IsSet());
+  }
+
+ private:
+  const std::vector<int>& batch_;
+  const size_t word_count_;
+  const std::string& passphrase_;
+  const std::string& path_;
+  const bytes_t& target_hash160_;
+  const bool stop_at_first_match_;
+  SharedFlag* cancelled_;
+  SharedFlag* found_;
+
+  // One entry per candidate. Each is written by exactly one thread.
+  std::vector<char> results_;
+};
+
+void SplitWords(const std::string& code, std::vector<std::string>& words) {
+  std::string word;
+  for (std::string::const_iterator i = code.begin(); i != code.end(); ++i) {
+    if (isspace(*i)) {
+      if (!word.empty()) {
+        words.push_back(word);
+        word.clear();
+      }
+    } else {
+      word += tolower(*i);
+    }
+  }
+  if (!word.empty()) {
+    words.push_back(word);
+  }
+}
+
+uint64_t SaturatingMultiply(uint64_t a, uint64_t b) {
+  const uint64_t max = static_cast<uint64_t>(-1);
+  if (a != 0 && b > max / a) {
+    return max;
+  }
+  return a * b;
+}
+
+}  // namespace
+
+MnemonicRecovery::MnemonicRecovery(const std::string& passphrase,
+                                   const std::string& path,
+                                   const bytes_t& target_hash160)
+  : passphrase_(passphrase), path_(path), target_hash160_(target_hash160),
+    max_edit_distance_(2), try_swaps_(true), thread_count_(0),
+    batch_size_(DEFAULT_BATCH_SIZE), stop_at_first_match_(true),
+    word_count_(0),
+    candidates_checked_(0), candidates_total_(0), seeds_derived_(0) {
+}
+
+int MnemonicRecovery::EditDistance(const std::string& a,
+                                   const std::string& b) {
+  std::vector<int> previous(b.size() + 1);
+  std::vector<int> current(b.size() + 1);
+  for (size_t j = 0; j <= b.size(); ++j) {
+    previous[j] = j;
+  }
+  for (size_t i = 1; i <= a.size(); ++i) {
+    current[0] = i;
+    for (size_t j = 1; j <= b.size(); ++j) {
+      const int substitution = previous[j - 1] + (a[i - 1] != b[j - 1]);
+      current[j] = std::min(std::min(previous[j] + 1, current[j - 1] + 1),
+                            substitution);
+    }
+    previous.swap(current);
+  }
+  return previous[b.size()];
+}
+
+void MnemonicRecovery::GetWordCandidates(const std::string& word,
+                                         int max_edit_distance,
+                                         std::vector<int>& candidates) {
+  candidates.clear();
+  if (word == UNKNOWN_WORD) {
+    for (int i = 0; i < BIP_0039_DICTIONARY_SIZE; ++i) {
+      candidates.push_back(i);
+    }
+    return;
+  }
+
+  const int index = Mnemonic::WordToIndex(word);
+  if (index >= 0) {
+    candidates.push_back(index);
+    return;
+  }
+
+  for (int i = 0; i < BIP_0039_DICTIONARY_SIZE; ++i) {
+    const std::string dictionary_word(Mnemonic::IndexToWord(i));
+    const int length_difference = dictionary_word.size() - word.size();
+    const bool shares_unique_prefix =
+      word.size() >= UNIQUE_PREFIX_LENGTH &&
+      dictionary_word.compare(0, UNIQUE_PREFIX_LENGTH,
+                              word, 0, UNIQUE_PREFIX_LENGTH) == 0;
+    if (shares_unique_prefix ||
+        (abs(length_difference) <= max_edit_distance &&
+         EditDistance(word, dictionary_word) <= max_edit_distance)) {
+      candidates.push_back(i);
+    }
+  }
+}
+
+bool MnemonicRecovery::Recover(const std::string& code,
+                               RecoveryObserver* observer,
+                               std::vector<std::string>& matches) {
+  std::vector<std::string> words;
+  SplitWords(code, words);
+  if (words.size() % 3 != 0 || words.size() < 12 || words.size() > 24) {
+    return false;
+  }
+
+  positions_t positions(words.size());
+  uint64_t product = 1;
+  for (size_t i = 0; i < words.size(); ++i) {
+    GetWordCandidates(words[i], max_edit_distance_, positions[i]);
+    if (positions[i].empty()) {
+      return false;
+    }
+    product = SaturatingMultiply(product, positions[i].size());
+  }
+
+  // Swapping only makes sense for two distinct, legible words. Each
+  // swap is an extra pass over the same-sized product.
+  std::vector<size_t> swaps;
+  if (try_swaps_) {
+    for (size_t i = 0; i + 1 < positions.size(); ++i) {
+      if (positions[i].size() == 1 && positions[i + 1].size() == 1 &&
+          positions[i][0] != positions[i + 1][0]) {
+        swaps.push_back(i);
+      }
+    }
+  }
+
+  cancelled_.Clear();
+  found_.Clear();
+  word_count_ = words.size();
+  candidates_checked_ = 0;
+  candidates_total_ = SaturatingMultiply(product, swaps.size() + 1);
+  seeds_derived_ = 0;
+  batch_.clear();
+
+  EnumerateCandidates(positions, observer, matches);
+  for (std::vector<size_t>::const_iterator i = swaps.begin();
+       i != swaps.end() && !IsDone();
+       ++i) {
+    positions_t swapped(positions);
+    swapped[*i].swap(swapped[*i + 1]);
+    EnumerateCandidates(swapped, observer, matches);
+  }
+  if (!IsDone()) {
+    FlushBatch(observer, matches);
+  }
+  batch_.clear();
+  return true;
+}
+
+void MnemonicRecovery::EnumerateCandidates(const positions_t& positions,
+                                           RecoveryObserver* observer,
+                                           std::vector<std::string>&
+                                           matches) {
+  const size_t n = positions.size();
+  std::vector<size_t> digits(n, 0);
+  std::vector<int> indexes(n);
+  bytes_t entropy;
+
+  while (!IsDone()) {
+    for (size_t i = 0; i < n; ++i) {
+      indexes[i] = positions[i][digits[i]];
+    }
+    ++candidates_checked_;
+    if (Mnemonic::IndexesToEntropy(indexes, entropy)) {
+      batch_.insert(batch_.end(), indexes.begin(), indexes.end());
+      if (batch_.size() >= batch_size_ * word_count_) {
+        FlushBatch(observer, matches);
+      }
+    }
+
+    // Advance like an odometer, last word fastest.
+    size_t p = n;
+    while (true) {
+      if (p == 0) {
+        return;
+      }
+      --p;
+      if (++digits[p] < positions[p].size()) {
+        break;
+      }
+      digits[p] = 0;
+    }
+  }
+}
+
+void MnemonicRecovery::FlushBatch(RecoveryObserver* observer,
+                                  std::vector<std::string>& matches) {
+  if (!batch_.empty()) {
+    DerivationTask task(batch_, word_count_, passphrase_, path_,
+                        target_hash160_, stop_at_first_match_,
+                        &cancelled_, &found_);
+    WorkerPool pool(thread_count_);
+    pool.Run(&task, task.size());
+
+    // Harvest in batch order so results don't depend on scheduling.
+    for (size_t i = 0; i < task.size(); ++i) {
+      if (task.result(i) == DerivationTask::NOT_DERIVED) {
+        continue;
+      }
+      ++seeds_derived_;
+      if (task.result(i) == DerivationTask::MATCHED) {
+        matches.push_back(IndexesToCode(&batch_[i * word_count_],
+                                        word_count_));
+      }
+    }
+    batch_.clear();
+  }
+
+  if (observer && !observer->OnRecoveryProgress(candidates_checked_,
+                                                candidates_total_,
+                                                seeds_derived_)) {
+    Cancel();
+  }
+}
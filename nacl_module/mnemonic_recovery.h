@@ -0,0 +1,130 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__MNEMONIC_RECOVERY_H__)
+#define __MNEMONIC_RECOVERY_H__
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "worker_pool.h"
+
+class RecoveryObserver {
+ public:
+  virtual ~RecoveryObserver() {}
+
+  // Called on the thread running Recover() after each batch. Returning
+  // false cancels the search.
+  virtual bool OnRecoveryProgress(uint64_t candidates_checked,
+                                  uint64_t candidates_total,
+                                  uint64_t seeds_derived) = 0;
+};
+
+// Finds the BIP 0039 code a user meant, given a damaged copy and an
+// address that the right code is known to produce.
+//
+// Each position in the damaged code becomes a list of candidate
+// words: the word itself if it's in the dictionary, every word if
+// it's UNKNOWN_WORD, and every dictionary word within
+// max_edit_distance if it's misspelled. Optionally, adjacent pairs of
+// valid words are also tried swapped. The cartesian product of those
+// lists is walked in order and filtered by the code's checksum, which
+// rejects all but 1/16 to 1/256 of candidates for the price of one
+// SHA-256. Survivors are collected into batches and each batch runs
+// PBKDF2 and BIP 0032 derivation on a WorkerPool.
+class MnemonicRecovery {
+ public:
+  // Stand-in for a word the user can't read at all.
+  static const char UNKNOWN_WORD[];
+
+  // passphrase is the BIP 0039 passphrase. path is a BIP 0032 path
+  // from the master node ("m/44'/0'/0'/0/0") to the node whose hash160
+  // should equal target_hash160.
+  MnemonicRecovery(const std::string& passphrase,
+                   const std::string& path,
+                   const bytes_t& target_hash160);
+
+  void set_max_edit_distance(int d) { max_edit_distance_ = d; }
+  void set_try_swaps(bool try_swaps) { try_swaps_ = try_swaps; }
+  void set_thread_count(size_t count) { thread_count_ = count; }
+  void set_batch_size(size_t size) { batch_size_ = size > 0 ? size : 1; }
+  void set_stop_at_first_match(bool stop) { stop_at_first_match_ = stop; }
+
+  // Searches for codes matching the target. Matching codes are
+  // appended to matches in enumeration order. Returns false if the
+  // damaged code doesn't have a valid BIP 0039 word count or a
+  // position has no candidates at all.
+  bool Recover(const std::string& code,
+               RecoveryObserver* observer,
+               std::vector<std::string>& matches);
+
+  // Safe to call from another thread or from the observer.
+  void Cancel() { cancelled_.Set(); }
+  bool was_cancelled() const { return cancelled_.IsSet(); }
+
+  // Dictionary indexes that might have been meant by word.
+  static void GetWordCandidates(const std::string& word,
+                                int max_edit_distance,
+                                std::vector<int>& candidates);
+
+  // Levenshtein distance.
+  static int EditDistance(const std::string& a, const std::string& b);
+
+ private:
+  typedef std::vector<std::vector<int> > positions_t;
+
+  void EnumerateCandidates(const positions_t& positions,
+                           RecoveryObserver* observer,
+                           std::vector<std::string>& matches);
+  void FlushBatch(RecoveryObserver* observer,
+                  std::vector<std::string>& matches);
+  bool IsDone() const {
+    return cancelled_.IsSet() || (stop_at_first_match_ && found_.IsSet());
+  }
+
+  const std::string passphrase_;
+  const std::string path_;
+  const bytes_t target_hash160_;
+
+  int max_edit_distance_;
+  bool try_swaps_;
+  size_t thread_count_;
+  size_t batch_size_;
+  bool stop_at_first_match_;
+
+  SharedFlag cancelled_;
+  SharedFlag found_;
+
+  size_t word_count_;
+  uint64_t candidates_checked_;
+  uint64_t candidates_total_;
+  uint64_t seeds_derived_;
+
+  // Flattened word indexes of checksum-valid candidates awaiting
+  // derivation, word_count_ per candidate.
+  std::vector<int> batch_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(MnemonicRecovery);
+};
+
+#endif  // #if !defined(__MNEMONIC_RECOVERY_H__)
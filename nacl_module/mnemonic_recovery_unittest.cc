@@ -0,0 +1,150 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "mnemonic.h"
+#include "mnemonic_recovery.h"
+#include "node.h"
+#include "node_factory.h"
+#include "types.h"
+
+static const std::string CODE("legal winner thank year wave sausage worth "
+                              "useful legal winner thank yellow");
+static const std::string PASSPHRASE("TREZOR");
+static const std::string PATH("m/0'/0/0");
+
+static bytes_t TargetForCode(const std::string& code) {
+  Mnemonic m;
+  bytes_t seed;
+  EXPECT_TRUE(m.CodeToSeed(code, PASSPHRASE, seed));
+  std::auto_ptr<Node> master_node(NodeFactory::CreateNodeFromSeed(seed));
+  std::auto_ptr<Node> node(NodeFactory::DeriveChildNodeWithPath(*master_node,
+                                                                PATH));
+  return node->hex_id();
+}
+
+class CountingObserver : public RecoveryObserver {
+ public:
+  CountingObserver(bool keep_going)
+    : keep_going_(keep_going), calls_(0), last_checked_(0) {}
+
+  bool OnRecoveryProgress(uint64_t candidates_checked,
+                          uint64_t /*candidates_total*/,
+                          uint64_t /*seeds_derived*/) {
+    EXPECT_GE(candidates_checked, last_checked_);
+    last_checked_ = candidates_checked;
+    ++calls_;
+    return keep_going_;
+  }
+
+  bool keep_going_;
+  int calls_;
+  uint64_t last_checked_;
+};
+
+TEST(MnemonicRecoveryTest, EditDistance) {
+  EXPECT_EQ(0, MnemonicRecovery::EditDistance("legal", "legal"));
+  EXPECT_EQ(1, MnemonicRecovery::EditDistance("legal", "legl"));
+  EXPECT_EQ(1, MnemonicRecovery::EditDistance("legal", "lebal"));
+  EXPECT_EQ(2, MnemonicRecovery::EditDistance("legal", "elgal"));
+  EXPECT_EQ(5, MnemonicRecovery::EditDistance("", "legal"));
+}
+
+TEST(MnemonicRecoveryTest, WordCandidates) {
+  std::vector<int> candidates;
+  MnemonicRecovery::GetWordCandidates("?", 2, candidates);
+  EXPECT_EQ(BIP_0039_DICTIONARY_SIZE, (int)candidates.size());
+
+  MnemonicRecovery::GetWordCandidates("legal", 2, candidates);
+  ASSERT_EQ(1, (int)candidates.size());
+  EXPECT_EQ(Mnemonic::WordToIndex("legal"), candidates[0]);
+
+  MnemonicRecovery::GetWordCandidates("lgeal", 1, candidates);
+  EXPECT_TRUE(candidates.empty());
+  MnemonicRecovery::GetWordCandidates("lgeal", 2, candidates);
+  EXPECT_NE(candidates.end(), std::find(candidates.begin(), candidates.end(),
+                                        Mnemonic::WordToIndex("legal")));
+
+  // A unique four-letter prefix is enough regardless of distance.
+  MnemonicRecovery::GetWordCandidates("sausgae", 0, candidates);
+  ASSERT_EQ(1, (int)candidates.size());
+  EXPECT_EQ(Mnemonic::WordToIndex("sausage"), candidates[0]);
+}
+
+TEST(MnemonicRecoveryTest, UnknownWord) {
+  MnemonicRecovery r(PASSPHRASE, PATH, TargetForCode(CODE));
+  r.set_try_swaps(false);
+  CountingObserver observer(true);
+  std::vector<std::string> matches;
+  EXPECT_TRUE(r.Recover("legal winner thank year wave ? worth "
+                        "useful legal winner thank yellow",
+                        &observer, matches));
+  ASSERT_EQ(1, (int)matches.size());
+  EXPECT_EQ(CODE, matches[0]);
+  EXPECT_LT(0, observer.calls_);
+  EXPECT_FALSE(r.was_cancelled());
+}
+
+TEST(MnemonicRecoveryTest, MisspelledAndSwappedWords) {
+  MnemonicRecovery r(PASSPHRASE, PATH, TargetForCode(CODE));
+  std::vector<std::string> matches;
+  EXPECT_TRUE(r.Recover("legal winner thank year wave sausage worth "
+                        "useful legal winner thnak yelow",
+                        NULL, matches));
+  ASSERT_EQ(1, (int)matches.size());
+  EXPECT_EQ(CODE, matches[0]);
+
+  matches.clear();
+  EXPECT_TRUE(r.Recover("legal winner thank year wave sausage useful "
+                        "worth legal winner thank yellow",
+                        NULL, matches));
+  ASSERT_EQ(1, (int)matches.size());
+  EXPECT_EQ(CODE, matches[0]);
+}
+
+TEST(MnemonicRecoveryTest, Cancel) {
+  MnemonicRecovery r(PASSPHRASE, PATH, TargetForCode(CODE));
+  r.set_batch_size(1);
+  CountingObserver observer(false);
+  std::vector<std::string> matches;
+  EXPECT_TRUE(r.Recover("? ? thank year wave sausage worth "
+                        "useful legal winner thank yellow",
+                        &observer, matches));
+  EXPECT_TRUE(matches.empty());
+  EXPECT_TRUE(r.was_cancelled());
+  EXPECT_EQ(1, observer.calls_);
+}
+
+TEST(MnemonicRecoveryTest, BadInput) {
+  MnemonicRecovery r(PASSPHRASE, PATH, bytes_t(20, 0));
+  std::vector<std::string> matches;
+  EXPECT_FALSE(r.Recover("legal winner thank", NULL, matches));
+  EXPECT_FALSE(r.Recover("legal winner thank year wave sausage worth "
+                         "useful legal winner thank qqqqqqqqqq",
+                         NULL, matches));
+}
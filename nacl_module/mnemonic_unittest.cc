@@ -64,8 +64,48 @@ TEST(MnemonicTest, BIP0039TestVectors) {
     EXPECT_TRUE(m.CodeToEntropy(code, derived_entropy));
     EXPECT_EQ(entropy, derived_entropy);
 
+    std::string derived_code;
+    EXPECT_TRUE(Mnemonic::EntropyToCode(entropy, derived_code));
+    EXPECT_EQ(code, derived_code);
+
     bytes_t derived_seed;
     EXPECT_TRUE(m.CodeToSeed(code, "TREZOR", derived_seed));
     EXPECT_EQ(seed, derived_seed);
   }
 }
+
+TEST(MnemonicTest, WordLookup) {
+  EXPECT_EQ(0, Mnemonic::WordToIndex("abandon"));
+  EXPECT_EQ(3, Mnemonic::WordToIndex("about"));
+  EXPECT_EQ(2047, Mnemonic::WordToIndex("zoo"));
+  EXPECT_EQ(-1, Mnemonic::WordToIndex(""));
+  EXPECT_EQ(-1, Mnemonic::WordToIndex("abando"));
+  EXPECT_EQ(-1, Mnemonic::WordToIndex("zoos"));
+  EXPECT_EQ(-1, Mnemonic::WordToIndex("Abandon"));
+}
+
+TEST(MnemonicTest, RejectsBadCodes) {
+  Mnemonic m;
+  bytes_t entropy;
+
+  // Bad checksum: the last word of the all-zero vector is "about".
+  EXPECT_FALSE(m.CodeToEntropy("abandon abandon abandon abandon abandon "
+                               "abandon abandon abandon abandon abandon "
+                               "abandon abandon", entropy));
+  EXPECT_TRUE(entropy.empty());
+
+  // Wrong amount of entropy.
+  std::string code;
+  EXPECT_FALSE(Mnemonic::EntropyToCode(bytes_t(12, 0), code));
+  EXPECT_FALSE(Mnemonic::EntropyToCode(bytes_t(17, 0), code));
+  EXPECT_FALSE(Mnemonic::EntropyToCode(bytes_t(36, 0), code));
+
+  // Wrong number of words.
+  EXPECT_FALSE(m.CodeToEntropy("abandon abandon about", entropy));
+
+  // Extra whitespace is harmless.
+  EXPECT_TRUE(m.CodeToEntropy("  abandon abandon abandon abandon abandon "
+                              "abandon abandon abandon abandon abandon\t"
+                              "abandon   about\n", entropy));
+  EXPECT_EQ(bytes_t(16, 0), entropy);
+}
@@ -22,13 +22,25 @@
 
 #include "node.h"
 
+#include <cstring>
 #include <sstream>
 #include <string>
 
 #include "base58.h"
 #include "crypto.h"
+#include "openssl/crypto.h"
 #include "secp256k1.h"
 
+// Copies up to size bytes of source into dest, zero-filling the rest.
+static void CopyPadded(unsigned char* dest, size_t size,
+                       const unsigned char* source, size_t source_size) {
+  const size_t copy_size = source_size < size ? source_size : size;
+  if (copy_size > 0) {
+    memcpy(dest, source, copy_size);
+  }
+  memset(dest + copy_size, 0, size - copy_size);
+}
+
 Node::Node(const bytes_t& key,
            const bytes_t& chain_code,
            uint32_t version,
@@ -39,21 +51,34 @@ Node::Node(const bytes_t& key,
   depth_(depth),
   parent_fingerprint_(parent_fingerprint),
   child_num_(child_num) {
-  set_key(key);
-  set_chain_code(chain_code);
+  set_key(key.empty() ? NULL : &key[0], key.size());
+  CopyPadded(chain_code_, CHAIN_CODE_SIZE,
+             chain_code.empty() ? NULL : &chain_code[0], chain_code.size());
 }
 
-Node::~Node() {
+Node::Node(const unsigned char* key,
+           size_t key_size,
+           const unsigned char* chain_code,
+           uint32_t version,
+           unsigned int depth,
+           uint32_t parent_fingerprint,
+           uint32_t child_num) :
+  version_(version),
+  depth_(depth),
+  parent_fingerprint_(parent_fingerprint),
+  child_num_(child_num) {
+  set_key(key, key_size);
+  CopyPadded(chain_code_, CHAIN_CODE_SIZE, chain_code, CHAIN_CODE_SIZE);
 }
 
 std::string Node::toString() const {
   std::stringstream ss;
   ss << "version: " << std::hex << version_ << std::endl
-     << "hex_id: " << to_hex(hex_id_) << std::endl
-     << "fingerprint: " << std::hex << fingerprint_ << std::endl
-     << "secret_key: " << to_hex(secret_key_) << std::endl
-     << "public_key: " << to_hex(public_key_) << std::endl
-     << "chain_code: " << to_hex(chain_code_) << std::endl
+     << "hex_id: " << to_hex(hex_id()) << std::endl
+     << "fingerprint: " << std::hex << fingerprint() << std::endl
+     << "secret_key: " << to_hex(secret_key()) << std::endl
+     << "public_key: " << to_hex(public_key()) << std::endl
+     << "chain_code: " << to_hex(chain_code()) << std::endl
      << "depth: " << depth_ << std::endl
      << "parent_fingerprint: " << std::hex << parent_fingerprint_ << std::endl
      << "child_num: " << child_num_ << std::endl
@@ -62,36 +87,55 @@ std::string Node::toString() const {
   return ss.str();
 }
 
-void Node::set_key(const bytes_t& new_key) {
-  secret_key_.clear();
+void Node::Wipe() {
+  // Unlike memset(), this can't be optimized away as a dead store.
+  OPENSSL_cleanse(secret_key_, SECRET_KEY_SIZE);
+  OPENSSL_cleanse(chain_code_, CHAIN_CODE_SIZE);
+  OPENSSL_cleanse(public_key_, PUBLIC_KEY_SIZE);
+  OPENSSL_cleanse(hex_id_, HASH160_SIZE);
+  fingerprint_ = 0;
+  // The memoized values are gone, so don't claim to have them.
+  has_public_key_ = false;
+  has_hex_id_ = false;
+}
+
+void Node::set_key(const unsigned char* new_key, size_t new_key_size) {
   // TODO(miket): check key_num validity
-  is_private_ = new_key.size() == 32;
+  is_private_ = new_key_size == SECRET_KEY_SIZE;
   version_ = is_private_ ? 0x0488ADE4 : 0x0488B21E;
   if (is_private()) {
-    secret_key_ = new_key;
-    secp256k1_key curvekey;
-    curvekey.setPrivKey(secret_key_);
-    public_key_ = curvekey.getPubKey();
+    memcpy(secret_key_, new_key, SECRET_KEY_SIZE);
+    has_public_key_ = false;
   } else {
-    public_key_ = new_key;
+    memset(secret_key_, 0, SECRET_KEY_SIZE);
+    CopyPadded(public_key_, PUBLIC_KEY_SIZE, new_key, new_key_size);
+    has_public_key_ = true;
   }
-  update_fingerprint();
+  has_hex_id_ = false;
 }
 
-void Node::set_chain_code(const bytes_t& new_code) {
-  chain_code_ = new_code;
+void Node::UpdatePublicKey() const {
+  secp256k1_key curvekey;
+  curvekey.setPrivKey(bytes_t(secret_key_, secret_key_ + SECRET_KEY_SIZE));
+  const bytes_t public_key(curvekey.getPubKey());
+  CopyPadded(public_key_, PUBLIC_KEY_SIZE, &public_key[0],
+             public_key.size());
+  has_public_key_ = true;
 }
 
-void Node::update_fingerprint() {
-  hex_id_ = Crypto::SHA256ThenRIPE(public_key_);
+void Node::UpdateHexId() const {
+  const bytes_t hash160(Crypto::SHA256ThenRIPE(public_key()));
+  memcpy(hex_id_, &hash160[0], HASH160_SIZE);
   fingerprint_ = (uint32_t)hex_id_[0] << 24 |
     (uint32_t)hex_id_[1] << 16 |
     (uint32_t)hex_id_[2] << 8 |
     (uint32_t)hex_id_[3];
+  has_hex_id_ = true;
 }
 
 bytes_t Node::toSerialized(bool private_if_available) const {
   bytes_t s;
+  s.reserve(78);
   bool should_generate_private = is_private() && private_if_available;
 
   // 4 byte: version bytes (mainnet: 0x0488B21E public, 0x0488ADE4 private;
@@ -120,16 +164,18 @@ bytes_t Node::toSerialized(bool private_if_available) const {
   s.push_back((uint32_t)child_num_ & 0xff);
 
   // 32 bytes: the chain code
-  s.insert(s.end(), chain_code().begin(), chain_code().end());
+  s.insert(s.end(), chain_code_, chain_code_ + CHAIN_CODE_SIZE);
 
   // 33 bytes: the public key or private key data (0x02 + X or 0x03 + X
   // for public keys, 0x00 + k for private keys)
   bool use_private = is_private() && private_if_available;
-  const bytes_t& key = use_private ? secret_key() : public_key();
   if (use_private) {
     s.push_back(0x00);
+    s.insert(s.end(), secret_key_, secret_key_ + SECRET_KEY_SIZE);
+  } else {
+    const unsigned char* public_key = public_key_data();
+    s.insert(s.end(), public_key, public_key + PUBLIC_KEY_SIZE);
   }
-  s.insert(s.end(), key.begin(), key.end());
 
   return s;
 }
@@ -20,48 +20,132 @@
 // CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#if !defined(__NODE_H__)
+#define __NODE_H__
+
+#include <string>
+
+#include "fixed_bytes.h"
 #include "types.h"
 
+// A BIP 0032 extended key. All key material lives in fixed-size
+// inline arrays and there are no virtual methods, so a Node is
+// trivially copyable and costs no allocations to create, copy or
+// destroy. The bytes_t accessors build a vector on each call; hot
+// paths should use the *_data() pointers instead.
+//
+// For private nodes, the public key (an EC multiply) and the hash160
+// and fingerprint derived from it are computed on first access and
+// then remembered. That first access writes to the node, so a node
+// shared between threads should have fingerprint() called on it
+// before it's shared.
 class Node {
  public:
+  enum {
+    SECRET_KEY_SIZE = 32,
+    PUBLIC_KEY_SIZE = 33,
+    CHAIN_CODE_SIZE = 32,
+    HASH160_SIZE = 20
+  };
+
   Node(const bytes_t& key,
        const bytes_t& chain_code,
        uint32_t version,
        unsigned int depth,
        uint32_t parent_fingerprint,
        uint32_t child_num);
-  virtual ~Node();
+  Node(const unsigned char* key,
+       size_t key_size,
+       const unsigned char* chain_code,
+       uint32_t version,
+       unsigned int depth,
+       uint32_t parent_fingerprint,
+       uint32_t child_num);
 
   bool is_private() const { return is_private_; }
   uint32_t version() const { return version_; }
-  const bytes_t& hex_id() const { return hex_id_; }
-  uint32_t fingerprint() const { return fingerprint_; }
-  const bytes_t& secret_key() const { return secret_key_; }
-  const bytes_t& public_key() const { return public_key_; }
-  const bytes_t& chain_code() const { return chain_code_; }
+  bytes_t hex_id() const {
+    EnsureHexId();
+    return bytes_t(hex_id_, hex_id_ + HASH160_SIZE);
+  }
+  uint32_t fingerprint() const {
+    EnsureHexId();
+    return fingerprint_;
+  }
+  bytes_t secret_key() const {
+    return is_private_ ?
+      bytes_t(secret_key_, secret_key_ + SECRET_KEY_SIZE) : bytes_t();
+  }
+  bytes_t public_key() const {
+    EnsurePublicKey();
+    return bytes_t(public_key_, public_key_ + PUBLIC_KEY_SIZE);
+  }
+  bytes_t chain_code() const {
+    return bytes_t(chain_code_, chain_code_ + CHAIN_CODE_SIZE);
+  }
   unsigned int depth() const { return depth_; }
   uint32_t parent_fingerprint() const { return parent_fingerprint_; }
   uint32_t child_num() const { return child_num_; }
 
+  Hash160 hash160() const {
+    EnsureHexId();
+    return Hash160(hex_id_);
+  }
+  PubKey33 public_key33() const {
+    EnsurePublicKey();
+    return PubKey33(public_key_);
+  }
+
+  const unsigned char* hex_id_data() const {
+    EnsureHexId();
+    return hex_id_;
+  }
+  const unsigned char* secret_key_data() const { return secret_key_; }
+  const unsigned char* public_key_data() const {
+    EnsurePublicKey();
+    return public_key_;
+  }
+  const unsigned char* chain_code_data() const { return chain_code_; }
+
   std::string toString() const;
   bytes_t toSerialized(bool public_if_available) const;
   bytes_t toSerialized() const;
   bytes_t toSerializedPublic() const;
   bytes_t toSerializedPrivate() const;
 
+  // Zeroes the key material. Used by holders of long-lived private
+  // nodes, such as NodeCache, before letting go of them.
+  void Wipe();
+
  private:
-  void set_key(const bytes_t& new_key);
-  void set_chain_code(const bytes_t& new_code);
-  void update_fingerprint();
+  void set_key(const unsigned char* new_key, size_t new_key_size);
+  void EnsurePublicKey() const {
+    if (!has_public_key_) {
+      UpdatePublicKey();
+    }
+  }
+  void EnsureHexId() const {
+    if (!has_hex_id_) {
+      UpdateHexId();
+    }
+  }
+  void UpdatePublicKey() const;
+  void UpdateHexId() const;
 
   bool is_private_;
   uint32_t version_;
-  bytes_t hex_id_;
-  uint32_t fingerprint_;
-  bytes_t secret_key_;
-  bytes_t public_key_;
-  bytes_t chain_code_;
   unsigned int depth_;
   uint32_t parent_fingerprint_;
   uint32_t child_num_;
+  unsigned char secret_key_[SECRET_KEY_SIZE];
+  unsigned char chain_code_[CHAIN_CODE_SIZE];
+
+  // Memoized; see the class comment.
+  mutable bool has_public_key_;
+  mutable bool has_hex_id_;
+  mutable uint32_t fingerprint_;
+  mutable unsigned char hex_id_[HASH160_SIZE];
+  mutable unsigned char public_key_[PUBLIC_KEY_SIZE];
 };
+
+#endif  // #if !defined(__NODE_H__)
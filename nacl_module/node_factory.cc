@@ -23,6 +23,7 @@
 #include "node_factory.h"
 
 #include <algorithm>
+#include <cstring>
 #include <iterator>
 #include <iomanip>
 #include <iostream>
@@ -36,11 +37,16 @@
 #include "openssl/sha.h"
 #include "secp256k1.h"
 #include "types.h"
+#include "worker_pool.h"
 
 const std::string CURVE_ORDER_BYTES("FFFFFFFFFFFFFFFFFFFFFFFFFFFFFF\
 FEBAAEDCE6AF48A03BBFD25E8CD0364141");
 const BigInt CURVE_ORDER(CURVE_ORDER_BYTES);
 
+// Large enough to amortize WorkerPool's thread spawns, small enough
+// that progress reports and cancellation stay responsive.
+const uint32_t RANGE_BATCH_SIZE = 1024;
+
 Node* NodeFactory::CreateNodeFromSeed(const bytes_t& seed) {
   const std::string BIP0032_HMAC_KEY("Bitcoin seed");
   bytes_t digest;
@@ -53,8 +59,9 @@ Node* NodeFactory::CreateNodeFromSeed(const bytes_t& seed) {
        &digest[0],
        NULL);
 
-  return new Node(bytes_t(&digest[0], &digest[32]),
-                  bytes_t(&digest[32], &digest[64]),
+  return new Node(&digest[0],
+                  Node::SECRET_KEY_SIZE,
+                  &digest[32],
                   0,
                   0,
                   0,
@@ -99,89 +106,293 @@ Node* NodeFactory::CreateNodeFromExtended(const bytes_t& bytes) {
                   child_num);
 }
 
+// The workhorse behind both DeriveChildNode() overloads. A child's
+// parent_fingerprint costs an EC multiply on a private parent, so
+// DeriveChildNodeWithPath() skips it for the intermediate nodes it
+// throws away.
+static bool DeriveChild(const Node& parent_node, uint32_t i,
+                        bool needs_parent_fingerprint, Node& child_node);
+
+DerivationPath::DerivationPath(const std::string& path) {
+  std::istringstream iss(path);
+  std::string token;
+  bool is_first_part = true;
+  while (std::getline(iss, token, '/')) {
+    // The first part is "m".
+    if (is_first_part || token.empty()) {
+      is_first_part = false;
+      continue;
+    }
+    uint32_t n = strtol(&token[0], NULL, 10);
+    if (token.rfind('\'') != std::string::npos) {
+      n += 0x80000000;
+    }
+    indexes_.push_back(n);
+  }
+}
+
+DerivationPath DerivationPath::Child(uint32_t i) const {
+  DerivationPath child(*this);
+  child.indexes_.push_back(i);
+  return child;
+}
+
+NodeCache::NodeCache(size_t max_size) : max_size_(max_size) {
+}
+
+NodeCache::~NodeCache() {
+  Clear();
+}
+
+bytes_t NodeCache::MakeKey(const Node& root,
+                           const DerivationPath& path,
+                           size_t prefix_length) {
+  // The root's hash160 alone would let a public and a private node
+  // with the same key share entries, so mix in privacy and the chain
+  // code too.
+  bytes_t key;
+  key.reserve(1 + Node::HASH160_SIZE + Node::CHAIN_CODE_SIZE +
+              prefix_length * 4);
+  key.push_back(root.is_private() ? 1 : 0);
+  key.insert(key.end(), root.hex_id_data(),
+             root.hex_id_data() + Node::HASH160_SIZE);
+  key.insert(key.end(), root.chain_code_data(),
+             root.chain_code_data() + Node::CHAIN_CODE_SIZE);
+  for (size_t i = 0; i < prefix_length; ++i) {
+    const uint32_t n = path[i];
+    key.push_back(n >> 24);
+    key.push_back((n >> 16) & 0xff);
+    key.push_back((n >> 8) & 0xff);
+    key.push_back(n & 0xff);
+  }
+  return key;
+}
+
+size_t NodeCache::FindDeepestPrefix(const Node& root,
+                                    const DerivationPath& path,
+                                    Node& ancestor) {
+  if (cache_.empty() || path.size() < 2) {
+    return 0;
+  }
+  bytes_t key(MakeKey(root, path, path.size() - 1));
+  for (size_t length = path.size() - 1; length > 0; --length) {
+    cache_t::const_iterator i = cache_.find(key);
+    if (i != cache_.end()) {
+      ancestor = i->second;
+      return length;
+    }
+    key.resize(key.size() - 4);
+  }
+  return 0;
+}
+
+void NodeCache::Add(const Node& root,
+                    const DerivationPath& path,
+                    size_t prefix_length,
+                    const Node& node) {
+  if (max_size_ == 0 || prefix_length == 0) {
+    return;
+  }
+  const bytes_t key(MakeKey(root, path, prefix_length));
+  if (cache_.count(key) != 0) {
+    return;
+  }
+  while (cache_.size() >= max_size_) {
+    cache_t::iterator i = cache_.find(insertion_order_.front());
+    i->second.Wipe();
+    cache_.erase(i);
+    insertion_order_.pop_front();
+  }
+  // A hit is usually the parent of the node being derived, which
+  // needs this node's fingerprint. Memoize it here once rather than
+  // in every copy handed out.
+  cache_.insert(std::make_pair(key, node)).first->second.fingerprint();
+  insertion_order_.push_back(key);
+}
+
+void NodeCache::Clear() {
+  for (cache_t::iterator i = cache_.begin(); i != cache_.end(); ++i) {
+    i->second.Wipe();
+  }
+  cache_.clear();
+  insertion_order_.clear();
+}
+
 Node* NodeFactory::DeriveChildNodeWithPath(const Node& parent_node,
                                            const std::string& path) {
-    std::istringstream iss(path);
-    std::string token;
-    std::vector<std::string> node_path_parts;
-    while (std::getline(iss, token, '/')) {
-      node_path_parts.push_back(token);
+  return DeriveChildNodeWithPath(parent_node, DerivationPath(path), NULL);
+}
+
+Node* NodeFactory::DeriveChildNodeWithPath(const Node& parent_node,
+                                           const DerivationPath& path,
+                                           NodeCache* cache) {
+  // Nodes are trivially copyable, so walk the path on the stack and
+  // allocate only the result.
+  Node child_node(parent_node);
+  Node temp_node(parent_node);
+  size_t i = 0;
+  if (cache) {
+    i = cache->FindDeepestPrefix(parent_node, path, child_node);
+  }
+  for (; i < path.size(); ++i) {
+    const uint32_t n = path[i];
+    const bool is_last = i + 1 == path.size();
+    if (!DeriveChild(child_node, n, is_last, temp_node)) {
+      return NULL;
     }
-    std::auto_ptr<Node> child_node(new Node(parent_node));
-    for (size_t i = 1; i < node_path_parts.size(); ++i) {
-      std::string part = node_path_parts[i];
-      if (part.empty()) {
-        continue;
-      }
-      uint32_t n = strtol(&part[0], NULL, 10);
-      if (part.rfind('\'') != std::string::npos) {
-        n += 0x80000000;
-      }
-      Node* temp_node = NodeFactory::DeriveChildNode(*child_node, n);
-      if (!temp_node) {
-        return NULL;
-      }
-      if (temp_node->parent_fingerprint() != child_node->fingerprint()) {
-        return NULL;
-      }
-      if (temp_node->child_num() != n) {
-        return NULL;
-      }
-      if (temp_node->depth() != child_node->depth() + 1) {
-        return NULL;
-      }
-      child_node.reset(temp_node);
+    if (temp_node.child_num() != n) {
+      return NULL;
+    }
+    if (temp_node.depth() != child_node.depth() + 1) {
+      return NULL;
     }
-    return child_node.release();
+    child_node = temp_node;
+    if (cache && !is_last) {
+      cache->Add(parent_node, path, i + 1, child_node);
+    }
+  }
+  return new Node(child_node);
 }
 
 Node* NodeFactory::DeriveChildNode(const Node& parent_node, uint32_t i) {
+  Node child_node(parent_node);
+  if (!DeriveChild(parent_node, i, true, child_node)) {
+    return NULL;
+  }
+  return new Node(child_node);
+}
+
+bool NodeFactory::DeriveChildNode(const Node& parent_node, uint32_t i,
+                                  Node& child_node) {
+  return DeriveChild(parent_node, i, true, child_node);
+}
+
+// Derives one batch of DeriveChildRange(). Each index writes only its
+// own slots in the output arrays.
+class RangeTask : public ParallelTask {
+ public:
+  RangeTask(const Node& parent_node,
+            uint32_t first_index,
+            unsigned char* public_keys,
+            unsigned char* hash160s)
+    : parent_node_(parent_node), first_index_(first_index),
+      public_keys_(public_keys), hash160s_(hash160s) {
+  }
+
+  virtual void Run(size_t index) {
+    Node child_node(parent_node_);
+    if (!DeriveChild(parent_node_, first_index_ + index, false,
+                     child_node)) {
+      return;
+    }
+    memcpy(public_keys_ + index * Node::PUBLIC_KEY_SIZE,
+           child_node.public_key_data(), Node::PUBLIC_KEY_SIZE);
+    memcpy(hash160s_ + index * Node::HASH160_SIZE,
+           child_node.hex_id_data(), Node::HASH160_SIZE);
+  }
+
+ private:
+  const Node& parent_node_;
+  const uint32_t first_index_;
+  unsigned char* public_keys_;
+  unsigned char* hash160s_;
+};
+
+bool NodeFactory::DeriveChildRange(const Node& parent_node,
+                                   uint32_t start,
+                                   uint32_t count,
+                                   size_t thread_count,
+                                   RangeObserver* observer,
+                                   bytes_t& public_keys,
+                                   bytes_t& hash160s,
+                                   uint32_t& derived_count) {
+  derived_count = 0;
+  public_keys.assign(static_cast<size_t>(count) * Node::PUBLIC_KEY_SIZE, 0);
+  hash160s.assign(static_cast<size_t>(count) * Node::HASH160_SIZE, 0);
+  if (count == 0) {
+    return true;
+  }
+  const uint32_t last = start + (count - 1);
+  if (last < start) {
+    return false;
+  }
+  if ((last & 0x80000000) && !parent_node.is_private()) {
+    return false;
+  }
+
+  // Every worker reads the parent, so fill in its lazily computed
+  // public key before there's more than one thread.
+  const Node parent(parent_node);
+  parent.public_key_data();
+
+  WorkerPool pool(thread_count);
+  while (derived_count < count) {
+    uint32_t batch_size = count - derived_count;
+    if (batch_size > RANGE_BATCH_SIZE) {
+      batch_size = RANGE_BATCH_SIZE;
+    }
+    RangeTask task(parent,
+                   start + derived_count,
+                   &public_keys[static_cast<size_t>(derived_count) *
+                                Node::PUBLIC_KEY_SIZE],
+                   &hash160s[static_cast<size_t>(derived_count) *
+                             Node::HASH160_SIZE]);
+    pool.Run(&task, batch_size);
+    derived_count += batch_size;
+    if (observer && !observer->OnRangeProgress(derived_count, count)) {
+      return derived_count == count;
+    }
+  }
+  return true;
+}
+
+static bool DeriveChild(const Node& parent_node, uint32_t i,
+                        bool needs_parent_fingerprint, Node& child_node) {
   // If the caller is asking for a private derivation but we don't
   // have the private key, exit with error.
   bool wants_private = (i & 0x80000000) != 0;
   if (wants_private && !parent_node.is_private()) {
-    return NULL;
+    return false;
   }
 
   // https://github.com/bitcoin/bips/blob/master/bip-0032.mediawiki#private-child-key-derivation
-  bytes_t child_data;
+  unsigned char child_data[1 + Node::SECRET_KEY_SIZE + 4];
+  size_t child_data_size = 0;
 
   if (wants_private) {
     // Push the parent's private key
-    child_data.push_back(0x00);
-    child_data.insert(child_data.end(),
-                      parent_node.secret_key().begin(),
-                      parent_node.secret_key().end());
+    child_data[child_data_size++] = 0x00;
+    memcpy(&child_data[child_data_size], parent_node.secret_key_data(),
+           Node::SECRET_KEY_SIZE);
+    child_data_size += Node::SECRET_KEY_SIZE;
   } else {
     // Push just the parent's public key
-    child_data.insert(child_data.end(),
-                      parent_node.public_key().begin(),
-                      parent_node.public_key().end());
+    memcpy(&child_data[child_data_size], parent_node.public_key_data(),
+           Node::PUBLIC_KEY_SIZE);
+    child_data_size += Node::PUBLIC_KEY_SIZE;
   }
   // Push i
-  child_data.push_back(i >> 24);
-  child_data.push_back((i >> 16) & 0xff);
-  child_data.push_back((i >> 8) & 0xff);
-  child_data.push_back(i & 0xff);
+  child_data[child_data_size++] = i >> 24;
+  child_data[child_data_size++] = (i >> 16) & 0xff;
+  child_data[child_data_size++] = (i >> 8) & 0xff;
+  child_data[child_data_size++] = i & 0xff;
 
   // Now HMAC the whole thing
-  bytes_t digest;
-  digest.resize(EVP_MAX_MD_SIZE);
+  unsigned char digest[EVP_MAX_MD_SIZE];
   HMAC(EVP_sha512(),
-       &parent_node.chain_code()[0],
-       parent_node.chain_code().size(),
-       &child_data[0],
-       child_data.size(),
-       &digest[0],
+       parent_node.chain_code_data(),
+       Node::CHAIN_CODE_SIZE,
+       child_data,
+       child_data_size,
+       digest,
        NULL);
 
   // Split HMAC into two pieces.
-  const bytes_t left32(digest.begin(), digest.begin() + 32);
-  const bytes_t right32(digest.begin() + 32, digest.begin() + 64);
+  const bytes_t left32(digest, digest + 32);
   const BigInt iLeft(left32);
   if (false && iLeft >= CURVE_ORDER) {
     // TODO: "and one should proceed with the next value for i."
-    return NULL;
+    return false;
   }
 
   bytes_t new_child_key;
@@ -191,7 +402,7 @@ Node* NodeFactory::DeriveChildNode(const Node& parent_node, uint32_t i) {
     k %= CURVE_ORDER;
     if (k.isZero()) {
       // TODO: "and one should proceed with the next value for i."
-      return NULL;
+      return false;
     }
     bytes_t child_key = k.getBytes();
     // pad with zeros to make it 32 bytes
@@ -203,16 +414,18 @@ Node* NodeFactory::DeriveChildNode(const Node& parent_node, uint32_t i) {
     K.generator_mul(left32);
     if (K.is_at_infinity()) {
       // TODO: "and one should proceed with the next value for i."
-      return NULL;
+      return false;
     }
     new_child_key = K.bytes();
   }
 
   // Chain code is right half of HMAC output
-  return new Node(new_child_key,
-                  right32,
-                  parent_node.version(),  // TODO(miket): ?
-                  parent_node.depth() + 1,
-                  parent_node.fingerprint(),
-                  i);
+  child_node = Node(&new_child_key[0],
+                    new_child_key.size(),
+                    digest + 32,
+                    parent_node.version(),  // TODO(miket): ?
+                    parent_node.depth() + 1,
+                    needs_parent_fingerprint ? parent_node.fingerprint() : 0,
+                    i);
+  return true;
 }
@@ -20,9 +20,88 @@
 // CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#if !defined(__NODE_FACTORY_H__)
+#define __NODE_FACTORY_H__
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "node.h"
 #include "types.h"
 
-class Node;
+// A parsed BIP 0032 path, e.g., "m/0'/1/2" as {0x80000000, 1, 2}.
+// Parse once and reuse rather than handing strings to NodeFactory in
+// a loop.
+class DerivationPath {
+ public:
+  DerivationPath() {}
+
+  // Accepts the same loose syntax DeriveChildNodeWithPath() always
+  // has: the first component ("m") is skipped, empty components are
+  // ignored, and a trailing ' marks a hardened index.
+  explicit DerivationPath(const std::string& path);
+
+  DerivationPath Child(uint32_t i) const;
+
+  size_t size() const { return indexes_.size(); }
+  uint32_t operator[](size_t i) const { return indexes_[i]; }
+  const std::vector<uint32_t>& indexes() const { return indexes_; }
+
+ private:
+  std::vector<uint32_t> indexes_;
+};
+
+// Remembers intermediate nodes so that deriving m/0/0, m/0/1, ...
+// derives m/0 once and then only the final step each time. Entries
+// are keyed by the root node's identity and the path prefix, and the
+// oldest entry is evicted (and wiped) once max_size is reached.
+// Holds private nodes when given private roots, so owners should
+// Clear() it when credentials lock. Not thread-safe.
+class NodeCache {
+ public:
+  explicit NodeCache(size_t max_size);
+  ~NodeCache();
+
+  // Returns the length of the longest proper prefix of path that's
+  // cached for root, copying that node into ancestor. Returns zero,
+  // leaving ancestor untouched, if there's none.
+  size_t FindDeepestPrefix(const Node& root,
+                           const DerivationPath& path,
+                           Node& ancestor);
+
+  // Caches node as the result of the first prefix_length steps of
+  // path from root.
+  void Add(const Node& root,
+           const DerivationPath& path,
+           size_t prefix_length,
+           const Node& node);
+
+  void Clear();
+  size_t size() const { return cache_.size(); }
+
+ private:
+  typedef std::map<bytes_t, Node> cache_t;
+
+  static bytes_t MakeKey(const Node& root,
+                         const DerivationPath& path,
+                         size_t prefix_length);
+
+  const size_t max_size_;
+  cache_t cache_;
+  std::deque<bytes_t> insertion_order_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(NodeCache);
+};
+
+// Hears from NodeFactory::DeriveChildRange() between batches, on the
+// calling thread. Returning false cancels the rest of the range.
+class RangeObserver {
+ public:
+  virtual ~RangeObserver() {}
+  virtual bool OnRangeProgress(uint32_t derived, uint32_t total) = 0;
+};
 
 class NodeFactory {
  public:
@@ -41,7 +120,40 @@ class NodeFactory {
   static Node* DeriveChildNodeWithPath(const Node& parent_node,
                                        const std::string& path);
 
+  // As above with a pre-parsed path. If cache isn't NULL, the deepest
+  // cached ancestor is used as the starting point, and any
+  // intermediate nodes derived along the way are added to it.
+  static Node* DeriveChildNodeWithPath(const Node& parent_node,
+                                       const DerivationPath& path,
+                                       NodeCache* cache = NULL);
+
   // TODO
   static Node* DeriveChildNode(const Node& parent_node,
                                uint32_t i);
+
+  // Same as above, but writes into child_node rather than allocating.
+  // Returns false (leaving child_node untouched) on failure.
+  static bool DeriveChildNode(const Node& parent_node,
+                              uint32_t i,
+                              Node& child_node);
+
+  // Derives children start through start + count - 1 of parent_node
+  // on thread_count threads (zero means one per processor). Their
+  // public keys and hash160s are written in index order, packed, to
+  // public_keys and hash160s, which are resized to fit. An index
+  // that can't be derived is left zero-filled. The range is worked in
+  // batches, and observer (if not NULL) hears after each one;
+  // derived_count is the number of leading indexes that are done.
+  // Returns false if the range is invalid or the observer cancelled
+  // it short.
+  static bool DeriveChildRange(const Node& parent_node,
+                               uint32_t start,
+                               uint32_t count,
+                               size_t thread_count,
+                               RangeObserver* observer,
+                               bytes_t& public_keys,
+                               bytes_t& hash160s,
+                               uint32_t& derived_count);
 };
+
+#endif  // #if !defined(__NODE_FACTORY_H__)
@@ -176,3 +176,163 @@ TEST(NodeTest, BIP0039AndBIP0044) {
   EXPECT_EQ("1HdTg7hSZCSzEvYJ9DJPAnw2TnVdqdLYMP",
             Base58::toAddress(child_node->public_key()));
 }
+
+TEST(NodeTest, CopyAndDeriveInPlace) {
+  const bytes_t seed(unhexlify("000102030405060708090a0b0c0d0e0f"));
+  std::auto_ptr<Node> parent_node(NodeFactory::CreateNodeFromSeed(seed));
+
+  // Copies are plain value copies.
+  Node copy(*parent_node);
+  EXPECT_EQ(parent_node->toSerialized(), copy.toSerialized());
+  EXPECT_EQ(parent_node->hex_id(), copy.hex_id());
+
+  // Deriving into an existing Node gives the same answer as the
+  // allocating version.
+  std::auto_ptr<Node> child_node(NodeFactory::DeriveChildNode(*parent_node,
+                                                              0x80000000));
+  EXPECT_TRUE(NodeFactory::DeriveChildNode(copy, 0x80000000, copy));
+  EXPECT_EQ(child_node->toSerialized(), copy.toSerialized());
+  EXPECT_EQ(child_node->fingerprint(), copy.fingerprint());
+
+  // Public-only parents can't derive hardened children, and the
+  // target is left alone.
+  std::auto_ptr<Node>
+    public_node(NodeFactory::CreateNodeFromExtended(parent_node->
+                                                    toSerializedPublic()));
+  EXPECT_FALSE(public_node->is_private());
+  EXPECT_FALSE(NodeFactory::DeriveChildNode(*public_node, 0x80000000, copy));
+  EXPECT_EQ(child_node->toSerialized(), copy.toSerialized());
+}
+
+TEST(NodeTest, DerivationPathAndCache) {
+  const DerivationPath path("m/0'/1/2'/2");
+  ASSERT_EQ(4, path.size());
+  EXPECT_EQ(0x80000000, path[0]);
+  EXPECT_EQ(1, path[1]);
+  EXPECT_EQ(0x80000002, path[2]);
+  EXPECT_EQ(2, path[3]);
+  EXPECT_EQ(5, path.Child(7).size());
+  EXPECT_EQ(7, path.Child(7)[4]);
+  EXPECT_EQ(0, DerivationPath("m").size());
+
+  const bytes_t seed(unhexlify("000102030405060708090a0b0c0d0e0f"));
+  std::auto_ptr<Node> root(NodeFactory::CreateNodeFromSeed(seed));
+  std::auto_ptr<Node> expected(NodeFactory::
+                               DeriveChildNodeWithPath(*root, "m/0'/1/2'/2"));
+
+  // Only intermediates are cached, and the oldest go first.
+  NodeCache cache(2);
+  std::auto_ptr<Node> node(NodeFactory::DeriveChildNodeWithPath(*root, path,
+                                                                &cache));
+  EXPECT_EQ(expected->toSerialized(), node->toSerialized());
+  EXPECT_EQ(2, cache.size());
+
+  // A hit gives a byte-identical node, parent fingerprint included.
+  Node ancestor(*root);
+  EXPECT_EQ(3, cache.FindDeepestPrefix(*root, path, ancestor));
+  node.reset(NodeFactory::DeriveChildNodeWithPath(*root, path, &cache));
+  EXPECT_EQ(expected->toSerialized(), node->toSerialized());
+  node.reset(NodeFactory::DeriveChildNodeWithPath(*root, path.Child(0),
+                                                  &cache));
+  std::auto_ptr<Node> sibling(NodeFactory::
+                              DeriveChildNodeWithPath(*root,
+                                                      "m/0'/1/2'/2/0"));
+  EXPECT_EQ(sibling->toSerialized(), node->toSerialized());
+
+  // Entries are per root; a public root sharing the key doesn't hit.
+  std::auto_ptr<Node>
+    public_root(NodeFactory::CreateNodeFromExtended(root->
+                                                    toSerializedPublic()));
+  EXPECT_EQ(0, cache.FindDeepestPrefix(*public_root, path, ancestor));
+
+  cache.Clear();
+  EXPECT_EQ(0, cache.size());
+  EXPECT_EQ(0, cache.FindDeepestPrefix(*root, path, ancestor));
+}
+
+class RangeCounter : public RangeObserver {
+ public:
+  explicit RangeCounter(bool keep_going)
+    : keep_going_(keep_going), calls_(0), last_derived_(0) {}
+  virtual bool OnRangeProgress(uint32_t derived, uint32_t /*total*/) {
+    ++calls_;
+    last_derived_ = derived;
+    return keep_going_;
+  }
+
+  bool keep_going_;
+  int calls_;
+  uint32_t last_derived_;
+};
+
+TEST(NodeTest, DeriveChildRange) {
+  const bytes_t seed(unhexlify("000102030405060708090a0b0c0d0e0f"));
+  std::auto_ptr<Node> root(NodeFactory::CreateNodeFromSeed(seed));
+  std::auto_ptr<Node>
+    public_root(NodeFactory::CreateNodeFromExtended(root->
+                                                    toSerializedPublic()));
+
+  // Same answers, in the same order, as one-at-a-time derivation.
+  const uint32_t START = 5;
+  const uint32_t COUNT = 40;
+  bytes_t public_keys;
+  bytes_t hash160s;
+  uint32_t derived_count = 0;
+  RangeCounter counter(true);
+  EXPECT_TRUE(NodeFactory::DeriveChildRange(*public_root, START, COUNT, 4,
+                                            &counter, public_keys, hash160s,
+                                            derived_count));
+  EXPECT_EQ(COUNT, derived_count);
+  EXPECT_EQ(1, counter.calls_);
+  EXPECT_EQ(COUNT, counter.last_derived_);
+  ASSERT_EQ(COUNT * Node::PUBLIC_KEY_SIZE, public_keys.size());
+  ASSERT_EQ(COUNT * Node::HASH160_SIZE, hash160s.size());
+  for (uint32_t i = 0; i < COUNT; ++i) {
+    std::auto_ptr<Node> child(NodeFactory::DeriveChildNode(*root, START + i));
+    EXPECT_EQ(child->public_key(),
+              bytes_t(&public_keys[i * Node::PUBLIC_KEY_SIZE],
+                      &public_keys[(i + 1) * Node::PUBLIC_KEY_SIZE]));
+    EXPECT_EQ(child->hex_id(),
+              bytes_t(&hash160s[i * Node::HASH160_SIZE],
+                      &hash160s[(i + 1) * Node::HASH160_SIZE]));
+  }
+
+  // Hardened ranges need a private parent; ranges can't wrap.
+  EXPECT_FALSE(NodeFactory::DeriveChildRange(*public_root, 0x7ffffffe, 4, 1,
+                                             NULL, public_keys, hash160s,
+                                             derived_count));
+  EXPECT_FALSE(NodeFactory::DeriveChildRange(*root, 0xfffffffe, 4, 1,
+                                             NULL, public_keys, hash160s,
+                                             derived_count));
+  EXPECT_TRUE(NodeFactory::DeriveChildRange(*root, 0x80000000, 2, 2,
+                                            NULL, public_keys, hash160s,
+                                            derived_count));
+  std::auto_ptr<Node> hardened(NodeFactory::DeriveChildNode(*root,
+                                                            0x80000001));
+  EXPECT_EQ(hardened->hex_id(),
+            bytes_t(&hash160s[Node::HASH160_SIZE],
+                    &hash160s[2 * Node::HASH160_SIZE]));
+}
+
+TEST(NodeTest, DeriveChildRangeCancel) {
+  const bytes_t seed(unhexlify("000102030405060708090a0b0c0d0e0f"));
+  std::auto_ptr<Node> root(NodeFactory::CreateNodeFromSeed(seed));
+  std::auto_ptr<Node>
+    public_root(NodeFactory::CreateNodeFromExtended(root->
+                                                    toSerializedPublic()));
+
+  // Stopping after the first batch leaves the rest zero-filled.
+  const uint32_t COUNT = 1025;
+  bytes_t public_keys;
+  bytes_t hash160s;
+  uint32_t derived_count = 0;
+  RangeCounter counter(false);
+  EXPECT_FALSE(NodeFactory::DeriveChildRange(*public_root, 0, COUNT, 0,
+                                             &counter, public_keys, hash160s,
+                                             derived_count));
+  EXPECT_EQ(1, counter.calls_);
+  EXPECT_LT(0, derived_count);
+  EXPECT_GT(COUNT, derived_count);
+  EXPECT_NE(0, public_keys[(derived_count - 1) * Node::PUBLIC_KEY_SIZE]);
+  EXPECT_EQ(0, public_keys[derived_count * Node::PUBLIC_KEY_SIZE]);
+}
@@ -0,0 +1,126 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "reservation_ledger.h"
+
+static const uint64_t DEFAULT_TIMEOUT = 10 * 60;
+
+ReservationLedger::ReservationLedger()
+  : timeout_(DEFAULT_TIMEOUT) {
+}
+
+void ReservationLedger::Reserve(const bytes_t& tx_hash,
+                                const tx_ins_t& inputs,
+                                uint32_t change_index,
+                                uint64_t now) {
+  Release(tx_hash);
+
+  Reservation& reservation = reservations_[tx_hash];
+  for (tx_ins_t::const_iterator i = inputs.begin(); i != inputs.end(); ++i) {
+    const outpoint_t outpoint(i->prev_txo_hash(), i->prev_txo_index());
+    reservation.outpoints.push_back(outpoint);
+    reserved_outpoints_.insert(outpoint);
+  }
+  reservation.change_index = change_index;
+  if (change_index != NO_CHANGE) {
+    reserved_change_indexes_.insert(change_index);
+  }
+  reservation.reserved_at = now;
+}
+
+bool ReservationLedger::Release(const bytes_t& tx_hash) {
+  reservation_map_t::iterator i = reservations_.find(tx_hash);
+  if (i == reservations_.end()) {
+    return false;
+  }
+  const Reservation& reservation = i->second;
+  for (std::vector<outpoint_t>::const_iterator j =
+         reservation.outpoints.begin();
+       j != reservation.outpoints.end();
+       ++j) {
+    reserved_outpoints_.erase(*j);
+  }
+  reserved_change_indexes_.erase(reservation.change_index);
+  reservations_.erase(i);
+  return true;
+}
+
+void ReservationLedger::Expire(uint64_t now) {
+  std::vector<bytes_t> expired;
+  for (reservation_map_t::const_iterator i = reservations_.begin();
+       i != reservations_.end();
+       ++i) {
+    if (now >= i->second.reserved_at + timeout_) {
+      expired.push_back(i->first);
+    }
+  }
+  for (std::vector<bytes_t>::const_iterator i = expired.begin();
+       i != expired.end();
+       ++i) {
+    Release(*i);
+  }
+}
+
+void ReservationLedger::
+GetReservedTxHashes(std::vector<bytes_t>& tx_hashes) const {
+  tx_hashes.clear();
+  for (reservation_map_t::const_iterator i = reservations_.begin();
+       i != reservations_.end();
+       ++i) {
+    tx_hashes.push_back(i->first);
+  }
+}
+
+bool ReservationLedger::IsOutputReserved(const bytes_t& tx_hash,
+                                         uint32_t tx_output_n) const {
+  return reserved_outpoints_.count(outpoint_t(tx_hash, tx_output_n)) != 0;
+}
+
+void ReservationLedger::RemoveReservedOutputs(tx_outs_t& unspent_txos) const {
+  if (reserved_outpoints_.empty()) {
+    return;
+  }
+  // Compact in place, swapping rather than copying the keepers down.
+  size_t kept = 0;
+  for (size_t i = 0; i < unspent_txos.size(); ++i) {
+    if (IsOutputReserved(unspent_txos[i].tx_hash(),
+                         unspent_txos[i].tx_output_n())) {
+      continue;
+    }
+    if (kept != i) {
+      unspent_txos[kept].swap(unspent_txos[i]);
+    }
+    ++kept;
+  }
+  unspent_txos.erase(unspent_txos.begin() + kept, unspent_txos.end());
+}
+
+uint32_t ReservationLedger::GetNextFreeChangeIndex(uint32_t first) const {
+  uint32_t index = first;
+  std::set<uint32_t>::const_iterator i =
+    reserved_change_indexes_.lower_bound(first);
+  while (i != reserved_change_indexes_.end() && *i == index) {
+    ++index;
+    ++i;
+  }
+  return index;
+}
@@ -0,0 +1,92 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__RESERVATION_LEDGER_H__)
+#define __RESERVATION_LEDGER_H__
+
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "tx.h"
+#include "types.h"
+
+// Remembers what the txs we've built, but haven't yet seen come back
+// from the network, have laid claim to: the outputs they spend and
+// the change address index they pay. Until then the blockchain still
+// thinks those outputs are unspent and that change address unused,
+// so without this two spends in a row could pick the same ones.
+//
+// A reservation ends when its tx is reported (the blockchain then
+// knows the truth), when it's explicitly released because the tx was
+// abandoned, or when it times out. Times are in seconds and supplied
+// by the caller.
+class ReservationLedger {
+ public:
+  static const uint32_t NO_CHANGE = 0xffffffff;
+
+  ReservationLedger();
+
+  // How long a reservation lasts. Defaults to ten minutes.
+  void set_timeout(uint64_t timeout) { timeout_ = timeout; }
+
+  // change_index is NO_CHANGE if the tx pays no change.
+  void Reserve(const bytes_t& tx_hash,
+               const tx_ins_t& inputs,
+               uint32_t change_index,
+               uint64_t now);
+
+  // Returns false if there was no such reservation.
+  bool Release(const bytes_t& tx_hash);
+
+  // Releases every reservation made more than timeout ago.
+  void Expire(uint64_t now);
+
+  size_t size() const { return reservations_.size(); }
+  void GetReservedTxHashes(std::vector<bytes_t>& tx_hashes) const;
+
+  bool IsOutputReserved(const bytes_t& tx_hash, uint32_t tx_output_n) const;
+  void RemoveReservedOutputs(tx_outs_t& unspent_txos) const;
+
+  // The first index at or after first that no reservation holds.
+  uint32_t GetNextFreeChangeIndex(uint32_t first) const;
+
+ private:
+  typedef std::pair<bytes_t, uint32_t> outpoint_t;
+
+  struct Reservation {
+    std::vector<outpoint_t> outpoints;
+    uint32_t change_index;
+    uint64_t reserved_at;
+  };
+  typedef std::map<bytes_t, Reservation> reservation_map_t;
+
+  reservation_map_t reservations_;
+  std::set<outpoint_t> reserved_outpoints_;
+  std::set<uint32_t> reserved_change_indexes_;
+  uint64_t timeout_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(ReservationLedger);
+};
+
+#endif  // #if !defined(__RESERVATION_LEDGER_H__)
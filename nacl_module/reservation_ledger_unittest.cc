@@ -0,0 +1,111 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "gtest/gtest.h"
+
+#include "reservation_ledger.h"
+#include "tx.h"
+#include "types.h"
+
+static const bytes_t FUNDING_HASH(32, 0xab);
+static const bytes_t SCRIPT(unhexlify("76a91462e907b15cbf27d5425399ebf6f0fb50"
+                                      "ebb88f1888ac"));
+
+static tx_ins_t MakeInputs(uint32_t first, uint32_t count) {
+  tx_ins_t inputs;
+  for (uint32_t i = first; i < first + count; ++i) {
+    inputs.push_back(TxIn(FUNDING_HASH, i, SCRIPT, bytes_t()));
+  }
+  return inputs;
+}
+
+TEST(ReservationLedgerTest, ReserveAndRelease) {
+  ReservationLedger ledger;
+  const bytes_t tx_1(32, 1);
+  const bytes_t tx_2(32, 2);
+
+  ledger.Reserve(tx_1, MakeInputs(0, 2), 5, 100);
+  ledger.Reserve(tx_2, MakeInputs(2, 1), ReservationLedger::NO_CHANGE, 100);
+  EXPECT_EQ(2, ledger.size());
+  EXPECT_TRUE(ledger.IsOutputReserved(FUNDING_HASH, 0));
+  EXPECT_TRUE(ledger.IsOutputReserved(FUNDING_HASH, 2));
+  EXPECT_FALSE(ledger.IsOutputReserved(FUNDING_HASH, 3));
+  EXPECT_FALSE(ledger.IsOutputReserved(tx_1, 0));
+
+  tx_outs_t unspent_txos;
+  for (uint32_t i = 0; i < 4; ++i) {
+    unspent_txos.push_back(TxOut(1000, SCRIPT, i, FUNDING_HASH));
+  }
+  ledger.RemoveReservedOutputs(unspent_txos);
+  ASSERT_EQ(1, unspent_txos.size());
+  EXPECT_EQ(3, unspent_txos[0].tx_output_n());
+
+  EXPECT_TRUE(ledger.Release(tx_1));
+  EXPECT_FALSE(ledger.Release(tx_1));
+  EXPECT_FALSE(ledger.IsOutputReserved(FUNDING_HASH, 0));
+  EXPECT_TRUE(ledger.IsOutputReserved(FUNDING_HASH, 2));
+
+  std::vector<bytes_t> tx_hashes;
+  ledger.GetReservedTxHashes(tx_hashes);
+  ASSERT_EQ(1, tx_hashes.size());
+  EXPECT_EQ(tx_2, tx_hashes[0]);
+}
+
+TEST(ReservationLedgerTest, ChangeIndexes) {
+  ReservationLedger ledger;
+  EXPECT_EQ(3, ledger.GetNextFreeChangeIndex(3));
+
+  ledger.Reserve(bytes_t(32, 1), MakeInputs(0, 1), 3, 0);
+  ledger.Reserve(bytes_t(32, 2), MakeInputs(1, 1), 4, 0);
+  ledger.Reserve(bytes_t(32, 3), MakeInputs(2, 1), 6, 0);
+  EXPECT_EQ(5, ledger.GetNextFreeChangeIndex(3));
+  EXPECT_EQ(2, ledger.GetNextFreeChangeIndex(2));
+  EXPECT_EQ(7, ledger.GetNextFreeChangeIndex(6));
+
+  ledger.Release(bytes_t(32, 1));
+  EXPECT_EQ(3, ledger.GetNextFreeChangeIndex(3));
+}
+
+TEST(ReservationLedgerTest, Expire) {
+  ReservationLedger ledger;
+  ledger.set_timeout(60);
+  ledger.Reserve(bytes_t(32, 1), MakeInputs(0, 1), 0, 1000);
+  ledger.Reserve(bytes_t(32, 2), MakeInputs(1, 1), 1, 1030);
+
+  ledger.Expire(1059);
+  EXPECT_EQ(2, ledger.size());
+  ledger.Expire(1060);
+  EXPECT_EQ(1, ledger.size());
+  EXPECT_FALSE(ledger.IsOutputReserved(FUNDING_HASH, 0));
+  EXPECT_EQ(0, ledger.GetNextFreeChangeIndex(0));
+  ledger.Expire(1090);
+  EXPECT_EQ(0, ledger.size());
+
+  // Reserving the same tx again replaces, rather than adds to, what
+  // it held.
+  ledger.Reserve(bytes_t(32, 3), MakeInputs(0, 2), 0, 2000);
+  ledger.Reserve(bytes_t(32, 3), MakeInputs(1, 1), 1, 2000);
+  EXPECT_EQ(1, ledger.size());
+  EXPECT_FALSE(ledger.IsOutputReserved(FUNDING_HASH, 0));
+  EXPECT_TRUE(ledger.IsOutputReserved(FUNDING_HASH, 1));
+  EXPECT_EQ(0, ledger.GetNextFreeChangeIndex(0));
+}
@@ -25,56 +25,23 @@
 #include <iostream>  // cerr
 
 #include <algorithm>
-#include <istream>
 #include <iterator>
+#include <limits>
 #include <memory>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <vector>
 
 #include "base58.h"
+#include "coin_selector.h"
 #include "crypto.h"
 #include "errors.h"
 #include "node.h"
 #include "node_factory.h"
-
-static uint16_t ReadUint16(std::istream& s) {
-  return s.get() | (s.get() << 8);
-}
-
-static uint32_t ReadUint32(std::istream& s) {
-  return s.get() | (s.get() << 8) | (s.get() << 16) | (s.get() << 24);
-}
-
-static uint64_t ReadUint64(std::istream& s) {
-  return (uint64_t)s.get() |
-    ((uint64_t)s.get() << 8) |
-    ((uint64_t)s.get() << 16) |
-    ((uint64_t)s.get() << 24) |
-    ((uint64_t)s.get() << 32) |
-    ((uint64_t)s.get() << 40) |
-    ((uint64_t)s.get() << 48) |
-    ((uint64_t)s.get() << 56);
-}
-
-static uint64_t ReadVarInt(std::istream& s) {
-  uint64_t value = s.get();
-  if (value < 0xfd) {
-    return value;
-  }
-  if (value == 0xfd) {
-    return ReadUint16(s);
-  }
-  if (value == 0xfe) {
-    return ReadUint32(s);
-  }
-  return ReadUint64(s);
-}
-
-static void ReadIntoBytes(std::istream& s, bytes_t& b, uint32_t len) {
-  b.resize(len);
-  s.read(reinterpret_cast<char *>(&b[0]), b.capacity());
-}
+#include "openssl/crypto.h"
+#include "tx_view.h"
+#include "worker_pool.h"
 
 static void PushUint16(bytes_t& out, uint16_t value) {
   out.push_back((value) & 0xff);
@@ -99,6 +66,19 @@ static void PushUint64(bytes_t& out, uint64_t value) {
   out.push_back((value >> 56) & 0xff);
 }
 
+static size_t VarIntSize(uint64_t value) {
+  if (value < 0xfd) {
+    return 1;
+  }
+  if (value <= 0xffff) {
+    return 1 + 2;
+  }
+  if (value <= 0xffffffff) {
+    return 1 + 4;
+  }
+  return 1 + 8;
+}
+
 static void PushVarInt(bytes_t& out, uint64_t value) {
   if (value < 0xfd) {
     out.push_back(value & 0xff);
@@ -107,10 +87,12 @@ static void PushVarInt(bytes_t& out, uint64_t value) {
   if (value <= 0xffff) {
     out.push_back(0xfd);
     PushUint16(out, value & 0xffff);
+    return;
   }
   if (value <= 0xffffffff) {
     out.push_back(0xfe);
     PushUint32(out, value & 0xffffffff);
+    return;
   }
   out.push_back(0xff);
   PushUint64(out, value);
@@ -121,31 +103,26 @@ static void PushBytesWithSize(bytes_t& out, const bytes_t& b) {
   out.insert(out.end(), b.begin(), b.end());
 }
 
-TxIn::TxIn(std::istream& is) {
-  bytes_t hash_serialized;
-  ReadIntoBytes(is, hash_serialized, 32);
-  prev_txo_hash_.resize(hash_serialized.size());
-  std::reverse_copy(hash_serialized.begin(),
-                    hash_serialized.end(),
-                    prev_txo_hash_.begin());
-
-  prev_txo_index_ = ReadUint32(is);
-  uint64_t script_len = ReadVarInt(is);
-  ReadIntoBytes(is, script_, script_len);
-  sequence_no_ = ReadUint32(is);
-  should_serialize_script_ = true;
+TxIn::TxIn(const TxView& view, size_t index)
+  : prev_txo_hash_(view.prev_txo_hash(index)),
+    prev_txo_index_(view.inputs()[index].prev_txo_index),
+    script_(view.input_script(index)),
+    sequence_no_(view.inputs()[index].sequence_no),
+    script_type_(SCRIPT_TYPE_UNKNOWN), should_serialize_script_(true) {
 }
 
 TxIn::TxIn(const std::string& coinbase_message)
   : prev_txo_hash_(32, 0), prev_txo_index_(-1),
     script_(coinbase_message.begin(), coinbase_message.end()),
-    sequence_no_(-1), should_serialize_script_(true) {
+    sequence_no_(-1), script_type_(SCRIPT_TYPE_UNKNOWN),
+    should_serialize_script_(true) {
 }
 
 TxIn::TxIn(const Transaction& tx, uint32_t tx_n)
   : prev_txo_hash_(tx.hash()), prev_txo_index_(tx_n),
     script_(tx.outputs()[tx_n].script()),
-    sequence_no_(-1), should_serialize_script_(true) {
+    sequence_no_(-1), script_type_(tx.outputs()[tx_n].script_type()),
+    should_serialize_script_(true) {
 }
 
 TxIn::TxIn(const bytes_t& hash,
@@ -153,14 +130,25 @@ TxIn::TxIn(const bytes_t& hash,
            const bytes_t& script,
            const bytes_t& hash160)
   : prev_txo_hash_(hash), prev_txo_index_(index), script_(script),
-    sequence_no_(-1), hash160_(hash160), should_serialize_script_(true) {
+    sequence_no_(-1), hash160_(hash160), script_type_(SCRIPT_TYPE_UNKNOWN),
+    should_serialize_script_(true) {
 }
 
 bytes_t TxIn::Serialize() const {
-  bytes_t s(prev_txo_hash_.size(), 0);
-  std::reverse_copy(prev_txo_hash_.begin(),
-                    prev_txo_hash_.end(),
-                    s.begin());
+  bytes_t s;
+  s.reserve(SerializedSize());
+  SerializeTo(s);
+  return s;
+}
+
+size_t TxIn::SerializedSize() const {
+  size_t script_size = should_serialize_script_ ? script_.size() : 0;
+  return prev_txo_hash_.size() + 4 +
+    VarIntSize(script_size) + script_size + 4;
+}
+
+void TxIn::SerializeTo(bytes_t& s) const {
+  s.insert(s.end(), prev_txo_hash_.rbegin(), prev_txo_hash_.rend());
   PushUint32(s, prev_txo_index_);
   if (should_serialize_script_) {
     PushBytesWithSize(s, script_);
@@ -168,58 +156,70 @@ bytes_t TxIn::Serialize() const {
     PushVarInt(s, 0);
   }
   PushUint32(s, sequence_no_);
-  return s;
 }
 
-Transaction::Transaction() {
-  UpdateHash();
+Transaction::Transaction()
+  : version_(1), lock_time_(0), hash_is_dirty_(true), max_signed_size_(0) {
 }
 
-Transaction::Transaction(std::istream& is) {
-  version_ = ReadUint32(is);
-  if (version_ != 1) {
-    std::cerr << "rejecting unrecognized tx version" << std::endl;
-    return;
-  }
-  uint64_t tx_in_count = ReadVarInt(is);
-  for (uint64_t i = 0; i < tx_in_count; ++i) {
-    inputs_.push_back(TxIn(is));
+Transaction::Transaction(const TxView& view)
+  : version_(view.version()), lock_time_(view.lock_time()),
+    hash_(view.hash()), hash_is_dirty_(false), max_signed_size_(0) {
+  inputs_.reserve(view.inputs().size());
+  for (size_t i = 0; i < view.inputs().size(); ++i) {
+    inputs_.push_back(TxIn(view, i));
   }
-  uint64_t tx_out_count = ReadVarInt(is);
-  for (uint64_t i = 0; i < tx_out_count; ++i) {
-    TxOut tx_out(is);
-    tx_out.set_tx_output_n(outputs_.size());
-    outputs_.push_back(tx_out);
+  outputs_.reserve(view.outputs().size());
+  for (size_t i = 0; i < view.outputs().size(); ++i) {
+    outputs_.push_back(TxOut(view, i));
   }
-  lock_time_ = ReadUint32(is);
-  UpdateHash();
 }
 
 void Transaction::Add(const TxIn& tx_in) {
   inputs_.push_back(tx_in);
-  UpdateHash();
+  hash_is_dirty_ = true;
 }
 
 void Transaction::Add(const TxOut& tx_out) {
-  TxOut out(tx_out);
-  out.set_tx_output_n(outputs_.size());
-  outputs_.push_back(out);
-  UpdateHash();
+  outputs_.push_back(tx_out);
+  outputs_.back().set_tx_output_n(outputs_.size() - 1);
+  hash_is_dirty_ = true;
 }
 
-void Transaction::UpdateHash() {
-  bytes_t serialized = Serialize();
-  bytes_t hash_bigendian = Crypto::DoubleSHA256(serialized);
-  hash_.resize(hash_bigendian.size());
-  std::reverse_copy(hash_bigendian.begin(),
-                    hash_bigendian.end(),
-                    hash_.begin());
+const bytes_t& Transaction::hash() const {
+  if (hash_is_dirty_) {
+    bytes_t hash_bigendian = Crypto::DoubleSHA256(Serialize());
+    hash_.assign(hash_bigendian.rbegin(), hash_bigendian.rend());
+    hash_is_dirty_ = false;
+  }
+  return hash_;
 }
 
 // https://en.bitcoin.it/wiki/Transactions
 bytes_t Transaction::Serialize() const {
   bytes_t s;
+  s.reserve(SerializedSize());
+  SerializeTo(s);
+  return s;
+}
 
+size_t Transaction::SerializedSize() const {
+  size_t size = 4 + VarIntSize(inputs_.size());
+  for (tx_ins_t::const_iterator i = inputs_.begin();
+       i != inputs_.end();
+       ++i) {
+    size += i->SerializedSize();
+  }
+  size += VarIntSize(outputs_.size());
+  for (tx_outs_t::const_iterator i = outputs_.begin();
+       i != outputs_.end();
+       ++i) {
+    size += i->SerializedSize();
+  }
+  return size + 4;
+}
+
+void Transaction::SerializeTo(bytes_t& s) const {
   // Version 1
   PushUint32(s, 1);
 
@@ -228,52 +228,139 @@ bytes_t Transaction::Serialize() const {
   for (tx_ins_t::const_iterator i = inputs_.begin();
        i != inputs_.end();
        ++i) {
-    bytes_t tx_in_bytes = i->Serialize();
-    s.insert(s.end(), tx_in_bytes.begin(), tx_in_bytes.end());
+    i->SerializeTo(s);
   }
 
   // Number of outputs
   PushVarInt(s, outputs_.size());
-
   for (tx_outs_t::const_iterator i = outputs_.begin();
        i != outputs_.end();
        ++i) {
-    bytes_t tx_out_bytes = i->Serialize();
-    s.insert(s.end(), tx_out_bytes.begin(), tx_out_bytes.end());
+    i->SerializeTo(s);
   }
 
   // Lock time
-  PushUint32(s, 0);
+  PushUint32(s, lock_time_);
+}
 
-  return s;
+// A signed P2PKH input: outpoint, script length, a push of a DER
+// signature (at most 72 bytes) plus its hash type byte, a push of a
+// compressed public key, and the sequence number.
+static const size_t MAX_DER_SIGNATURE_SIZE = 72;
+static const size_t P2PKH_SCRIPT_SIG_SIZE =
+  1 + MAX_DER_SIGNATURE_SIZE + 1 + 1 + 33;
+static const size_t P2PKH_SIGNED_INPUT_SIZE =
+  32 + 4 + 1 + P2PKH_SCRIPT_SIG_SIZE + 4;
+
+// No tx can be bigger than a block. A fee rate that can pay for that
+// many bytes, plus any flat fee and recipient values, never overflows.
+static const uint64_t MAX_TX_SIZE = 1000000;
+
+// Relays won't pass a tx with an output worth less than this; it's
+// what spending a P2PKH output costs at the minimum relay fee.
+static const uint64_t DUST_THRESHOLD = 546;
+
+// Sets sum to a + b, unless that would wrap.
+static bool AddWithoutOverflow(uint64_t a, uint64_t b, uint64_t& sum) {
+  if (a > std::numeric_limits<uint64_t>::max() - b) {
+    return false;
+  }
+  sum = a + b;
+  return true;
+}
+
+size_t Transaction::EstimateSignedSize(size_t input_count,
+                                       const tx_outs_t& outputs) {
+  size_t size = 4 + VarIntSize(input_count) +
+    input_count * P2PKH_SIGNED_INPUT_SIZE;
+  size += VarIntSize(outputs.size());
+  for (tx_outs_t::const_iterator i = outputs.begin();
+       i != outputs.end();
+       ++i) {
+    size += i->SerializedSize();
+  }
+  return size + 4;
 }
 
-bool Transaction::IdentifyUnspentTxos(const tx_outs_t& unspent_txos,
-                                      uint64_t value,
+bool Transaction::IdentifyUnspentTxos(CoinSelector* selector,
+                                      const tx_outs_t& desired_txos,
+                                      const TxOut& change_address,
                                       uint64_t fee,
+                                      uint64_t fee_rate,
                                       tx_outs_t& required_txos,
                                       uint64_t& change_value,
                                       int& error_code) {
-  uint64_t required_value = value + fee;
-  for (tx_outs_t::const_reverse_iterator i = unspent_txos.rbegin();
-       i != unspent_txos.rend();
+  if (fee_rate > std::numeric_limits<uint64_t>::max() / MAX_TX_SIZE) {
+    error_code = ERROR_INVALID_PARAM;
+    return false;
+  }
+  uint64_t value = 0;
+  for (tx_outs_t::const_iterator i = desired_txos.begin();
+       i != desired_txos.end();
        ++i) {
-    if (required_value == 0) {
-      break;
-    }
-    required_txos.push_back(*i);
-    if (required_value >= i->value()) {
-      required_value -= i->value();
-    } else {
-      change_value = i->value() - required_value;
-      required_value = 0;
+    if (!AddWithoutOverflow(value, i->value(), value)) {
+      error_code = ERROR_INVALID_PARAM;
+      return false;
     }
   }
-  if (required_value != 0) {
+  // Everything below multiplies fee_rate by a size, so keep sizes
+  // within MAX_TX_SIZE.
+  const size_t unfunded_size = EstimateSignedSize(0, desired_txos);
+  if (unfunded_size > MAX_TX_SIZE) {
+    error_code = ERROR_TRANSACTION_TOO_LARGE;
+    return false;
+  }
+  // Each input pays for its own bytes, so the selector weighs outputs
+  // by what they're worth after that. Change must be worth at least
+  // what spending it later costs, and never dust. A changeless
+  // selection may overshoot by anything short of what change would
+  // have cost: the change output now, plus the smallest change worth
+  // making.
+  const uint64_t change_fee = fee_rate * change_address.SerializedSize();
+  const uint64_t input_fee = fee_rate * P2PKH_SIGNED_INPUT_SIZE;
+  const uint64_t min_change_value = std::max(DUST_THRESHOLD, input_fee);
+  selector->set_input_cost(input_fee);
+  selector->set_cost_of_change(change_fee + min_change_value - 1);
+
+  uint64_t target;
+  if (!AddWithoutOverflow(value, fee, target) ||
+      !AddWithoutOverflow(target, fee_rate * unfunded_size, target)) {
+    error_code = ERROR_INVALID_PARAM;
+    return false;
+  }
+  uint64_t selected_change;
+  if (!selector->Select(target, required_txos, selected_change)) {
     // Not enough funds to cover transaction.
     error_code = ERROR_NOT_ENOUGH_FUNDS;
     return false;
   }
+
+  // Now that the input count is known, settle the fee exactly. (The
+  // selector's estimate can be short by the growth of the input count
+  // varint.)
+  const size_t funded_size = EstimateSignedSize(required_txos.size(),
+                                                desired_txos);
+  if (funded_size > MAX_TX_SIZE) {
+    error_code = ERROR_TRANSACTION_TOO_LARGE;
+    return false;
+  }
+  uint64_t required_value;
+  if (!AddWithoutOverflow(value, fee, required_value) ||
+      !AddWithoutOverflow(required_value, fee_rate * funded_size,
+                          required_value)) {
+    error_code = ERROR_INVALID_PARAM;
+    return false;
+  }
+  const uint64_t selected_value = AddRecipientValues(required_txos);
+  if (selected_value < required_value) {
+    error_code = ERROR_NOT_ENOUGH_FUNDS;
+    return false;
+  }
+  const uint64_t left_over = selected_value - required_value;
+  change_value = 0;
+  if (selected_change != 0 && left_over >= change_fee + min_change_value) {
+    change_value = left_over - change_fee;
+  }
   return true;
 }
 
@@ -288,8 +375,8 @@ uint64_t Transaction::AddRecipientValues(const tx_outs_t& txos) {
 bool Transaction::
 GenerateKeysForUnspentTxos(KeyProvider* key_provider,
                            const tx_outs_t& txos,
-                           std::map<bytes_t, bytes_t>& signing_keys,
-                           std::map<bytes_t, bytes_t>& signing_public_keys,
+                           std::map<Hash160, bytes_t>& signing_keys,
+                           std::map<Hash160, bytes_t>& signing_public_keys,
                            int& error_code) {
   // Create a set of addresses needed to sign the required_txos. Note
   // that an address here is the hash160, because that's the format
@@ -300,18 +387,19 @@ GenerateKeysForUnspentTxos(KeyProvider* key_provider,
        ++i) {
     signing_addresses.insert(i->GetSigningAddress());
   }
+  key_provider->PrepareKeysForAddresses(signing_addresses);
   for (std::set<bytes_t>::const_iterator i = signing_addresses.begin();
        i != signing_addresses.end();
        ++i) {
-    bytes_t public_key;
-    bytes_t key;
-    if (!key_provider->GetKeysForAddress(*i, public_key, key)) {
+    // Have the provider write straight into the map, so no stray
+    // copy of the key is left behind to be freed uncleansed.
+    const Hash160 hash160(*i);
+    if (!key_provider->GetKeysForAddress(*i, signing_public_keys[hash160],
+                                         signing_keys[hash160])) {
       // We don't have all the keys we need to spend these funds.
       error_code = ERROR_KEY_NOT_FOUND;
       return false;
     }
-    signing_public_keys[*i] = public_key;
-    signing_keys[*i] = key;
   }
   return true;
 }
@@ -319,63 +407,151 @@ GenerateKeysForUnspentTxos(KeyProvider* key_provider,
 bool Transaction::CopyUnspentTxosToTxins(const tx_outs_t& required_txos,
                                          int& error_code) {
   inputs_.clear();
+  inputs_.reserve(required_txos.size());
   for (tx_outs_t::const_iterator i = required_txos.begin();
        i != required_txos.end();
        ++i) {
     inputs_.push_back(TxIn(i->tx_hash(), i->tx_output_n(), i->script(),
                            i->GetSigningAddress()));
+    inputs_.back().set_script_type(i->script_type());
   }
   error_code = 0;
   return true;
 }
 
+namespace {
+
+// Signs one input per item. The sighash preimage for an input is the
+// tx with every input script blanked except that input's, which
+// holds the script of the output it spends. Each index builds its
+// own preimage from a shared copy of the fully blanked tx, so inputs
+// don't wait on one another. Each index writes only its own item.
+class ScriptSigTask : public ParallelTask {
+ public:
+  struct Item {
+    size_t script_size_offset;  // of the blank script's length byte
+    const bytes_t* txo_script;
+    const bytes_t* key;
+    bytes_t signature;
+    bool succeeded;
+  };
+
+  ScriptSigTask(const bytes_t& blanked_tx, std::vector<Item>& items)
+    : blanked_tx_(blanked_tx), items_(items) {}
+
+  void Run(size_t index) {
+    Item& item = items_[index];
+    const size_t offset = item.script_size_offset;
+    bytes_t preimage;
+    preimage.reserve(blanked_tx_.size() + 9 + item.txo_script->size() + 4);
+    preimage.insert(preimage.end(),
+                    blanked_tx_.begin(), blanked_tx_.begin() + offset);
+    PushBytesWithSize(preimage, *item.txo_script);
+    preimage.insert(preimage.end(),
+                    blanked_tx_.begin() + offset + 1, blanked_tx_.end());
+
+    // SIGHASH_ALL
+    PushUint32(preimage, 1);
+
+    try {
+      item.succeeded = Crypto::Sign(*item.key,
+                                    Crypto::DoubleSHA256(preimage),
+                                    item.signature);
+    } catch (const std::exception&) {
+      item.succeeded = false;
+    }
+  }
+
+ private:
+  const bytes_t& blanked_tx_;
+  std::vector<Item>& items_;
+};
+
+}  // namespace
+
 bool Transaction::
-GenerateScriptSigs(std::map<bytes_t, bytes_t>& signing_keys,
-                   std::map<bytes_t, bytes_t>& signing_public_keys,
+GenerateScriptSigs(std::map<Hash160, bytes_t>& signing_keys,
+                   std::map<Hash160, bytes_t>& signing_public_keys,
                    int& error_code) {
   // Loop through each txin and sign individually.
   // https://en.bitcoin.it/w/images/en/7/70/Bitcoin_OpCheckSig_InDetail.png
+  if (inputs_.empty()) {
+    error_code = 0;
+    return true;
+  }
 
-  // Mark all inputs so they pretend they have no script.
-  for (tx_ins_t::iterator i = inputs_.begin();
-       i != inputs_.end();
-       ++i) {
-    i->should_serialize_script(false);
+  // Find every key before changing anything, so a missing one leaves
+  // the inputs as they were.
+  std::vector<ScriptSigTask::Item> items(inputs_.size());
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    // A key can sign for P2PKH and P2PK outputs, but not for a script.
+    if (inputs_[i].script_type() != SCRIPT_TYPE_P2PKH &&
+        inputs_[i].script_type() != SCRIPT_TYPE_P2PK) {
+      error_code = ERROR_TRANSACTION_FAILED;
+      return false;
+    }
+    std::map<Hash160, bytes_t>::const_iterator key =
+      signing_keys.find(Hash160(inputs_[i].hash160()));
+    if (key == signing_keys.end()) {
+      error_code = ERROR_KEY_NOT_FOUND;
+      return false;
+    }
+    items[i].txo_script = &inputs_[i].script();
+    items[i].key = &key->second;
+    items[i].succeeded = false;
   }
 
+  // Mark all inputs so they pretend they have no script, and note
+  // where each one's (empty) script sits in the result.
   for (tx_ins_t::iterator i = inputs_.begin();
        i != inputs_.end();
        ++i) {
-
-    // Output just this one tx's script for the transaction.
-    i->should_serialize_script(true);
-
-    // Take a snapshot of what we want to sign.
-    bytes_t tx_with_one_script_sig = Serialize();
-
-    // Put the script back into hiding.
     i->should_serialize_script(false);
+  }
+  bytes_t blanked_tx;
+  blanked_tx.reserve(SerializedSize());
+  SerializeTo(blanked_tx);
+
+  size_t offset = 4 + VarIntSize(inputs_.size());
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    items[i].script_size_offset = offset + 32 + 4;
+    offset += inputs_[i].SerializedSize();
+  }
 
-    // SIGHASH_ALL
-    PushUint32(tx_with_one_script_sig, 1);
-
-    // Generate the signature.
-    const bytes_t& signing_address = i->hash160();
-    bytes_t signature;
-    Crypto::Sign(signing_keys[signing_address],
-                 Crypto::DoubleSHA256(tx_with_one_script_sig),
-                 signature);
+  // ECDSA signing dominates, so spread it over the processors.
+  ScriptSigTask task(blanked_tx, items);
+  WorkerPool pool(std::min(WorkerPool::GetProcessorCount(), items.size()));
+  pool.Run(&task, items.size());
+
+  // Check every result before touching any input, so a failure leaves
+  // the tx as it was and is always reported for the same input.
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (!items[i].succeeded) {
+      for (tx_ins_t::iterator j = inputs_.begin();
+           j != inputs_.end();
+           ++j) {
+        j->should_serialize_script(true);
+      }
+      error_code = ERROR_TRANSACTION_FAILED;
+      return false;
+    }
+  }
 
-    // Serialize the signature + public key, then insert it in place
-    // of the txo script in the txin.
+  // Serialize the signature, plus the public key for P2PKH, then
+  // insert it in place of the txo script in the txin. A P2PK output
+  // script already holds the public key.
+  for (size_t i = 0; i < items.size(); ++i) {
+    const bytes_t& signature = items[i].signature;
     bytes_t script_sig_and_key;
     PushVarInt(script_sig_and_key, signature.size() + 1);
     script_sig_and_key.insert(script_sig_and_key.end(),
                               signature.begin(), signature.end());
     script_sig_and_key.push_back(1);  // hash type ??
-    PushBytesWithSize(script_sig_and_key,
-                      signing_public_keys[signing_address]);
-    i->set_script(script_sig_and_key);
+    if (inputs_[i].script_type() == SCRIPT_TYPE_P2PKH) {
+      PushBytesWithSize(script_sig_and_key,
+                        signing_public_keys[Hash160(inputs_[i].hash160())]);
+    }
+    inputs_[i].set_script(script_sig_and_key);
   }
   error_code = 0;
   return true;
@@ -386,14 +562,58 @@ bytes_t Transaction::Sign(KeyProvider* key_provider,
                           const tx_outs_t& desired_txos,
                           const TxOut& change_address,
                           uint64_t fee,
+                          uint64_t fee_rate,
                           int& error_code) {
+  CoinSelector selector(&unspent_txos);
+  return Sign(key_provider, &selector, desired_txos, change_address,
+              fee, fee_rate, error_code);
+}
+
+namespace {
+
+// Cleanses every key in a map on the way out of scope, so the copies
+// Sign() takes from the KeyProvider don't outlive it.
+class ScopedKeyCleanser {
+ public:
+  explicit ScopedKeyCleanser(std::map<Hash160, bytes_t>& keys)
+    : keys_(keys) {}
+
+  ~ScopedKeyCleanser() {
+    for (std::map<Hash160, bytes_t>::iterator i = keys_.begin();
+         i != keys_.end();
+         ++i) {
+      if (!i->second.empty()) {
+        OPENSSL_cleanse(&i->second[0], i->second.size());
+      }
+    }
+  }
+
+ private:
+  std::map<Hash160, bytes_t>& keys_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(ScopedKeyCleanser);
+};
+
+}  // namespace
+
+bytes_t Transaction::Sign(KeyProvider* key_provider,
+                          CoinSelector* selector,
+                          const tx_outs_t& desired_txos,
+                          const TxOut& change_address,
+                          uint64_t fee,
+                          uint64_t fee_rate,
+                          int& error_code) {
+  // Everything below rewrites inputs_ and outputs_.
+  hash_is_dirty_ = true;
+
   // Determine which unspent_txos we need.
-  uint64_t required_value = AddRecipientValues(desired_txos);
   tx_outs_t required_txos;
   uint64_t change_value = 0;
-  if (!IdentifyUnspentTxos(unspent_txos,
-                           required_value,
+  if (!IdentifyUnspentTxos(selector,
+                           desired_txos,
+                           change_address,
                            fee,
+                           fee_rate,
                            required_txos,
                            change_value,
                            error_code)) {
@@ -401,15 +621,22 @@ bytes_t Transaction::Sign(KeyProvider* key_provider,
   }
 
   // Generate outputs, adding change address if needed.
+  outputs_.reserve(desired_txos.size() + 1);
   outputs_ = desired_txos;
   if (change_value != 0) {
     TxOut change_address_with_value(change_address);
     change_address_with_value.set_value(change_value);
     outputs_.push_back(change_address_with_value);
   }
+  if (max_signed_size_ != 0 &&
+      EstimateSignedSize(required_txos.size(), outputs_) > max_signed_size_) {
+    error_code = ERROR_TRANSACTION_TOO_LARGE;
+    return bytes_t();
+  }
 
-  std::map<bytes_t, bytes_t> signing_keys;
-  std::map<bytes_t, bytes_t> signing_public_keys;
+  std::map<Hash160, bytes_t> signing_keys;
+  ScopedKeyCleanser signing_keys_cleanser(signing_keys);
+  std::map<Hash160, bytes_t> signing_public_keys;
   if (!GenerateKeysForUnspentTxos(key_provider,
                                   required_txos,
                                   signing_keys,
@@ -438,10 +665,11 @@ bytes_t Transaction::Sign(KeyProvider* key_provider,
 }
 
 
-TxOut::TxOut(std::istream& is) : tx_output_n_(-1), is_spent_(false) {
-  value_ = ReadUint64(is);
-  uint64_t script_len = ReadVarInt(is);
-  ReadIntoBytes(is, script_, script_len);
+TxOut::TxOut(const TxView& view, size_t index)
+  : value_(view.outputs()[index].value),
+    script_(view.output_script(index)),
+    tx_output_n_(index), is_spent_(false) {
+  ClassifyScript();
 }
 
 TxOut::TxOut(uint64_t value, const bytes_t& recipient_hash160)
@@ -454,15 +682,47 @@ TxOut::TxOut(uint64_t value, const bytes_t& recipient_hash160)
                  recipient_hash160.end());
   script_.push_back(0x88);  // OP_EQUALVERIFY
   script_.push_back(0xac);  // OP_CHECKSIG
+  ClassifyScript();
 }
 
 TxOut::TxOut(uint64_t value, const bytes_t& script,
              uint32_t tx_output_n, const bytes_t& tx_hash)
   : value_(value), script_(script), tx_output_n_(tx_output_n),
     is_spent_(false), tx_hash_(tx_hash) {
+  ClassifyScript();
+}
+
+TxOut::TxOut(uint64_t value, const bytes_t& script,
+             uint32_t tx_output_n, const bytes_t& tx_hash,
+             ScriptType script_type, const bytes_t& signing_address)
+  : value_(value), script_(script), tx_output_n_(tx_output_n),
+    is_spent_(false), tx_hash_(tx_hash), script_type_(script_type),
+    signing_address_(signing_address) {
+}
+
+void TxOut::swap(TxOut& other) {
+  std::swap(value_, other.value_);
+  script_.swap(other.script_);
+  std::swap(tx_output_n_, other.tx_output_n_);
+  std::swap(is_spent_, other.is_spent_);
+  tx_hash_.swap(other.tx_hash_);
+  std::swap(script_type_, other.script_type_);
+  signing_address_.swap(other.signing_address_);
+}
+
+void TxOut::ClassifyScript() {
+  unsigned char key[SCRIPT_KEY_SIZE];
+  script_type_ = ClassifyScript(script_.empty() ? NULL : &script_[0],
+                                script_.size(),
+                                key);
+  if (script_type_ != SCRIPT_TYPE_UNKNOWN) {
+    signing_address_.assign(key, key + SCRIPT_KEY_SIZE);
+  }
 }
 
-bytes_t TxOut::GetSigningAddress() const {
+ScriptType TxOut::ClassifyScript(const unsigned char* script,
+                                 size_t script_size,
+                                 unsigned char* key) {
   // http://www.reddit.com/r/Bitcoin/comments/1x93tf/some_irc_chatter_about_what_is_going_on_at_mtgox/cf99yac
   //
   // "There is a design flaw in the Bitcoin protocol where it's
@@ -485,37 +745,51 @@ bytes_t TxOut::GetSigningAddress() const {
   //
   // TODO: handle this properly.
 
-  if (script_.size() == 25 &&
-      script_[0] == 0x76 && script_[1] == 0xa9 && script_[2] == 0x14 &&
-      script_[23] == 0x88 && script_[24] == 0xac) {
+  if (script_size == 25 &&
+      script[0] == 0x76 && script[1] == 0xa9 && script[2] == 0x14 &&
+      script[23] == 0x88 && script[24] == 0xac) {
     // Standard Pay-to-PubkeyHash.
     // https://en.bitcoin.it/wiki/Transactions
-    return bytes_t(script_.begin() + 3, script_.begin() + 3 + 20);
+    std::copy(script + 3, script + 3 + SCRIPT_KEY_SIZE, key);
+    return SCRIPT_TYPE_P2PKH;
   }
 
-  if (script_.size() == 23 &&
-      script_[0] == 0xa9 && script_[1] == 0x14 &&
-      script_[22] == 0x87) {
+  if (script_size == 23 &&
+      script[0] == 0xa9 && script[1] == 0x14 &&
+      script[22] == 0x87) {
     // Standard Pay-to-ScriptHash.
     // https://en.bitcoin.it/wiki/Transactions
-    return bytes_t(script_.begin() + 2, script_.begin() + 2 + 20);
+    std::copy(script + 2, script + 2 + SCRIPT_KEY_SIZE, key);
+    return SCRIPT_TYPE_P2SH;
   }
 
-  uint32_t overall_size = script_.size();
-  if (overall_size == 65 + 2 &&
-      script_[0] == 65 &&
-      script_[overall_size - 1] == 0xac) {
-    // Coinbase
-    bytes_t public_key(&script_[1], &script_[overall_size - 1]);
-    return Base58::toHash160(public_key);
+  // Pay-to-Pubkey, as in coinbases, with the public key either
+  // uncompressed (65 bytes) or compressed (33 bytes).
+  if (((script_size == 65 + 2 && script[0] == 65) ||
+       (script_size == 33 + 2 && script[0] == 33 &&
+        (script[1] == 0x02 || script[1] == 0x03))) &&
+      script[script_size - 1] == 0xac) {
+    bytes_t public_key(script + 1, script + script_size - 1);
+    bytes_t hash160(Base58::toHash160(public_key));
+    std::copy(hash160.begin(), hash160.end(), key);
+    return SCRIPT_TYPE_P2PK;
   }
 
-  return bytes_t();
+  return SCRIPT_TYPE_UNKNOWN;
 }
 
 bytes_t TxOut::Serialize() const {
   bytes_t s;
+  s.reserve(SerializedSize());
+  SerializeTo(s);
+  return s;
+}
+
+size_t TxOut::SerializedSize() const {
+  return 8 + VarIntSize(script_.size()) + script_.size();
+}
+
+void TxOut::SerializeTo(bytes_t& s) const {
   PushUint64(s, value_);
   PushBytesWithSize(s, script_);
-  return s;
 }
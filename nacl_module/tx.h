@@ -24,17 +24,33 @@
 #define __TX_H__
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
+#include "fixed_bytes.h"
 #include "types.h"
 
+class CoinSelector;
 class Transaction;
+class TxView;
+
+// The output script templates we know how to spend or watch.
+typedef enum {
+  SCRIPT_TYPE_UNKNOWN = 0,
+  SCRIPT_TYPE_P2PKH,
+  SCRIPT_TYPE_P2SH,
+  SCRIPT_TYPE_P2PK
+} ScriptType;
+
+// Every known ScriptType boils down to a 20-byte hash160: of the
+// public key for P2PKH and P2PK, and of the redeem script for P2SH.
+const size_t SCRIPT_KEY_SIZE = 20;
 
 // https://en.bitcoin.it/wiki/Transactions
 class TxIn {
  public:
-  TxIn(std::istream& is);
+  TxIn(const TxView& view, size_t index);
   TxIn(const std::string& coinbase_message);
   TxIn(const Transaction& tx, uint32_t tx_n);
   TxIn(const bytes_t& hash,
@@ -52,11 +68,18 @@ class TxIn {
   const bytes_t& hash160() const { return hash160_; }
   void set_hash160(const bytes_t& hash160) { hash160_ = hash160; }
 
+  // The type of the output this input spends, which decides the
+  // shape of its script sig.
+  ScriptType script_type() const { return script_type_; }
+  void set_script_type(ScriptType script_type) { script_type_ = script_type; }
+
   void should_serialize_script(bool should_serialize_script) {
     should_serialize_script_ = should_serialize_script;
   }
 
   bytes_t Serialize() const;
+  size_t SerializedSize() const;
+  void SerializeTo(bytes_t& s) const;
 
  private:
   bytes_t prev_txo_hash_;
@@ -66,6 +89,7 @@ class TxIn {
 
   // Begin unserialized parts
   bytes_t hash160_;  // The address that needs to sign this input
+  ScriptType script_type_;
   bool should_serialize_script_;
 };
 typedef std::vector<TxIn> tx_ins_t;
@@ -75,14 +99,28 @@ class TxOut {
   // Creating a recipient.
   TxOut(uint64_t value, const bytes_t& recipient_hash160);
   // Restoring from octets.
-  TxOut(std::istream& is);
+  TxOut(const TxView& view, size_t index);
   // Generating an unspent txo list.
   TxOut(uint64_t value, const bytes_t& script,
         uint32_t tx_output_n, const bytes_t& tx_hash);
+  // Same, for a script that's already been classified.
+  TxOut(uint64_t value, const bytes_t& script,
+        uint32_t tx_output_n, const bytes_t& tx_hash,
+        ScriptType script_type, const bytes_t& signing_address);
+
+  // Matches script against the known templates. If one fits, writes
+  // its SCRIPT_KEY_SIZE-byte key to key. Otherwise leaves key alone
+  // and returns SCRIPT_TYPE_UNKNOWN.
+  static ScriptType ClassifyScript(const unsigned char* script,
+                                   size_t script_size,
+                                   unsigned char* key);
+
+  ScriptType script_type() const { return script_type_; }
 
   // The address whose private key is needed to spend this output.
-  // Empty if we don't know how to parse the output script.
-  bytes_t GetSigningAddress() const;
+  // Empty if we don't know how to parse the output script. Worked out
+  // once when the TxOut is made.
+  const bytes_t& GetSigningAddress() const { return signing_address_; }
 
   uint64_t value() const { return value_; }
   void set_value(uint64_t new_value) { value_ = new_value; }
@@ -92,13 +130,21 @@ class TxOut {
   void set_tx_output_n(uint32_t n) { tx_output_n_ = n; }
 
   bytes_t Serialize() const;
+  size_t SerializedSize() const;
+  void SerializeTo(bytes_t& s) const;
 
   void MarkSpent() { is_spent_ = true; }
   bool is_spent() const { return is_spent_; }
 
   const bytes_t& tx_hash() const { return tx_hash_; }
 
+  // Exchanges contents without copying any of the byte vectors, for
+  // shuffling TxOuts around inside a tx_outs_t.
+  void swap(TxOut& other);
+
  private:
+  void ClassifyScript();
+
   uint64_t value_;
   bytes_t script_;
   uint32_t tx_output_n_;
@@ -106,11 +152,21 @@ class TxOut {
 
   // set only for unspent_txos
   bytes_t tx_hash_;
+
+  ScriptType script_type_;
+  bytes_t signing_address_;
 };
 typedef std::vector<TxOut> tx_outs_t;
 
 class KeyProvider {
  public:
+  virtual ~KeyProvider() {}
+
+  // Called once with every address a transaction is about to ask
+  // GetKeysForAddress() for, so a provider can get them in bulk.
+  virtual void PrepareKeysForAddresses(const std::set<bytes_t>&
+                                       /*hash160s*/) {}
+
   virtual bool GetKeysForAddress(const bytes_t& hash160,
                                  bytes_t& public_key,
                                  bytes_t& key) = 0;
@@ -119,22 +175,61 @@ class KeyProvider {
 class Transaction {
  public:
   Transaction();
-  Transaction(std::istream& is);
+  // Copies everything out of the view, which must have parsed
+  // successfully.
+  explicit Transaction(const TxView& view);
 
   bytes_t Serialize() const;
 
+  // The exact length of Serialize()'s result, without building it.
+  size_t SerializedSize() const;
+
+  // Appends the serialized tx to s. Call s.reserve(SerializedSize())
+  // first to write it without reallocating.
+  void SerializeTo(bytes_t& s) const;
+
+  // Picks inputs from unspent_txos to pay desired_txos, adds change
+  // if there's enough left over, and signs. The fee is the flat fee
+  // plus fee_rate satoshis per byte of the signed tx, as predicted by
+  // EstimateSignedSize().
   bytes_t Sign(KeyProvider* key_provider,
                const tx_outs_t& unspent_txos,
                const tx_outs_t& desired_txos,
                const TxOut& change_address,
                uint64_t fee,
+               uint64_t fee_rate,
+               int& error_code);
+  // Same, but picks inputs with a caller's selector, which can then
+  // be told what was spent and reused for the next tx.
+  bytes_t Sign(KeyProvider* key_provider,
+               CoinSelector* selector,
+               const tx_outs_t& desired_txos,
+               const TxOut& change_address,
+               uint64_t fee,
+               uint64_t fee_rate,
                int& error_code);
 
+  // If nonzero, Sign() fails with ERROR_TRANSACTION_TOO_LARGE, before
+  // asking for any keys, when the signed tx could be bigger than this.
+  void set_max_signed_size(size_t max_signed_size) {
+    max_signed_size_ = max_signed_size;
+  }
+
+  // The largest a tx spending input_count P2PKH outputs to outputs
+  // can be once signed. Only the signatures vary: a DER signature is
+  // at most 72 bytes but can come out a byte or two shorter. Spending
+  // a P2PK output instead saves the 34-byte public key push, so this
+  // is an upper bound for those too.
+  static size_t EstimateSignedSize(size_t input_count,
+                                   const tx_outs_t& outputs);
+
   uint32_t version() const { return version_; }
   const tx_ins_t& inputs() const { return inputs_; }
   const tx_outs_t& outputs() const { return outputs_; }
   uint32_t lock_time() const { return lock_time_; }
-  const bytes_t& hash() const { return hash_; }
+  // Computed on first use after the tx changes, so building up a
+  // large tx with Add() doesn't rehash it every time.
+  const bytes_t& hash() const;
 
   void MarkOutputSpent(uint32_t index) { outputs_[index].MarkSpent(); }
 
@@ -142,31 +237,34 @@ class Transaction {
   void Add(const TxOut& tx_out);
 
  private:
-  void UpdateHash();
   uint64_t AddRecipientValues(const tx_outs_t& txos);
-  bool IdentifyUnspentTxos(const tx_outs_t& unspent_txos,
-                           uint64_t value,
+  bool IdentifyUnspentTxos(CoinSelector* selector,
+                           const tx_outs_t& desired_txos,
+                           const TxOut& change_address,
                            uint64_t fee,
+                           uint64_t fee_rate,
                            tx_outs_t& required_txos,
                            uint64_t& change_value,
                            int& error_code);
   bool GenerateKeysForUnspentTxos(KeyProvider* key_provider,
                                   const tx_outs_t& txos,
-                                  std::map<bytes_t, bytes_t>& signing_keys,
-                                  std::map<bytes_t, bytes_t>&
+                                  std::map<Hash160, bytes_t>& signing_keys,
+                                  std::map<Hash160, bytes_t>&
                                   signing_public_keys,
                                   int& error_code);
   bool CopyUnspentTxosToTxins(const tx_outs_t& required_txos,
                               int& error_code);
-  bool GenerateScriptSigs(std::map<bytes_t, bytes_t>& signing_keys,
-                          std::map<bytes_t, bytes_t>& signing_public_keys,
+  bool GenerateScriptSigs(std::map<Hash160, bytes_t>& signing_keys,
+                          std::map<Hash160, bytes_t>& signing_public_keys,
                           int& error_code);
 
   uint32_t version_;
   tx_ins_t inputs_;
   tx_outs_t outputs_;
   uint32_t lock_time_;
-  bytes_t hash_;
+  mutable bytes_t hash_;
+  mutable bool hash_is_dirty_;
+  size_t max_signed_size_;
 
   DISALLOW_EVIL_CONSTRUCTORS(Transaction);
 };
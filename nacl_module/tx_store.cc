@@ -0,0 +1,178 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "tx_store.h"
+
+#include <algorithm>
+
+#include "crypto.h"
+#include "tx_view.h"
+
+static const size_t HASH_SIZE = 32;
+
+TxStore::TxStore() {
+}
+
+bool TxStore::Add(const bytes_t& raw, uint32_t& tx) {
+  TxView view;
+  if (!view.Parse(raw)) {
+    return false;
+  }
+  const bytes_t serialized_hash(Crypto::DoubleSHA256(raw));
+  if (FindSerializedHash(&serialized_hash[0], tx)) {
+    return true;
+  }
+
+  // Offsets are 32 bits. That's 4GB of transactions, far beyond what
+  // we'd ever hold in memory anyway.
+  if (raw.size() > 0xffffffff - slab_.size()) {
+    return false;
+  }
+  tx = tx_records_.size();
+  Append(view, serialized_hash);
+  return true;
+}
+
+void TxStore::Append(const TxView& view, const bytes_t& serialized_hash) {
+  const uint32_t raw_offset = slab_.size();
+  slab_.insert(slab_.end(), view.data(), view.data() + view.size());
+
+  TxRecord record;
+  record.raw_offset = raw_offset;
+  record.raw_size = view.size();
+  record.inputs_begin = input_outpoints_.size();
+  record.outputs_begin = output_values_.size();
+  const uint32_t tx = tx_records_.size();
+  tx_records_.push_back(record);
+  tx_hashes_.insert(tx_hashes_.end(),
+                    serialized_hash.begin(), serialized_hash.end());
+  tx_index_[Hash256(&serialized_hash[0])] = tx;
+
+  for (size_t i = 0; i < view.inputs().size(); ++i) {
+    input_outpoints_.push_back(raw_offset +
+                               view.inputs()[i].prev_txo_hash_offset);
+  }
+  for (size_t i = 0; i < view.outputs().size(); ++i) {
+    const TxView::Output& output = view.outputs()[i];
+    output_values_.push_back(output.value);
+    output_script_offsets_.push_back(raw_offset + output.script_offset);
+    output_script_sizes_.push_back(output.script_size);
+    output_txs_.push_back(tx);
+    output_spent_.push_back(false);
+
+    unsigned char key[SCRIPT_KEY_SIZE] = { 0 };
+    const unsigned char* script =
+      output.script_size ? view.data() + output.script_offset : NULL;
+    output_script_types_.push_back(TxOut::ClassifyScript(script,
+                                                         output.script_size,
+                                                         key));
+    output_keys_.insert(output_keys_.end(), key, key + SCRIPT_KEY_SIZE);
+  }
+}
+
+bool TxStore::Find(const bytes_t& hash, uint32_t& tx) const {
+  if (hash.size() != HASH_SIZE) {
+    return false;
+  }
+  unsigned char serialized_hash[HASH_SIZE];
+  std::reverse_copy(hash.begin(), hash.end(), serialized_hash);
+  return FindSerializedHash(serialized_hash, tx);
+}
+
+bool TxStore::FindSerializedHash(const unsigned char* hash,
+                                 uint32_t& tx) const {
+  const uint32_t* found = tx_index_.Find(Hash256(hash));
+  if (!found) {
+    return false;
+  }
+  tx = *found;
+  return true;
+}
+
+bytes_t TxStore::hash(uint32_t tx) const {
+  const unsigned char* p = &tx_hashes_[tx * HASH_SIZE];
+  bytes_t hash(HASH_SIZE);
+  std::reverse_copy(p, p + HASH_SIZE, hash.begin());
+  return hash;
+}
+
+bytes_t TxStore::raw(uint32_t tx) const {
+  const unsigned char* p = &slab_[tx_records_[tx].raw_offset];
+  return bytes_t(p, p + tx_records_[tx].raw_size);
+}
+
+uint32_t TxStore::inputs_begin(uint32_t tx) const {
+  return tx_records_[tx].inputs_begin;
+}
+
+uint32_t TxStore::inputs_end(uint32_t tx) const {
+  if (tx + 1 < tx_records_.size()) {
+    return tx_records_[tx + 1].inputs_begin;
+  }
+  return input_outpoints_.size();
+}
+
+uint32_t TxStore::outputs_begin(uint32_t tx) const {
+  return tx_records_[tx].outputs_begin;
+}
+
+uint32_t TxStore::outputs_end(uint32_t tx) const {
+  if (tx + 1 < tx_records_.size()) {
+    return tx_records_[tx + 1].outputs_begin;
+  }
+  return output_values_.size();
+}
+
+bool TxStore::FindSpentOutput(uint32_t input, uint32_t& output) const {
+  const unsigned char* outpoint = &slab_[input_outpoints_[input]];
+  uint32_t tx;
+  if (!FindSerializedHash(outpoint, tx)) {
+    return false;
+  }
+  const unsigned char* p = outpoint + HASH_SIZE;
+  const uint32_t index = (uint32_t)p[0] |
+    ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) |
+    ((uint32_t)p[3] << 24);
+  if (index >= outputs_end(tx) - outputs_begin(tx)) {
+    return false;
+  }
+  output = outputs_begin(tx) + index;
+  return true;
+}
+
+uint32_t TxStore::output_n(uint32_t output) const {
+  return output - outputs_begin(output_txs_[output]);
+}
+
+bytes_t TxStore::output_script(uint32_t output) const {
+  const unsigned char* p = &slab_[output_script_offsets_[output]];
+  return bytes_t(p, p + output_script_sizes_[output]);
+}
+
+bytes_t TxStore::output_signing_address(uint32_t output) const {
+  if (output_script_types_[output] == SCRIPT_TYPE_UNKNOWN) {
+    return bytes_t();
+  }
+  const unsigned char* key = &output_keys_[output * SCRIPT_KEY_SIZE];
+  return bytes_t(key, key + SCRIPT_KEY_SIZE);
+}
@@ -0,0 +1,126 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__TX_STORE_H__)
+#define __TX_STORE_H__
+
+#include <vector>
+
+#include "fixed_bytes.h"
+#include "flat_hash_map.h"
+#include "tx.h"
+#include "types.h"
+
+class TxView;
+
+// A compact, append-only home for many transactions. Instead of a
+// Transaction object per tx, with its vectors of TxIns and TxOuts
+// and their bytes_t members, the raw bytes of every tx go into one
+// slab and everything else is a column of fixed-size values indexing
+// into it. Adding a tx costs a handful of amortized appends.
+//
+// Transactions, inputs and outputs are all named by dense uint32_t
+// indexes. The inputs of tx t are [inputs_begin(t), inputs_end(t)),
+// and likewise for outputs. Hashes going in and out are in the usual
+// reversed display order.
+class TxStore {
+ public:
+  TxStore();
+
+  // Parses and stores a raw transaction, setting tx to its index.
+  // Adding a tx that's already present is harmless and returns the
+  // existing index. Returns false if the bytes don't parse.
+  bool Add(const bytes_t& raw, uint32_t& tx);
+
+  bool Find(const bytes_t& hash, uint32_t& tx) const;
+
+  uint32_t tx_count() const { return tx_records_.size(); }
+  uint32_t input_count() const { return input_outpoints_.size(); }
+  uint32_t output_count() const { return output_values_.size(); }
+
+  // Transactions
+  bytes_t hash(uint32_t tx) const;
+  bytes_t raw(uint32_t tx) const;
+  uint32_t inputs_begin(uint32_t tx) const;
+  uint32_t inputs_end(uint32_t tx) const;
+  uint32_t outputs_begin(uint32_t tx) const;
+  uint32_t outputs_end(uint32_t tx) const;
+
+  // Inputs. Sets output to the stored output this input spends,
+  // returning false if we don't have the tx it comes from.
+  bool FindSpentOutput(uint32_t input, uint32_t& output) const;
+
+  // Outputs
+  uint32_t output_tx(uint32_t output) const { return output_txs_[output]; }
+  uint32_t output_n(uint32_t output) const;
+  uint64_t output_value(uint32_t output) const {
+    return output_values_[output];
+  }
+  bytes_t output_script(uint32_t output) const;
+  ScriptType output_script_type(uint32_t output) const {
+    return static_cast<ScriptType>(output_script_types_[output]);
+  }
+  // Classified when the tx was added. Empty for unknown scripts.
+  bytes_t output_signing_address(uint32_t output) const;
+  // Same, without the allocation. All zeroes for unknown scripts.
+  Hash160 output_key(uint32_t output) const {
+    return Hash160(&output_keys_[output * SCRIPT_KEY_SIZE]);
+  }
+  bool is_spent(uint32_t output) const { return output_spent_[output]; }
+  void MarkSpent(uint32_t output) { output_spent_[output] = true; }
+
+ private:
+  struct TxRecord {
+    uint32_t raw_offset;
+    uint32_t raw_size;
+    uint32_t inputs_begin;
+    uint32_t outputs_begin;
+  };
+
+  bool FindSerializedHash(const unsigned char* hash, uint32_t& tx) const;
+  void Append(const TxView& view, const bytes_t& serialized_hash);
+
+  // All the raw transactions, back to back.
+  bytes_t slab_;
+
+  std::vector<TxRecord> tx_records_;
+  bytes_t tx_hashes_;  // 32 bytes per tx, serialized byte order
+
+  // The slab offset of each input's 36-byte outpoint (previous tx
+  // hash and output index).
+  std::vector<uint32_t> input_outpoints_;
+
+  std::vector<uint64_t> output_values_;
+  std::vector<uint32_t> output_script_offsets_;
+  std::vector<uint32_t> output_script_sizes_;
+  std::vector<uint32_t> output_txs_;
+  std::vector<bool> output_spent_;
+  std::vector<unsigned char> output_script_types_;
+  bytes_t output_keys_;  // SCRIPT_KEY_SIZE bytes per output
+
+  // Serialized-order hash to tx index.
+  FlatHashMap<Hash256, uint32_t> tx_index_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TxStore);
+};
+
+#endif  // #if !defined(__TX_STORE_H__)
@@ -26,12 +26,17 @@
 #include <string>
 
 #include "gtest/gtest.h"
+#include "openssl/ec.h"
+#include "openssl/ecdsa.h"
+#include "openssl/obj_mac.h"
 
 #include "base58.h"
+#include "crypto.h"
 #include "errors.h"
 #include "node.h"
 #include "node_factory.h"
 #include "tx.h"
+#include "tx_view.h"
 #include "types.h"
 
 #include "test_transactions.hex"
@@ -108,6 +113,7 @@ TEST(TxTest, BasicTransaction) {
                                        recipient_txos,
                                        change_txo,
                                        255,
+                                       0,
                                        error_code);
   EXPECT_EQ(ERROR_NONE, error_code);
 
@@ -115,13 +121,269 @@ TEST(TxTest, BasicTransaction) {
   // std::cerr << to_hex(signed_tx) << std::endl;
 }
 
+// Holds the key for 1BvgsfsZQVtkLS69NvGF8rw6NZW2ShJQHr, m/0'/0/0 of
+// BIP 0032 Test Vector 1.
+class SingleKeyProvider : public KeyProvider {
+ public:
+  static bytes_t hash160() {
+    return unhexlify("77d896b0f85f72ae0f3d0487c432b23c28b71493");
+  }
+
+  static bytes_t public_key() {
+    return unhexlify("027B6A7DD645507D775215A9035BE06700E1ED8C54"
+                     "1DA9351B4BD14BD50AB61428");
+  }
+
+  virtual bool GetKeysForAddress(const bytes_t& hash160,
+                                 bytes_t& public_key,
+                                 bytes_t& key) {
+    if (hash160 != SingleKeyProvider::hash160()) {
+      return false;
+    }
+    public_key = SingleKeyProvider::public_key();
+    key = unhexlify("BF847390268D072B420406809EC0C9097779E38754E071FB"
+                    "51942FF30DD32F8C");
+    return true;
+  }
+};
+
+TEST(TxTest, FeeRate) {
+  const uint64_t FEE_RATE = 10;
+  const bytes_t RECIPIENT(unhexlify("6b468a091d50dfb7557200c46d0c1999d060a637"));
+  const bytes_t CHANGE(unhexlify("6dc73af1c96ff68e9dbdecd7453bad59bf0c83a4"));
+
+  // Three deposits of 0.1 BTC to the key we hold.
+  tx_outs_t unspent_txos;
+  for (uint32_t i = 0; i < 3; ++i) {
+    TxOut deposit(SATOSHIS_IN_BTC / 10, SingleKeyProvider::hash160());
+    unspent_txos.push_back(TxOut(deposit.value(), deposit.script(), i,
+                                 unhexlify("47b95fdeff3a20cb72d3ad499f0c34b2"
+                                           "bdec16de51a3fcf95e5db57e9d61fb18")));
+  }
+  tx_outs_t recipient_txos;
+  recipient_txos.push_back(TxOut(SATOSHIS_IN_BTC / 4, RECIPIENT));
+
+  SingleKeyProvider key_provider;
+  Transaction transaction;
+  int error_code = ERROR_NONE;
+  const bytes_t signed_tx = transaction.Sign(&key_provider,
+                                             unspent_txos,
+                                             recipient_txos,
+                                             TxOut(0, CHANGE),
+                                             0,
+                                             FEE_RATE,
+                                             error_code);
+  ASSERT_EQ(ERROR_NONE, error_code);
+
+  TxView view;
+  ASSERT_TRUE(view.Parse(signed_tx));
+  ASSERT_EQ(3, view.inputs().size());
+  ASSERT_EQ(2, view.outputs().size());
+
+  // The estimate is exact but for signatures that came out shorter
+  // than the 72-byte maximum.
+  size_t short_by = 0;
+  for (size_t i = 0; i < view.inputs().size(); ++i) {
+    short_by += 1 + 72 + 1 + 1 + 33 - view.inputs()[i].script_size;
+  }
+  EXPECT_GE(3 * 2, short_by);
+  const size_t estimate = Transaction::EstimateSignedSize(3,
+                                                          transaction.outputs());
+  EXPECT_EQ(signed_tx.size() + short_by, estimate);
+
+  // And the fee pays for exactly that many bytes.
+  const uint64_t fee = 3 * SATOSHIS_IN_BTC / 10 -
+    view.outputs()[0].value - view.outputs()[1].value;
+  EXPECT_EQ(FEE_RATE * estimate, fee);
+
+  // Change that isn't worth its own output goes to the miner.
+  recipient_txos[0].set_value(3 * SATOSHIS_IN_BTC / 10 -
+                              FEE_RATE * estimate);
+  ASSERT_TRUE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                               TxOut(0, CHANGE), 0, FEE_RATE,
+                               error_code).size() > 0);
+  EXPECT_EQ(1, transaction.outputs().size());
+
+  // Nor is change worth less than spending it would cost...
+  const uint64_t SPEND_FEE = FEE_RATE * (32 + 4 + 1 + 1 + 72 + 1 + 1 + 33 + 4);
+  recipient_txos[0].set_value(3 * SATOSHIS_IN_BTC / 10 -
+                              FEE_RATE * estimate - SPEND_FEE + 1);
+  ASSERT_TRUE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                               TxOut(0, CHANGE), 0, FEE_RATE,
+                               error_code).size() > 0);
+  EXPECT_EQ(1, transaction.outputs().size());
+  recipient_txos[0].set_value(3 * SATOSHIS_IN_BTC / 10 -
+                              FEE_RATE * estimate - SPEND_FEE);
+  ASSERT_TRUE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                               TxOut(0, CHANGE), 0, FEE_RATE,
+                               error_code).size() > 0);
+  ASSERT_EQ(2, transaction.outputs().size());
+  EXPECT_EQ(SPEND_FEE, transaction.outputs()[1].value());
+
+  // ...or dust, even when the fee rate is zero.
+  recipient_txos[0].set_value(3 * SATOSHIS_IN_BTC / 10 - 545);
+  ASSERT_TRUE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                               TxOut(0, CHANGE), 0, 0,
+                               error_code).size() > 0);
+  EXPECT_EQ(1, transaction.outputs().size());
+  recipient_txos[0].set_value(3 * SATOSHIS_IN_BTC / 10 - 546);
+  ASSERT_TRUE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                               TxOut(0, CHANGE), 0, 0,
+                               error_code).size() > 0);
+  ASSERT_EQ(2, transaction.outputs().size());
+  EXPECT_EQ(546, transaction.outputs()[1].value());
+
+  // Not enough to pay the fee.
+  recipient_txos[0].set_value(3 * SATOSHIS_IN_BTC / 10 -
+                              FEE_RATE * (estimate - 34) + 1);
+  EXPECT_TRUE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                               TxOut(0, CHANGE), 0, FEE_RATE,
+                               error_code).empty());
+  EXPECT_EQ(ERROR_NOT_ENOUGH_FUNDS, error_code);
+
+  // A rate or values so big the fee would wrap around are refused,
+  // not paid at whatever they wrapped to.
+  recipient_txos[0].set_value(SATOSHIS_IN_BTC / 4);
+  EXPECT_TRUE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                               TxOut(0, CHANGE), 0, 0x4000000000000000ULL,
+                               error_code).empty());
+  EXPECT_EQ(ERROR_INVALID_PARAM, error_code);
+  EXPECT_TRUE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                               TxOut(0, CHANGE), 0xffffffffffffff00ULL,
+                               FEE_RATE, error_code).empty());
+  EXPECT_EQ(ERROR_INVALID_PARAM, error_code);
+  recipient_txos.push_back(TxOut(0xffffffffffffff00ULL, RECIPIENT));
+  EXPECT_TRUE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                               TxOut(0, CHANGE), 0, FEE_RATE,
+                               error_code).empty());
+  EXPECT_EQ(ERROR_INVALID_PARAM, error_code);
+}
+
+// Checks input's script sig against the legacy SIGHASH_ALL digest of
+// tx.
+static bool VerifyScriptSig(const Transaction& tx, size_t input,
+                            const bytes_t& txo_script) {
+  Transaction preimage_tx;
+  for (size_t i = 0; i < tx.inputs().size(); ++i) {
+    const TxIn& txin = tx.inputs()[i];
+    preimage_tx.Add(TxIn(txin.prev_txo_hash(), txin.prev_txo_index(),
+                         i == input ? txo_script : bytes_t(), bytes_t()));
+  }
+  for (size_t i = 0; i < tx.outputs().size(); ++i) {
+    preimage_tx.Add(tx.outputs()[i]);
+  }
+  bytes_t preimage = preimage_tx.Serialize();
+  const unsigned char SIGHASH_ALL[] = { 1, 0, 0, 0 };
+  preimage.insert(preimage.end(), SIGHASH_ALL, SIGHASH_ALL + 4);
+  const bytes_t digest = Crypto::DoubleSHA256(preimage);
+
+  // <sig + hash type> <public key> for P2PKH. For P2PK it's just the
+  // signature, and the key comes from the output script.
+  const bytes_t& script = tx.inputs()[input].script();
+  const size_t signature_size = script[0] - 1;
+  bytes_t public_key(script.begin() + 1 + script[0], script.end());
+  if (public_key.empty()) {
+    public_key.assign(txo_script.begin() + 1, txo_script.end() - 1);
+  } else {
+    public_key.erase(public_key.begin());
+  }
+  EC_KEY* key = EC_KEY_new_by_curve_name(NID_secp256k1);
+  const unsigned char* p = &public_key[0];
+  bool is_valid = false;
+  if (o2i_ECPublicKey(&key, &p, public_key.size())) {
+    is_valid = ECDSA_verify(0, &digest[0], digest.size(),
+                            &script[1], signature_size, key) == 1;
+  }
+  EC_KEY_free(key);
+  return is_valid;
+}
+
+TEST(TxTest, ManyInputs) {
+  const bytes_t RECIPIENT(unhexlify("6b468a091d50dfb7557200c46d0c1999d060a637"));
+  const uint32_t INPUT_COUNT = 40;
+
+  tx_outs_t unspent_txos;
+  TxOut deposit(1000, SingleKeyProvider::hash160());
+  for (uint32_t i = 0; i < INPUT_COUNT; ++i) {
+    unspent_txos.push_back(TxOut(deposit.value(), deposit.script(), i,
+                                 unhexlify("47b95fdeff3a20cb72d3ad499f0c34b2"
+                                           "bdec16de51a3fcf95e5db57e9d61fb18")));
+  }
+  tx_outs_t recipient_txos;
+  recipient_txos.push_back(TxOut(INPUT_COUNT * 1000, RECIPIENT));
+
+  SingleKeyProvider key_provider;
+  Transaction transaction;
+  int error_code = ERROR_NONE;
+  ASSERT_FALSE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                                TxOut(0, RECIPIENT), 0, 0,
+                                error_code).empty());
+  ASSERT_EQ(INPUT_COUNT, transaction.inputs().size());
+
+  // Every input carries a good signature of its own digest, no matter
+  // which thread made it.
+  for (size_t i = 0; i < transaction.inputs().size(); ++i) {
+    EXPECT_TRUE(VerifyScriptSig(transaction, i, deposit.script()));
+  }
+}
+
+TEST(TxTest, SpendP2PK) {
+  const bytes_t RECIPIENT(unhexlify("6b468a091d50dfb7557200c46d0c1999d060a637"));
+  const bytes_t TX_HASH(unhexlify("47b95fdeff3a20cb72d3ad499f0c34b2"
+                                  "bdec16de51a3fcf95e5db57e9d61fb18"));
+  const bytes_t PUBLIC_KEY(SingleKeyProvider::public_key());
+  const bytes_t HASH160(SingleKeyProvider::hash160());
+
+  // One P2PKH and one P2PK deposit to the key we hold.
+  bytes_t p2pk_script(1, PUBLIC_KEY.size());
+  p2pk_script.insert(p2pk_script.end(), PUBLIC_KEY.begin(), PUBLIC_KEY.end());
+  p2pk_script.push_back(0xac);  // OP_CHECKSIG
+  const TxOut p2pkh_deposit(1000, HASH160);
+  tx_outs_t unspent_txos;
+  unspent_txos.push_back(TxOut(1000, p2pkh_deposit.script(), 0, TX_HASH));
+  unspent_txos.push_back(TxOut(1000, p2pk_script, 1, TX_HASH));
+  ASSERT_EQ(SCRIPT_TYPE_P2PK, unspent_txos[1].script_type());
+  tx_outs_t recipient_txos;
+  recipient_txos.push_back(TxOut(2000, RECIPIENT));
+
+  SingleKeyProvider key_provider;
+  Transaction transaction;
+  int error_code = ERROR_NONE;
+  ASSERT_FALSE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                                TxOut(0, RECIPIENT), 0, 0,
+                                error_code).empty());
+  ASSERT_EQ(2, transaction.inputs().size());
+
+  // The P2PK input's script sig is the signature alone; the P2PKH one
+  // still carries the public key.
+  for (size_t i = 0; i < transaction.inputs().size(); ++i) {
+    const TxIn& txin = transaction.inputs()[i];
+    const bytes_t& txo_script =
+      txin.prev_txo_index() == 1 ? p2pk_script : p2pkh_deposit.script();
+    EXPECT_TRUE(VerifyScriptSig(transaction, i, txo_script));
+    EXPECT_EQ(txin.prev_txo_index() == 1,
+              txin.script().size() == 1u + txin.script()[0]);
+  }
+
+  // A P2SH output that hashes to our address can't be spent with the
+  // key alone.
+  bytes_t p2sh_script(unhexlify("a914"));
+  p2sh_script.insert(p2sh_script.end(), HASH160.begin(), HASH160.end());
+  p2sh_script.push_back(0x87);
+  unspent_txos[1] = TxOut(1000, p2sh_script, 1, TX_HASH);
+  EXPECT_TRUE(transaction.Sign(&key_provider, unspent_txos, recipient_txos,
+                               TxOut(0, RECIPIENT), 0, 0,
+                               error_code).empty());
+  EXPECT_EQ(ERROR_TRANSACTION_FAILED, error_code);
+}
+
 TEST(TxTest, ParseRawTransaction) {
-  std::istringstream is;
-  const char* p = reinterpret_cast<const char*>(&TX_1[0]);
-  is.rdbuf()->pubsetbuf(const_cast<char*>(p),
-                        TX_1.size());
+  TxView view;
+  ASSERT_TRUE(view.Parse(TX_1));
+  EXPECT_EQ(230, view.inputs().size());
+  EXPECT_EQ(1, view.outputs().size());
 
-  Transaction tx(is);
+  Transaction tx(view);
   EXPECT_EQ(1, tx.version());
   EXPECT_EQ(230, tx.inputs().size());
   EXPECT_EQ(1, tx.outputs().size());
@@ -130,6 +392,122 @@ TEST(TxTest, ParseRawTransaction) {
   // And for style points, serialize it again.
   const bytes_t tx_serialized = tx.Serialize();
   ASSERT_EQ(TX_1, tx_serialized);
+  EXPECT_EQ(view.hash(), tx.hash());
+}
+
+TEST(TxTest, ParseMalformedTransaction) {
+  TxView view;
+
+  // Every truncation of a good transaction is rejected.
+  for (size_t i = 0; i < TX_1.size(); i += 37) {
+    EXPECT_FALSE(view.Parse(&TX_1[0], i));
+  }
+  EXPECT_TRUE(view.inputs().empty());
+
+  // So is trailing garbage.
+  bytes_t padded(TX_1);
+  padded.push_back(0);
+  EXPECT_FALSE(view.Parse(padded));
+
+  // A script length that points far past the end of the buffer.
+  bytes_t bad_script(TX_1);
+  bad_script[4 + 1 + 32 + 4] = 0xfe;
+  EXPECT_FALSE(view.Parse(bad_script));
+
+  // An input count that couldn't possibly fit.
+  const unsigned char huge_count[] = {
+    0x01, 0x00, 0x00, 0x00,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  };
+  EXPECT_FALSE(view.Parse(huge_count, sizeof(huge_count)));
+
+  // Unsupported version.
+  bytes_t version_2(TX_1);
+  version_2[0] = 2;
+  EXPECT_FALSE(view.Parse(version_2));
+
+  EXPECT_TRUE(view.Parse(TX_1));
+}
+
+TEST(TxTest, LargeTransaction) {
+  const bytes_t ADDR(unhexlify("62e907b15cbf27d5425399ebf6f0fb50ebb88f18"));
+
+  // Enough inputs and outputs that the counts need 0xfd prefixes, and
+  // a coinbase script long enough that its length does too.
+  Transaction tx;
+  tx.Add(TxIn(std::string(300, 'x')));
+  for (int i = 1; i < 400; ++i) {
+    tx.Add(TxIn(std::string(1, 'x')));
+  }
+  for (int i = 0; i < 300; ++i) {
+    tx.Add(TxOut(i + 1, ADDR));
+  }
+
+  const bytes_t serialized = tx.Serialize();
+  EXPECT_EQ(serialized.size(), tx.SerializedSize());
+
+  TxView view;
+  ASSERT_TRUE(view.Parse(serialized));
+  EXPECT_EQ(400, view.inputs().size());
+  EXPECT_EQ(300, view.outputs().size());
+  EXPECT_EQ(300, view.inputs()[0].script_size);
+  EXPECT_EQ(300, view.outputs()[299].value);
+  EXPECT_EQ(view.hash(), tx.hash());
+
+  // The hash keeps up with later changes.
+  tx.Add(TxOut(1, ADDR));
+  const bytes_t reserialized = tx.Serialize();
+  ASSERT_TRUE(view.Parse(reserialized));
+  EXPECT_EQ(view.hash(), tx.hash());
+}
+
+TEST(TxTest, ClassifyScript) {
+  // 1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa, the genesis coinbase address.
+  const bytes_t HASH160(unhexlify("62e907b15cbf27d5425399ebf6f0fb50ebb88f18"));
+  const bytes_t PUBLIC_KEY(unhexlify("0339a36013301597daef41fbe593a02cc513d0b5"
+                                     "5527ec2df1050e2e8ff49c85c2"));
+  bytes_t script;
+
+  // P2PKH
+  TxOut p2pkh(1, HASH160);
+  EXPECT_EQ(SCRIPT_TYPE_P2PKH, p2pkh.script_type());
+  EXPECT_EQ(HASH160, p2pkh.GetSigningAddress());
+
+  // P2SH
+  script = unhexlify("a914");
+  script.insert(script.end(), HASH160.begin(), HASH160.end());
+  script.push_back(0x87);
+  TxOut p2sh(1, script, 0, bytes_t());
+  EXPECT_EQ(SCRIPT_TYPE_P2SH, p2sh.script_type());
+  EXPECT_EQ(HASH160, p2sh.GetSigningAddress());
+
+  // Compressed P2PK
+  script.assign(1, PUBLIC_KEY.size());
+  script.insert(script.end(), PUBLIC_KEY.begin(), PUBLIC_KEY.end());
+  script.push_back(0xac);
+  TxOut p2pk(1, script, 0, bytes_t());
+  EXPECT_EQ(SCRIPT_TYPE_P2PK, p2pk.script_type());
+  EXPECT_EQ(Crypto::SHA256ThenRIPE(PUBLIC_KEY), p2pk.GetSigningAddress());
+
+  // Uncompressed P2PK, from the genesis coinbase.
+  const bytes_t UNCOMPRESSED_KEY(unhexlify("04678afdb0fe5548271967f1a67130b7"
+                                           "105cd6a828e03909a67962e0ea1f61de"
+                                           "b649f6bc3f4cef38c4f35504e51ec112"
+                                           "de5c384df7ba0b8d578a4c702b6bf11d"
+                                           "5f"));
+  script.assign(1, UNCOMPRESSED_KEY.size());
+  script.insert(script.end(),
+                UNCOMPRESSED_KEY.begin(), UNCOMPRESSED_KEY.end());
+  script.push_back(0xac);
+  TxOut genesis(1, script, 0, bytes_t());
+  EXPECT_EQ(SCRIPT_TYPE_P2PK, genesis.script_type());
+  EXPECT_EQ(HASH160, genesis.GetSigningAddress());
+
+  // Anything else.
+  script.pop_back();
+  TxOut unknown(1, script, 0, bytes_t());
+  EXPECT_EQ(SCRIPT_TYPE_UNKNOWN, unknown.script_type());
+  EXPECT_TRUE(unknown.GetSigningAddress().empty());
 }
 
 TEST(TxTest, CoinbaseToFritterAway) {
@@ -0,0 +1,179 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "tx_view.h"
+
+#include <iostream>  // cerr
+
+#include <algorithm>
+
+#include "crypto.h"
+
+uint32_t ByteReader::ReadUint32() {
+  const unsigned char* p = Skip(4);
+  if (!p) {
+    return 0;
+  }
+  return (uint32_t)p[0] |
+    ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) |
+    ((uint32_t)p[3] << 24);
+}
+
+uint64_t ByteReader::ReadUint64() {
+  const unsigned char* p = Skip(8);
+  if (!p) {
+    return 0;
+  }
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+uint64_t ByteReader::ReadVarInt() {
+  const unsigned char* p = Skip(1);
+  if (!p) {
+    return 0;
+  }
+  if (*p < 0xfd) {
+    return *p;
+  }
+  if (*p == 0xfd) {
+    const unsigned char* q = Skip(2);
+    return q ? ((uint64_t)q[0] | ((uint64_t)q[1] << 8)) : 0;
+  }
+  if (*p == 0xfe) {
+    return ReadUint32();
+  }
+  return ReadUint64();
+}
+
+const unsigned char* ByteReader::Skip(uint64_t size) {
+  if (!ok_ || size > size_ - offset_) {
+    ok_ = false;
+    return NULL;
+  }
+  const unsigned char* p = data_ + offset_;
+  offset_ += size;
+  return p;
+}
+
+// Smallest possible serialized input (36-byte outpoint, empty script,
+// sequence number) and output (value, empty script). Used to reject
+// counts that couldn't possibly fit before reserving space for them.
+static const size_t MIN_INPUT_SIZE = 32 + 4 + 1 + 4;
+static const size_t MIN_OUTPUT_SIZE = 8 + 1;
+
+TxView::TxView()
+  : data_(NULL), size_(0), version_(0), lock_time_(0) {
+}
+
+void TxView::Clear() {
+  data_ = NULL;
+  size_ = 0;
+  version_ = 0;
+  lock_time_ = 0;
+  inputs_.clear();
+  outputs_.clear();
+}
+
+bool TxView::Parse(const bytes_t& bytes) {
+  return Parse(bytes.empty() ? NULL : &bytes[0], bytes.size());
+}
+
+bool TxView::Parse(const unsigned char* data, size_t size) {
+  Clear();
+  ByteReader reader(data, size);
+
+  version_ = reader.ReadUint32();
+  if (reader.ok() && version_ != 1) {
+    std::cerr << "rejecting unrecognized tx version" << std::endl;
+    Clear();
+    return false;
+  }
+
+  uint64_t tx_in_count = reader.ReadVarInt();
+  if (tx_in_count > size / MIN_INPUT_SIZE) {
+    Clear();
+    return false;
+  }
+  inputs_.reserve(tx_in_count);
+  for (uint64_t i = 0; reader.ok() && i < tx_in_count; ++i) {
+    Input input;
+    input.prev_txo_hash_offset = reader.offset();
+    reader.Skip(32);
+    input.prev_txo_index = reader.ReadUint32();
+    input.script_size = reader.ReadVarInt();
+    input.script_offset = reader.offset();
+    reader.Skip(input.script_size);
+    input.sequence_no = reader.ReadUint32();
+    inputs_.push_back(input);
+  }
+
+  uint64_t tx_out_count = reader.ReadVarInt();
+  if (tx_out_count > size / MIN_OUTPUT_SIZE) {
+    Clear();
+    return false;
+  }
+  outputs_.reserve(tx_out_count);
+  for (uint64_t i = 0; reader.ok() && i < tx_out_count; ++i) {
+    Output output;
+    output.value = reader.ReadUint64();
+    output.script_size = reader.ReadVarInt();
+    output.script_offset = reader.offset();
+    reader.Skip(output.script_size);
+    outputs_.push_back(output);
+  }
+
+  lock_time_ = reader.ReadUint32();
+  if (!reader.ok() || !reader.at_end()) {
+    Clear();
+    return false;
+  }
+  data_ = data;
+  size_ = size;
+  return true;
+}
+
+bytes_t TxView::prev_txo_hash(size_t input) const {
+  const unsigned char* p = data_ + inputs_[input].prev_txo_hash_offset;
+  bytes_t hash(32);
+  std::reverse_copy(p, p + 32, hash.begin());
+  return hash;
+}
+
+bytes_t TxView::input_script(size_t input) const {
+  const unsigned char* p = data_ + inputs_[input].script_offset;
+  return bytes_t(p, p + inputs_[input].script_size);
+}
+
+bytes_t TxView::output_script(size_t output) const {
+  const unsigned char* p = data_ + outputs_[output].script_offset;
+  return bytes_t(p, p + outputs_[output].script_size);
+}
+
+bytes_t TxView::hash() const {
+  bytes_t hash_bigendian = Crypto::DoubleSHA256(data_, size_);
+  return bytes_t(hash_bigendian.rbegin(), hash_bigendian.rend());
+}
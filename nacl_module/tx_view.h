@@ -0,0 +1,110 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__TX_VIEW_H__)
+#define __TX_VIEW_H__
+
+#include <vector>
+
+#include "types.h"
+
+// Reads little-endian integers, varints and byte runs from a buffer
+// it doesn't own. Every read is bounds-checked: once one runs past
+// the end, ok() turns false and stays false, and later reads return
+// zero or NULL.
+class ByteReader {
+ public:
+  ByteReader(const unsigned char* data, size_t size)
+    : data_(data), size_(size), offset_(0), ok_(true) {}
+
+  bool ok() const { return ok_; }
+  size_t offset() const { return offset_; }
+  bool at_end() const { return offset_ == size_; }
+
+  uint32_t ReadUint32();
+  uint64_t ReadUint64();
+  uint64_t ReadVarInt();
+
+  // Returns a pointer to the next size bytes and moves past them.
+  const unsigned char* Skip(uint64_t size);
+
+ private:
+  const unsigned char* data_;
+  size_t size_;
+  size_t offset_;
+  bool ok_;
+};
+
+// A parsed transaction that refers to, rather than copies, the bytes
+// it was parsed from. Inputs and outputs are recorded as offsets into
+// that buffer, which must outlive the view. Turn it into an owning
+// Transaction with Transaction(const TxView&) only when one is
+// actually needed.
+class TxView {
+ public:
+  struct Input {
+    size_t prev_txo_hash_offset;  // 32 bytes, serialized byte order
+    uint32_t prev_txo_index;
+    size_t script_offset;
+    size_t script_size;
+    uint32_t sequence_no;
+  };
+  struct Output {
+    uint64_t value;
+    size_t script_offset;
+    size_t script_size;
+  };
+
+  TxView();
+
+  // Returns false, leaving the view empty, unless data holds exactly
+  // one well-formed version 1 transaction.
+  bool Parse(const unsigned char* data, size_t size);
+  bool Parse(const bytes_t& bytes);
+
+  const unsigned char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  uint32_t version() const { return version_; }
+  uint32_t lock_time() const { return lock_time_; }
+  const std::vector<Input>& inputs() const { return inputs_; }
+  const std::vector<Output>& outputs() const { return outputs_; }
+
+  // Copying accessors, for when a bytes_t is needed anyway. Hashes
+  // are in the usual reversed display order, as in Transaction.
+  bytes_t prev_txo_hash(size_t input) const;
+  bytes_t input_script(size_t input) const;
+  bytes_t output_script(size_t output) const;
+  bytes_t hash() const;
+
+ private:
+  void Clear();
+
+  const unsigned char* data_;
+  size_t size_;
+  uint32_t version_;
+  uint32_t lock_time_;
+  std::vector<Input> inputs_;
+  std::vector<Output> outputs_;
+};
+
+#endif  // #if !defined(__TX_VIEW_H__)
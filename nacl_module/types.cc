@@ -20,29 +20,58 @@
 // CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
-#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 
 #include "types.h"
 
-std::string to_hex(const bytes_t& bytes) {
-  std::stringstream out;
-  size_t len = bytes.size();
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+// The value of each hex digit, or -1 for anything that isn't one.
+static const signed char HEX_VALUES[256] = {
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+   0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
 
-  for (size_t i = 0; i < len; i++) {
-    out << std::setw(2) << std::hex << std::setfill('0') <<
-      static_cast<unsigned int>(bytes[i]);
+void to_hex(const unsigned char* bytes, size_t size, char* hex) {
+  for (size_t i = 0; i < size; ++i) {
+    hex[i * 2] = HEX_DIGITS[bytes[i] >> 4];
+    hex[i * 2 + 1] = HEX_DIGITS[bytes[i] & 0x0f];
   }
+}
 
-  return out.str();
+std::string to_hex(const bytes_t& bytes) {
+  std::string hex(bytes.size() * 2, '0');
+  if (!bytes.empty()) {
+    to_hex(&bytes[0], bytes.size(), &hex[0]);
+  }
+  return hex;
 }
 
 std::string to_hex_reversed(const bytes_t& bytes) {
-  bytes_t bytes_reversed(bytes);
-  std::reverse(bytes_reversed.begin(), bytes_reversed.end());
-  return to_hex(bytes_reversed);
+  std::string hex(bytes.size() * 2, '0');
+  const size_t size = bytes.size();
+  for (size_t i = 0; i < size; ++i) {
+    const unsigned char byte = bytes[size - 1 - i];
+    hex[i * 2] = HEX_DIGITS[byte >> 4];
+    hex[i * 2 + 1] = HEX_DIGITS[byte & 0x0f];
+  }
+  return hex;
 }
 
 std::string to_fingerprint(uint32_t fingerprint) {
@@ -52,16 +81,33 @@ std::string to_fingerprint(uint32_t fingerprint) {
   return stream.str();
 }
 
-// http://stackoverflow.com/a/9622208/344467
 int to_int(int c) {
-  if (not isxdigit(c)) return -1; // error: non-hexadecimal digit found
-  if (isdigit(c)) return c - '0';
-  if (isupper(c)) c = tolower(c);
-  return c - 'a' + 10;
+  if (c < 0 || c > 0xff) {
+    return -1;
+  }
+  return HEX_VALUES[c];
+}
+
+bool unhexlify(const char* hex, size_t hex_size, unsigned char* bytes) {
+  if (hex_size % 2 != 0) {
+    return false;
+  }
+  // Bad digits are all -1, so OR-ing everything together catches
+  // them without a branch per byte.
+  int bad = 0;
+  for (size_t i = 0; i < hex_size / 2; ++i) {
+    const int top = HEX_VALUES[static_cast<unsigned char>(hex[i * 2])];
+    const int bot = HEX_VALUES[static_cast<unsigned char>(hex[i * 2 + 1])];
+    bad |= top | bot;
+    bytes[i] = static_cast<unsigned char>((top << 4) | bot);
+  }
+  return bad >= 0;
 }
 
 bytes_t unhexlify(const std::string& s) {
-  bytes_t result(s.size() >> 1);
-  unhexlify(&s[0], &s[s.size()], &result[0]);
+  bytes_t result(s.size() / 2);
+  if (result.empty() || !unhexlify(s.data(), s.size(), &result[0])) {
+    return bytes_t();
+  }
   return result;
 }
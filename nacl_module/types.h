@@ -32,6 +32,8 @@ const uint64_t SATOSHIS_IN_BTC = 100000000;
 
 typedef std::vector<unsigned char> bytes_t;
 
+// Writes 2 * size lowercase hex digits, with no terminator, to hex.
+void to_hex(const unsigned char* bytes, size_t size, char* hex);
 std::string to_hex(const bytes_t& bytes);
 std::string to_hex_reversed(const bytes_t& bytes);
 std::string to_fingerprint(uint32_t fingerprint);
@@ -50,6 +52,10 @@ template<class InputIterator, class OutputIterator> int
   return 0;
 }
 
+// Decodes hex_size digits, either case, into hex_size / 2 bytes.
+// Returns false if hex_size is odd or any digit isn't hex.
+bool unhexlify(const char* hex, size_t hex_size, unsigned char* bytes);
+// Empty if s isn't valid hex.
 bytes_t unhexlify(const std::string& s);
 
 #define DISALLOW_EVIL_CONSTRUCTORS(TypeName)    \
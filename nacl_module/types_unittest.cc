@@ -0,0 +1,73 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "gtest/gtest.h"
+
+#include "types.h"
+
+TEST(TypesTest, Hex) {
+  bytes_t bytes;
+  for (int i = 0; i < 256; ++i) {
+    bytes.push_back(i);
+  }
+  const std::string hex(to_hex(bytes));
+  ASSERT_EQ(512, hex.size());
+  EXPECT_EQ("000102", hex.substr(0, 6));
+  EXPECT_EQ("9fa0", hex.substr(0x9f * 2, 4));
+  EXPECT_EQ("feff", hex.substr(508));
+  EXPECT_EQ(bytes, unhexlify(hex));
+
+  EXPECT_EQ("ff0a01", to_hex_reversed(unhexlify("010aff")));
+  EXPECT_EQ("", to_hex(bytes_t()));
+  EXPECT_EQ("", to_hex_reversed(bytes_t()));
+
+  // Either case decodes.
+  EXPECT_EQ(unhexlify("abcdef"), unhexlify("ABCdEF"));
+
+  // Into a caller's buffer.
+  char buffer[6];
+  to_hex(&bytes[0xfd], 3, buffer);
+  EXPECT_EQ("fdfeff", std::string(buffer, 6));
+  unsigned char decoded[3];
+  EXPECT_TRUE(unhexlify(buffer, 6, decoded));
+  EXPECT_EQ(0xfd, decoded[0]);
+  EXPECT_EQ(0xff, decoded[2]);
+}
+
+TEST(TypesTest, BadHex) {
+  EXPECT_TRUE(unhexlify("").empty());
+  EXPECT_TRUE(unhexlify("abc").empty());
+  EXPECT_TRUE(unhexlify("0g").empty());
+  EXPECT_TRUE(unhexlify("00 1").empty());
+  EXPECT_TRUE(unhexlify("0x00").empty());
+  EXPECT_TRUE(unhexlify(std::string("00\x80" "0", 4)).empty());
+  EXPECT_TRUE(unhexlify(std::string("00\0" "0", 4)).empty());
+
+  unsigned char decoded[2];
+  EXPECT_FALSE(unhexlify("0011", 3, decoded));
+  EXPECT_FALSE(unhexlify("00z1", 4, decoded));
+  EXPECT_TRUE(unhexlify("0011", 4, decoded));
+
+  EXPECT_EQ(-1, to_int('g'));
+  EXPECT_EQ(-1, to_int(-1));
+  EXPECT_EQ(11, to_int('B'));
+}
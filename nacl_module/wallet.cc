@@ -23,18 +23,22 @@
 #include <iostream>  // cerr
 
 #include <algorithm>
+#include <ctime>
+#include <deque>
 #include <istream>
 #include <sstream>
 
-#include "base58.h"
 #include "blockchain.h"
+#include "coin_selector.h"
 #include "credentials.h"
 #include "crypto.h"
 #include "encrypting_node_factory.h"
 #include "errors.h"
 #include "node.h"
 #include "node_factory.h"
+#include "openssl/crypto.h"
 #include "wallet.h"
+#include "worker_pool.h"
 
 Address::Address(const bytes_t& hash160, uint32_t child_num, bool is_public)
   : hash160_(hash160), child_num_(child_num), is_public_(is_public),
@@ -44,14 +48,29 @@ Address::Address(const bytes_t& hash160, uint32_t child_num, bool is_public)
 Wallet::Wallet(Blockchain* blockchain,
                Credentials* credentials,
                const std::string& ext_pub_b58,
-               const bytes_t& ext_prv_enc)
+               const bytes_t& ext_prv_enc,
+               const bytes_t& address_cache)
   : blockchain_(blockchain), credentials_(credentials),
     ext_pub_b58_(ext_pub_b58), ext_prv_enc_(ext_prv_enc),
     watch_only_node_(EncryptingNodeFactory::RestoreNode(ext_pub_b58_)),
+    node_cache_(16),
     public_address_gap_(4), change_address_gap_(4),
     public_address_start_(0), change_address_start_(0),
-    next_change_address_index_(change_address_start_) {
+    next_change_address_index_(change_address_start_),
+    thread_count_(0) {
+  if (credentials_) {
+    credentials_->AddObserver(this);
+  }
   ResetGaps();
+  // A cache comes from a wallet that already did the initial gap
+  // checks, so redoing them here would grow it by another bunch.
+  if (!address_cache.empty()) {
+    if (ImportAddressCache(address_cache)) {
+      return;
+    }
+    std::cerr << "Ignoring address cache for another wallet or version"
+              << std::endl;
+  }
   CheckPublicAddressGap(0);
   CheckChangeAddressGap(0);
 }
@@ -62,6 +81,10 @@ void Wallet::ResetGaps() {
 }
 
 Wallet::~Wallet() {
+  if (credentials_) {
+    credentials_->RemoveObserver(this);
+  }
+  ClearSigningSession();
   for (hash_to_address_t::const_iterator i = watched_addresses_.begin();
        i != watched_addresses_.end();
        ++i) {
@@ -76,31 +99,32 @@ void Wallet::WatchAddress(const bytes_t& hash160,
     return;
   }
   Address* address = new Address(hash160, child_num, is_public);
-  watched_addresses_[hash160] = address;
+  watched_addresses_[Hash160(hash160)] = address;
 }
 
 bool Wallet::IsAddressWatched(const bytes_t& hash160) {
-  return watched_addresses_.count(hash160) == 1;
+  return watched_addresses_.count(Hash160(hash160)) == 1;
 }
 
 void Wallet::UpdateAddressBalance(const bytes_t& hash160, uint64_t balance) {
-  if (!IsAddressWatched(hash160)) {
+  hash_to_address_t::iterator i = watched_addresses_.find(Hash160(hash160));
+  if (i == watched_addresses_.end()) {
     std::cerr << "oops, update balance of unwatched address" << std::endl;
     return;
   }
-  if (watched_addresses_[hash160]->balance() != balance) {
-    Address* a = watched_addresses_[hash160];
-    a->set_balance(balance);
+  if (i->second->balance() != balance) {
+    i->second->set_balance(balance);
   }
 }
 
 void Wallet::UpdateAddressTxCount(const bytes_t& hash160, uint64_t tx_count) {
-  if (!IsAddressWatched(hash160)) {
+  hash_to_address_t::iterator i = watched_addresses_.find(Hash160(hash160));
+  if (i == watched_addresses_.end()) {
     std::cerr << "oops, update tx_count of unwatched address" << std::endl;
     return;
   }
-  if (watched_addresses_[hash160]->tx_count() != tx_count && tx_count != 0) {
-    Address* a = watched_addresses_[hash160];
+  if (i->second->tx_count() != tx_count && tx_count != 0) {
+    Address* a = i->second;
     a->set_tx_count(tx_count);
     if (a->is_public()) {
       CheckPublicAddressGap(a->child_num());
@@ -110,22 +134,234 @@ void Wallet::UpdateAddressTxCount(const bytes_t& hash160, uint64_t tx_count) {
   }
 }
 
-void Wallet::GenerateAddressBunch(uint32_t start, uint32_t count,
-                                  bool is_public) {
-  const std::string& path_prefix = is_public ?
-    "m/0/" : // external path
-    "m/1/";  // internal path
-  for (uint32_t i = start; i < start + count; ++i) {
-    std::stringstream node_path;
-    node_path << path_prefix << i;
-    std::auto_ptr<Node>
-      address_node(NodeFactory::DeriveChildNodeWithPath(*watch_only_node_,
-                                                        node_path.str()));
-    if (address_node.get()) {
-      WatchAddress(Base58::toHash160(address_node->public_key()),
-                   i, is_public);
+bool Wallet::DeriveChainNode(const Node& root, uint32_t chain,
+                             Node& chain_node) {
+  // The chain node is the cached intermediate of every address path
+  // on that chain.
+  const DerivationPath address_path(DerivationPath().Child(chain).Child(0));
+  if (node_cache_.FindDeepestPrefix(root, address_path, chain_node) == 1) {
+    return true;
+  }
+  if (!NodeFactory::DeriveChildNode(root, chain, chain_node)) {
+    return false;
+  }
+  node_cache_.Add(root, address_path, 1, chain_node);
+  return true;
+}
+
+// "H9AC", followed by a one-byte format version.
+const uint32_t ADDRESS_CACHE_MAGIC = 0x48394143;
+const unsigned char ADDRESS_CACHE_VERSION = 1;
+const size_t ADDRESS_CACHE_HEADER_SIZE = 4 + 1 + 4 + 4 + 4;
+const size_t ADDRESS_CACHE_CHECKSUM_SIZE = 4;
+
+static void PushUint32(bytes_t& bytes, uint32_t n) {
+  bytes.push_back(n >> 24);
+  bytes.push_back((n >> 16) & 0xff);
+  bytes.push_back((n >> 8) & 0xff);
+  bytes.push_back(n & 0xff);
+}
+
+static uint32_t ReadUint32(const unsigned char* p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+    (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+// The fingerprint in the header lets a mismatch be reported cheaply;
+// checksumming over the whole serialized xpub as well catches
+// fingerprint collisions and xpubs differing only in chain code.
+static bytes_t AddressCacheChecksum(const Node& node,
+                                    const unsigned char* body,
+                                    size_t body_size) {
+  bytes_t input(node.toSerializedPublic());
+  input.insert(input.end(), body, body + body_size);
+  const bytes_t digest(Crypto::DoubleSHA256(input));
+  return bytes_t(digest.begin(),
+                 digest.begin() + ADDRESS_CACHE_CHECKSUM_SIZE);
+}
+
+void Wallet::ExportAddressCache(bytes_t& cache) {
+  const uint32_t counts[2] = { public_address_count_, change_address_count_ };
+  const uint32_t starts[2] = { public_address_start_, change_address_start_ };
+
+  // Addresses are only kept by hash160, so index them first.
+  std::map<uint32_t, const Hash160*> by_index[2];
+  for (hash_to_address_t::const_iterator i = watched_addresses_.begin();
+       i != watched_addresses_.end();
+       ++i) {
+    by_index[i->second->is_public() ? 0 : 1][i->second->child_num()] =
+      &i->first;
+  }
+
+  cache.clear();
+  cache.reserve(ADDRESS_CACHE_HEADER_SIZE +
+                (counts[0] + counts[1]) * Node::HASH160_SIZE +
+                ADDRESS_CACHE_CHECKSUM_SIZE);
+  PushUint32(cache, ADDRESS_CACHE_MAGIC);
+  cache.push_back(ADDRESS_CACHE_VERSION);
+  PushUint32(cache, watch_only_node_->fingerprint());
+  PushUint32(cache, counts[0]);
+  PushUint32(cache, counts[1]);
+  for (int chain = 0; chain < 2; ++chain) {
+    for (uint32_t i = starts[chain]; i < starts[chain] + counts[chain]; ++i) {
+      std::map<uint32_t, const Hash160*>::const_iterator hash160 =
+        by_index[chain].find(i);
+      if (hash160 == by_index[chain].end()) {
+        // Underivable index; all zeroes is never a real hash160 here.
+        cache.insert(cache.end(), Node::HASH160_SIZE, 0);
+      } else {
+        cache.insert(cache.end(), hash160->second->begin(),
+                     hash160->second->end());
+      }
+    }
+  }
+  const bytes_t checksum(AddressCacheChecksum(*watch_only_node_,
+                                              &cache[0], cache.size()));
+  cache.insert(cache.end(), checksum.begin(), checksum.end());
+}
+
+bool Wallet::ImportAddressCache(const bytes_t& cache) {
+  if (cache.size() < ADDRESS_CACHE_HEADER_SIZE +
+      ADDRESS_CACHE_CHECKSUM_SIZE) {
+    return false;
+  }
+  const unsigned char* p = &cache[0];
+  if (ReadUint32(p) != ADDRESS_CACHE_MAGIC ||
+      p[4] != ADDRESS_CACHE_VERSION ||
+      ReadUint32(p + 5) != watch_only_node_->fingerprint()) {
+    return false;
+  }
+  const uint32_t counts[2] = { ReadUint32(p + 9), ReadUint32(p + 13) };
+  const uint32_t starts[2] = { public_address_start_, change_address_start_ };
+  // Compare in 64 bits so huge counts can't wrap the size check.
+  const uint64_t body_size = ADDRESS_CACHE_HEADER_SIZE +
+    ((uint64_t)counts[0] + counts[1]) * Node::HASH160_SIZE;
+  if (body_size + ADDRESS_CACHE_CHECKSUM_SIZE != cache.size()) {
+    return false;
+  }
+  const bytes_t checksum(AddressCacheChecksum(*watch_only_node_, p,
+                                              body_size));
+  if (!std::equal(checksum.begin(), checksum.end(), p + body_size)) {
+    return false;
+  }
+
+  // Good. Only add what's missing; anything already watched was
+  // derived from the same xpub and so is identical.
+  const bytes_t zero_hash160(Node::HASH160_SIZE, 0);
+  uint32_t* wallet_counts[2] = { &public_address_count_,
+                                 &change_address_count_ };
+  const unsigned char* hash160 = p + ADDRESS_CACHE_HEADER_SIZE;
+  for (int chain = 0; chain < 2; ++chain) {
+    for (uint32_t i = 0; i < counts[chain]; ++i) {
+      if (i >= *wallet_counts[chain] &&
+          !std::equal(zero_hash160.begin(), zero_hash160.end(), hash160)) {
+        WatchAddress(bytes_t(hash160, hash160 + Node::HASH160_SIZE),
+                     starts[chain] + i, chain == 0);
+      }
+      hash160 += Node::HASH160_SIZE;
+    }
+    if (counts[chain] > *wallet_counts[chain]) {
+      *wallet_counts[chain] = counts[chain];
+    }
+  }
+  if (public_pool_.get()) {
+    public_pool_->Restart(public_address_start_ + public_address_count_);
+  }
+  if (change_pool_.get()) {
+    change_pool_->Restart(change_address_start_ + change_address_count_);
+  }
+  return true;
+}
+
+void Wallet::set_look_ahead_depth(size_t depth) {
+  public_pool_.reset();
+  change_pool_.reset();
+  if (depth == 0) {
+    return;
+  }
+  Node chain_node(*watch_only_node_);
+  if (DeriveChainNode(*watch_only_node_, 0, chain_node)) {
+    public_pool_.reset(new AddressPool(chain_node,
+                                       public_address_start_ +
+                                       public_address_count_,
+                                       depth));
+  }
+  if (DeriveChainNode(*watch_only_node_, 1, chain_node)) {
+    change_pool_.reset(new AddressPool(chain_node,
+                                       change_address_start_ +
+                                       change_address_count_,
+                                       depth));
+  }
+}
+
+// Smaller bunches, like the few addresses the gap logic asks for at a
+// time, are derived inline; spawning threads would cost more than the
+// derivation itself.
+const uint32_t PARALLEL_BUNCH_THRESHOLD = 64;
+
+uint32_t Wallet::GenerateAddressBunch(uint32_t start, uint32_t count,
+                                      bool is_public,
+                                      RangeObserver* observer) {
+  // Use up whatever the look-ahead pool has ready.
+  AddressPool* pool = is_public ? public_pool_.get() : change_pool_.get();
+  uint32_t taken = 0;
+  bytes_t pooled_hash160;
+  while (pool && taken < count &&
+         pool->Take(start + taken, pooled_hash160)) {
+    if (!pooled_hash160.empty()) {
+      WatchAddress(pooled_hash160, start + taken, is_public);
+    }
+    ++taken;
+  }
+  if (taken == count) {
+    return count;
+  }
+  start += taken;
+  count -= taken;
+
+  Node chain_node(*watch_only_node_);
+  if (!DeriveChainNode(*watch_only_node_,
+                       is_public ?
+                       0 :  // external path
+                       1,   // internal path
+                       chain_node)) {
+    // Like any other underivable address, skip rather than retry.
+    return taken + count;
+  }
+  bytes_t public_keys;
+  bytes_t hash160s;
+  uint32_t derived_count = 0;
+  NodeFactory::DeriveChildRange(chain_node, start, count,
+                                count >= PARALLEL_BUNCH_THRESHOLD ?
+                                thread_count_ : 1,
+                                observer, public_keys, hash160s,
+                                derived_count);
+  for (uint32_t i = 0; i < derived_count; ++i) {
+    // A zero-filled key marks an index that couldn't be derived.
+    if (public_keys[i * Node::PUBLIC_KEY_SIZE] == 0) {
+      continue;
     }
+    const bytes_t::const_iterator hash160 =
+      hash160s.begin() + i * Node::HASH160_SIZE;
+    WatchAddress(bytes_t(hash160, hash160 + Node::HASH160_SIZE),
+                 start + i, is_public);
+  }
+  if (pool) {
+    pool->Restart(start + derived_count);
   }
+  return taken + derived_count;
+}
+
+bool Wallet::ExtendPublicAddresses(uint32_t count, RangeObserver* observer) {
+  if (count <= public_address_count_) {
+    return true;
+  }
+  const uint32_t wanted = count - public_address_count_;
+  const uint32_t generated =
+    GenerateAddressBunch(public_address_start_ + public_address_count_,
+                         wanted, true, observer);
+  public_address_count_ += generated;
+  return generated == wanted;
 }
 
 void Wallet::CheckPublicAddressGap(uint32_t address_index_used) {
@@ -136,7 +372,7 @@ void Wallet::CheckPublicAddressGap(uint32_t address_index_used) {
   if (desired_count > public_address_count_) {
     // Yes, it's time to allocate.
     GenerateAddressBunch(public_address_start_ + public_address_count_,
-                         public_address_gap_, true);
+                         public_address_gap_, true, NULL);
     public_address_count_ += public_address_gap_;
   }
 }
@@ -149,7 +385,7 @@ void Wallet::CheckChangeAddressGap(uint32_t address_index_used) {
   if (desired_count > change_address_count_) {
     // Yes, it's time to allocate.
     GenerateAddressBunch(change_address_start_ + change_address_count_,
-                         change_address_gap_, false);
+                         change_address_gap_, false, NULL);
     change_address_count_ += change_address_gap_;
   }
   if (address_index_used >= next_change_address_index_) {
@@ -160,86 +396,209 @@ void Wallet::CheckChangeAddressGap(uint32_t address_index_used) {
   }
 }
 
-bytes_t Wallet::GetNextUnusedChangeAddress() {
-  // TODO(miket): we should probably increment
-  // next_change_address_index_ here, because a transaction might take
-  // a while to confirm, and if the user issues several transactions
-  // in a row, they'll all go to the same change address.
-  std::stringstream node_path;
-  node_path << "m/1/" << next_change_address_index_;  // internal path
+uint32_t Wallet::GetNextFreeChangeIndex() {
+  // next_change_address_index_ only moves once a tx pays to it, so
+  // skip past the ones that txs still in flight are going to.
+  const uint32_t index =
+    reservations_.GetNextFreeChangeIndex(next_change_address_index_);
+  while (index >= change_address_start_ + change_address_count_) {
+    GenerateAddressBunch(change_address_start_ + change_address_count_,
+                         change_address_gap_, false, NULL);
+    change_address_count_ += change_address_gap_;
+  }
+  return index;
+}
+
+bytes_t Wallet::GetChangeAddress(uint32_t index) {
+  const DerivationPath internal_path("m/1");
   std::auto_ptr<Node> address_node(NodeFactory::
                                    DeriveChildNodeWithPath(*watch_only_node_,
-                                                           node_path.str()));
+                                                           internal_path.Child(
+                                                             index),
+                                                           &node_cache_));
   if (address_node.get()) {
-    return Base58::toHash160(address_node->public_key());
+    return address_node->hex_id();
   }
   return bytes_t();
 }
 
+void Wallet::PrepareKeysForAddresses(const std::set<bytes_t>& hash160s) {
+  DeriveSigningKeys(hash160s);
+}
+
 bool Wallet::GetKeysForAddress(const bytes_t& hash160,
                                bytes_t& public_key,
                                bytes_t& key) {
-  if (signing_keys_.count(hash160) == 0) {
-    return false;
+  const Hash160 address(hash160);
+  if (signing_keys_.count(address) == 0) {
+    std::set<bytes_t> hash160s;
+    hash160s.insert(hash160);
+    DeriveSigningKeys(hash160s);
+    if (signing_keys_.count(address) == 0) {
+      return false;
+    }
   }
-  public_key = signing_public_keys_[hash160];
-  key = signing_keys_[hash160];
+  public_key = signing_public_keys_[address].bytes();
+  key = signing_keys_[address];
   return true;
 }
 
-void Wallet::GenerateAllSigningKeys(Node* signing_node) {
-  for (uint32_t i = public_address_start_;
-       i < public_address_start_ + public_address_count_;
+Node* Wallet::GetSigningNode() {
+  if (!signing_node_.get() && credentials_ && !credentials_->isLocked()) {
+    signing_node_.reset(EncryptingNodeFactory::RestoreNode(credentials_,
+                                                           ext_prv_enc_));
+  }
+  return signing_node_.get();
+}
+
+namespace {
+
+// Wipes a private Node however the scope holding it is left.
+class ScopedNodeWiper {
+ public:
+  explicit ScopedNodeWiper(Node& node) : node_(node) {}
+  ~ScopedNodeWiper() { node_.Wipe(); }
+
+ private:
+  Node& node_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(ScopedNodeWiper);
+};
+
+// Derives one signing key per item from its chain node. Each index
+// writes only its own item.
+class SigningKeyTask : public ParallelTask {
+ public:
+  struct Item {
+    bool is_public;
+    const Node* chain_node;
+    uint32_t child_num;
+    Hash160 hash160;
+    PubKey33 public_key;
+    bytes_t key;
+  };
+
+  explicit SigningKeyTask(std::vector<Item>& items) : items_(items) {}
+
+  void Run(size_t index) {
+    Item& item = items_[index];
+    Node node(*item.chain_node);
+    ScopedNodeWiper node_wiper(node);
+    if (!NodeFactory::DeriveChildNode(*item.chain_node, item.child_num,
+                                      node)) {
+      return;
+    }
+    // Guard against a watched address that isn't where it claims.
+    if (node.hash160() != item.hash160) {
+      return;
+    }
+    item.public_key = node.public_key33();
+    // Straight from the node's buffer; secret_key() would leave an
+    // uncleansed temporary behind.
+    item.key.assign(node.secret_key_data(),
+                    node.secret_key_data() + Node::SECRET_KEY_SIZE);
+  }
+
+ private:
+  std::vector<Item>& items_;
+};
+
+}  // namespace
+
+void Wallet::DeriveSigningKeys(const std::set<bytes_t>& hash160s) {
+  std::vector<SigningKeyTask::Item> items;
+  for (std::set<bytes_t>::const_iterator i = hash160s.begin();
+       i != hash160s.end();
        ++i) {
-    std::stringstream node_path;
-    node_path << "m/0/" << i;  // external path
-    std::auto_ptr<Node> node(NodeFactory::
-                             DeriveChildNodeWithPath(*signing_node,
-                                                     node_path.str()));
-    if (node.get()) {
-      bytes_t hash160(Base58::toHash160(node->public_key()));
-      signing_public_keys_[hash160] = node->public_key();
-      signing_keys_[hash160] = node->secret_key();
+    if (i->size() != Node::HASH160_SIZE) {
+      continue;
+    }
+    const Hash160 hash160(*i);
+    if (signing_keys_.count(hash160) != 0) {
+      continue;
+    }
+    hash_to_address_t::const_iterator address =
+      watched_addresses_.find(hash160);
+    if (address == watched_addresses_.end()) {
+      continue;
+    }
+    SigningKeyTask::Item item;
+    item.is_public = address->second->is_public();
+    item.chain_node = NULL;
+    item.child_num = address->second->child_num();
+    item.hash160 = hash160;
+    items.push_back(item);
+  }
+  if (items.empty()) {
+    return;
+  }
+
+  Node* signing_node = GetSigningNode();
+  if (!signing_node) {
+    return;
+  }
+  Node external_node(*signing_node);
+  ScopedNodeWiper external_node_wiper(external_node);
+  Node internal_node(*signing_node);
+  ScopedNodeWiper internal_node_wiper(internal_node);
+  if (!DeriveChainNode(*signing_node, 0, external_node) ||
+      !DeriveChainNode(*signing_node, 1, internal_node)) {
+    return;
+  }
+  // Shared by the workers, so fill in the lazy parts now.
+  external_node.fingerprint();
+  internal_node.fingerprint();
+  for (size_t i = 0; i < items.size(); ++i) {
+    items[i].chain_node =
+      items[i].is_public ? &external_node : &internal_node;
+  }
+
+  SigningKeyTask task(items);
+  WorkerPool pool(items.size() > 1 ? thread_count_ : 1);
+  pool.Run(&task, items.size());
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (!items[i].key.empty()) {
+      signing_public_keys_[items[i].hash160] = items[i].public_key;
+      signing_keys_[items[i].hash160].swap(items[i].key);
     }
   }
-  for (uint32_t i = change_address_start_;
-       i < change_address_start_ + change_address_count_;
+}
+
+void Wallet::ClearSigningSession() {
+  for (std::map<Hash160, bytes_t>::iterator i = signing_keys_.begin();
+       i != signing_keys_.end();
        ++i) {
-    std::stringstream node_path;
-    node_path << "m/1/" << i;  // internal path
-    std::auto_ptr<Node> node(NodeFactory::
-                             DeriveChildNodeWithPath(*signing_node,
-                                                     node_path.str()));
-    if (node.get()) {
-      bytes_t hash160(Base58::toHash160(node->public_key()));
-      signing_public_keys_[hash160] = node->public_key();
-      signing_keys_[hash160] = node->secret_key();
+    if (!i->second.empty()) {
+      OPENSSL_cleanse(&i->second[0], i->second.size());
     }
   }
+  signing_keys_.clear();
+  signing_public_keys_.clear();
+  if (signing_node_.get()) {
+    signing_node_->Wipe();
+    signing_node_.reset();
+  }
+}
+
+void Wallet::OnCredentialsLocked() {
+  ClearSigningSession();
+  node_cache_.Clear();
 }
 
 bool Wallet::CreateTx(const tx_outs_t& recipients,
                       uint64_t fee,
+                      uint64_t fee_rate,
                       bool should_sign,
                       bytes_t& tx) {
   if (should_sign && credentials_->isLocked()) {
     return false;
   }
-  TxOut change_txo(0, GetNextUnusedChangeAddress());
+  reservations_.Expire(time(NULL));
+  const uint32_t change_index = GetNextFreeChangeIndex();
+  TxOut change_txo(0, GetChangeAddress(change_index));
 
-  std::auto_ptr<Node>
-    signing_node(EncryptingNodeFactory::RestoreNode(credentials_,
-                                                    ext_prv_enc_));
-  GenerateAllSigningKeys(signing_node.get());
-
-  Blockchain::address_set_t addresses;
   tx_outs_t unspent_txos;
-  for (hash_to_address_t::const_iterator i = watched_addresses_.begin();
-       i != watched_addresses_.end();
-       ++i) {
-    addresses.insert(i->first);
-  }
-  blockchain_->GetUnspentTxos(addresses, unspent_txos);
+  GetWatchedUnspentTxos(unspent_txos);
 
   Transaction transaction;
   int error_code = 0;
@@ -249,15 +608,118 @@ bool Wallet::CreateTx(const tx_outs_t& recipients,
                         recipients,
                         change_txo,
                         fee,
+                        fee_rate,
                         error_code);
   if (error_code != ERROR_NONE) {
     std::cerr << "CreateTx failed: " << error_code << std::endl;
+    return false;
   }
+  ReserveTx(transaction, recipients.size(), change_index);
+  return true;
+}
 
-  signing_public_keys_.clear();
-  signing_keys_.clear();
+bool Wallet::CreateTxBatch(const std::vector<tx_outs_t>& recipient_groups,
+                           uint64_t fee,
+                           uint64_t fee_rate,
+                           size_t max_tx_size,
+                           std::vector<bytes_t>& txs) {
+  txs.clear();
+  if (credentials_->isLocked()) {
+    return false;
+  }
+  reservations_.Expire(time(NULL));
 
-  return error_code == ERROR_NONE;
+  // One snapshot and one sorted pool for the whole batch. Signing keys
+  // are kept in the signing session, so each is derived only once no
+  // matter how many txs spend from its address.
+  tx_outs_t unspent_txos;
+  GetWatchedUnspentTxos(unspent_txos);
+  CoinSelector selector(&unspent_txos);
+
+  std::deque<tx_outs_t> pending(recipient_groups.begin(),
+                                recipient_groups.end());
+  std::vector<bytes_t> tx_hashes;
+  while (!pending.empty()) {
+    const tx_outs_t recipients(pending.front());
+    pending.pop_front();
+
+    // Each tx gets its own change address; the ones before it in the
+    // batch have already reserved theirs.
+    const uint32_t change_index = GetNextFreeChangeIndex();
+    TxOut change_txo(0, GetChangeAddress(change_index));
+
+    Transaction transaction;
+    transaction.set_max_signed_size(max_tx_size);
+    int error_code = 0;
+    bytes_t tx = transaction.Sign(this,
+                                  &selector,
+                                  recipients,
+                                  change_txo,
+                                  fee,
+                                  fee_rate,
+                                  error_code);
+    if (error_code == ERROR_TRANSACTION_TOO_LARGE && recipients.size() > 1) {
+      // Split it, keeping the recipients in order.
+      const size_t half = recipients.size() / 2;
+      pending.push_front(tx_outs_t(recipients.begin() + half,
+                                   recipients.end()));
+      pending.push_front(tx_outs_t(recipients.begin(),
+                                   recipients.begin() + half));
+      continue;
+    }
+    if (error_code != ERROR_NONE) {
+      std::cerr << "CreateTxBatch failed: " << error_code << std::endl;
+      for (std::vector<bytes_t>::const_iterator i = tx_hashes.begin();
+           i != tx_hashes.end();
+           ++i) {
+        reservations_.Release(*i);
+      }
+      txs.clear();
+      return false;
+    }
+    selector.Remove(transaction.inputs());
+    ReserveTx(transaction, recipients.size(), change_index);
+    tx_hashes.push_back(transaction.hash());
+    txs.push_back(tx);
+  }
+  return true;
+}
+
+// A P2SH output can hash to one of our addresses, but our keys alone
+// can't spend it.
+static bool IsUnsignable(const TxOut& txo) {
+  return txo.script_type() != SCRIPT_TYPE_P2PKH &&
+    txo.script_type() != SCRIPT_TYPE_P2PK;
+}
+
+void Wallet::GetWatchedUnspentTxos(tx_outs_t& unspent_txos) {
+  Blockchain::address_set_t addresses;
+  for (hash_to_address_t::const_iterator i = watched_addresses_.begin();
+       i != watched_addresses_.end();
+       ++i) {
+    addresses.insert(i->first);
+  }
+  blockchain_->GetUnspentTxos(addresses, unspent_txos);
+  unspent_txos.erase(std::remove_if(unspent_txos.begin(), unspent_txos.end(),
+                                    IsUnsignable),
+                     unspent_txos.end());
+  reservations_.RemoveReservedOutputs(unspent_txos);
+}
+
+void Wallet::ReserveTx(const Transaction& transaction,
+                       size_t recipient_count,
+                       uint32_t change_index) {
+  // Sign() appends change after the recipients, if there's any.
+  const bool has_change = transaction.outputs().size() > recipient_count;
+  reservations_.Reserve(transaction.hash(),
+                        transaction.inputs(),
+                        has_change ? change_index :
+                        ReservationLedger::NO_CHANGE,
+                        time(NULL));
+}
+
+bool Wallet::ReleaseTx(const bytes_t& tx_hash) {
+  return reservations_.Release(tx_hash);
 }
 
 static bool SortAddresses(const Address* a, const Address* b) {
@@ -273,21 +735,34 @@ void Wallet::GetAddresses(Address::addresses_t& addresses) {
   for (hash_to_address_t::const_iterator i = watched_addresses_.begin();
        i != watched_addresses_.end();
        ++i) {
-    i->second->set_balance(blockchain_->GetAddressBalance(i->first));
-    i->second->set_tx_count(blockchain_->GetAddressTxCount(i->first));
+    const bytes_t& hash160 = i->second->hash160();
+    i->second->set_balance(blockchain_->GetAddressBalance(hash160));
+    i->second->set_tx_count(blockchain_->GetAddressTxCount(hash160));
     addresses.push_back(i->second);
   }
   std::sort(addresses.begin(), addresses.end(), SortAddresses);
 }
 
 void Wallet::UpdateAddressBalancesAndTxCounts() {
+  // Once the blockchain has a tx we made, it knows what the tx spent
+  // and where its change went, so the reservation has done its job.
+  std::vector<bytes_t> reserved_tx_hashes;
+  reservations_.GetReservedTxHashes(reserved_tx_hashes);
+  for (std::vector<bytes_t>::const_iterator i = reserved_tx_hashes.begin();
+       i != reserved_tx_hashes.end();
+       ++i) {
+    if (blockchain_->HasTransaction(*i)) {
+      reservations_.Release(*i);
+    }
+  }
+
   bool size_changed = true;
   while (size_changed) {
     size_t watch_count = watched_addresses_.size();
     for (hash_to_address_t::const_iterator i = watched_addresses_.begin();
          i != watched_addresses_.end();
          ++i) {
-      Blockchain::address_t a = i->first;
+      const Blockchain::address_t& a = i->second->hash160();
       UpdateAddressBalance(a, blockchain_->GetAddressBalance(a));
       UpdateAddressTxCount(a, blockchain_->GetAddressTxCount(a));
     }
@@ -312,15 +787,15 @@ void Wallet::GetHistory(history_t& history) {
   for (Address::addresses_t::const_iterator i = addresses.begin();
        i != addresses.end();
        ++i) {
-    address_set.insert((*i)->hash160());
+    address_set.insert(Hash160((*i)->hash160()));
   }
 
-  std::vector<const Transaction*> transactions;
-  blockchain_->GetTransactionsForAddresses(address_set, transactions);
+  std::vector<Blockchain::tx_hash_t> tx_hashes;
+  blockchain_->GetTransactionsForAddresses(address_set, tx_hashes);
 
-  for (std::vector<const Transaction*>::const_iterator i =
-         transactions.begin();
-       i != transactions.end();
+  for (std::vector<Blockchain::tx_hash_t>::const_iterator i =
+         tx_hashes.begin();
+       i != tx_hashes.end();
        ++i) {
     HistoryItem item = blockchain_->TransactionToHistoryItem(address_set, *i);
     history.push_back(item);
@@ -28,11 +28,15 @@
 #include <string>
 #include <set>
 
+#include "address_pool.h"
 #include "blockchain.h"
+#include "credentials.h"
+#include "fixed_bytes.h"
+#include "node_factory.h"
+#include "reservation_ledger.h"
 #include "tx.h"
 #include "types.h"
 
-class Credentials;
 class HistoryItem;
 class Node;
 
@@ -56,26 +60,86 @@ class Address {
   uint64_t tx_count_;
 };
 
-class Wallet : public KeyProvider {
+class Wallet : public KeyProvider, public CredentialsObserver {
  public:
+  // If address_cache is a valid ExportAddressCache() result for this
+  // xpub, its addresses are watched without deriving anything.
   Wallet(Blockchain* blockchain, Credentials* credentials,
          const std::string& ext_pub_b58,
-         const bytes_t& ext_prv_enc);
+         const bytes_t& ext_prv_enc,
+         const bytes_t& address_cache = bytes_t());
   virtual ~Wallet();
 
   uint32_t public_address_count() const { return public_address_count_; }
   uint32_t change_address_count() const { return change_address_count_; }
 
+  // Threads used to derive addresses. Zero, the default, means one
+  // per processor.
+  void set_thread_count(size_t thread_count) {
+    thread_count_ = thread_count;
+  }
+
+  // A compact snapshot of every watched address, for the client to
+  // persist and hand back to the constructor next session. It holds
+  // only public data: a version, the xpub's fingerprint, the public
+  // and change address counts, the hash160s in index order, and a
+  // checksum tying all of it to the full xpub.
+  void ExportAddressCache(bytes_t& cache);
+
+  // Watches the addresses in cache, which must come from
+  // ExportAddressCache() on a wallet with the same xpub. Returns
+  // false, changing nothing, if it doesn't.
+  bool ImportAddressCache(const bytes_t& cache);
+
+  // How many addresses past the current gap to keep derived on
+  // background threads, per chain, so crossing the gap doesn't stall
+  // the caller. Zero, the default, turns look-ahead off.
+  void set_look_ahead_depth(size_t depth);
+
+  // Makes sure at least count public addresses are watched, deriving
+  // the missing ones in parallel. Meant for pre-generating a large
+  // pool of deposit addresses. Returns false if observer cancelled,
+  // in which case the addresses derived so far are kept.
+  bool ExtendPublicAddresses(uint32_t count, RangeObserver* observer);
+
   // KeyProvider overrides
+  void PrepareKeysForAddresses(const std::set<bytes_t>& hash160s);
   bool GetKeysForAddress(const bytes_t& hash160,
                          bytes_t& public_key,
                          bytes_t& key);
 
+  // Pays recipients from the wallet's unspent outputs. The fee is fee
+  // plus fee_rate satoshis per byte of the finished tx.
   bool CreateTx(const tx_outs_t& recipients,
                 uint64_t fee,
+                uint64_t fee_rate,
                 bool should_sign,
                 bytes_t& tx);
 
+  // Pays each group of recipients with its own tx, all drawn from one
+  // snapshot of the unspent outputs so that no two share an input.
+  // Each tx pays fee plus fee_rate per byte. If max_tx_size is
+  // nonzero, a group that would make a bigger tx is split in half
+  // until it fits. Every tx is signed, so credentials must be
+  // unlocked. Returns false, with txs empty, if any of them can't be
+  // made.
+  bool CreateTxBatch(const std::vector<tx_outs_t>& recipient_groups,
+                     uint64_t fee,
+                     uint64_t fee_rate,
+                     size_t max_tx_size,
+                     std::vector<bytes_t>& txs);
+
+  // Every tx made by CreateTx() or CreateTxBatch() holds on to its
+  // inputs and change address until it's reported back, released, or
+  // this many seconds pass, so that the next one picks others.
+  void set_reservation_timeout(uint64_t seconds) {
+    reservations_.set_timeout(seconds);
+  }
+
+  // Gives back what tx_hash was holding, for a tx that won't be
+  // broadcast after all. Returns false if it held nothing.
+  bool ReleaseTx(const bytes_t& tx_hash);
+
   // To be called when we know that something changed in the
   // blockchain.
   void UpdateAddressBalancesAndTxCounts();
@@ -83,19 +147,37 @@ class Wallet : public KeyProvider {
   void GetAddresses(Address::addresses_t& addresses);
   void GetHistory(history_t& history);
 
+  // CredentialsObserver overrides
+  void OnCredentialsLocked();
+
  protected:
   void UpdateAddressBalance(const bytes_t& hash160, uint64_t balance);
   void UpdateAddressTxCount(const bytes_t& hash160, uint64_t tx_count);
 
+  bool has_signing_session() const { return signing_node_.get() != NULL; }
+  size_t signing_key_count() const { return signing_keys_.size(); }
+
  private:
-  bytes_t GetNextUnusedChangeAddress();
+  // The first unused change index that no pending tx has reserved,
+  // watched so that its change will be seen when it comes back.
+  uint32_t GetNextFreeChangeIndex();
+  bytes_t GetChangeAddress(uint32_t index);
+  // The unspent outputs minus those reserved by pending txs.
+  void GetWatchedUnspentTxos(tx_outs_t& unspent_txos);
+  void ReserveTx(const Transaction& transaction,
+                 size_t recipient_count,
+                 uint32_t change_index);
 
   bool IsPublicAddressInWallet(const bytes_t& hash160);
   bool IsChangeAddressInWallet(const bytes_t& hash160);
   bool IsAddressInWallet(const bytes_t& hash160);
 
-  void GenerateAddressBunch(uint32_t start, uint32_t count,
-                            bool is_public);
+  // Gets root's m/0 or m/1, through node_cache_.
+  bool DeriveChainNode(const Node& root, uint32_t chain, Node& chain_node);
+  // Returns the number of leading indexes it got through, which is
+  // less than count only if observer cancelled.
+  uint32_t GenerateAddressBunch(uint32_t start, uint32_t count,
+                                bool is_public, RangeObserver* observer);
   void CheckPublicAddressGap(uint32_t address_index_used);
   void CheckChangeAddressGap(uint32_t address_index_used);
   void ResetGaps();
@@ -105,11 +187,17 @@ class Wallet : public KeyProvider {
                     bool is_public);
   bool IsAddressWatched(const bytes_t& hash160);
 
-  void GenerateAllSigningKeys(Node* signing_node);
+  // Decrypts the signing node unless the session already has it.
+  // NULL if the credentials are locked.
+  Node* GetSigningNode();
+  // Adds keys for any of hash160s that are watched but not yet in
+  // the session, deriving them in parallel.
+  void DeriveSigningKeys(const std::set<bytes_t>& hash160s);
+  void ClearSigningSession();
 
   void SetCurrentBlock(uint64_t height);
 
-  typedef std::map<bytes_t, Address*> hash_to_address_t;
+  typedef std::map<Hash160, Address*> hash_to_address_t;
   hash_to_address_t watched_addresses_;
 
   Blockchain* blockchain_;
@@ -118,6 +206,15 @@ class Wallet : public KeyProvider {
   const bytes_t ext_prv_enc_;
   std::auto_ptr<Node> watch_only_node_;
 
+  // The m/0 and m/1 chain nodes, public from watch_only_node_ and
+  // private from the signing node, so that each address costs one
+  // derivation step. Cleared on lock.
+  NodeCache node_cache_;
+
+  // Look-ahead for m/0 and m/1; NULL unless set_look_ahead_depth().
+  std::auto_ptr<AddressPool> public_pool_;
+  std::auto_ptr<AddressPool> change_pool_;
+
   // The size of a new bunch of contiguous addresses.
   const uint32_t public_address_gap_;
   const uint32_t change_address_gap_;
@@ -132,8 +229,18 @@ class Wallet : public KeyProvider {
 
   uint32_t next_change_address_index_;
 
-  std::map<bytes_t, bytes_t> signing_public_keys_;
-  std::map<bytes_t, bytes_t> signing_keys_;
+  ReservationLedger reservations_;
+
+  size_t thread_count_;
+
+  // The signing session: the decrypted signing node and the keys
+  // derived from it, kept while the credentials are unlocked so that
+  // a burst of CreateTx() calls decrypts and derives only once. Keys
+  // are derived only for addresses that transactions actually spend
+  // from. Zeroed and dropped on lock.
+  std::auto_ptr<Node> signing_node_;
+  std::map<Hash160, PubKey33> signing_public_keys_;
+  std::map<Hash160, bytes_t> signing_keys_;
 
   DISALLOW_EVIL_CONSTRUCTORS(Wallet);
 };
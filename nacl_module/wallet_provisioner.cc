@@ -0,0 +1,155 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "wallet_provisioner.h"
+
+#include <memory>
+
+#include "base58.h"
+#include "credentials.h"
+#include "crypto.h"
+#include "mnemonic.h"
+#include "node.h"
+#include "node_factory.h"
+#include "worker_pool.h"
+
+static const size_t DEFAULT_BATCH_SIZE = 64;
+
+// Same strength as EncryptingNodeFactory::GenerateMasterNode().
+static const size_t DEFAULT_ENTROPY_SIZE = 32;
+
+ProvisionedWallet::ProvisionedWallet()
+  : succeeded_(false) {
+}
+
+class ProvisioningTask : public ParallelTask {
+ public:
+  ProvisioningTask(const bytes_t& key,
+                   const std::string& account_path,
+                   const std::string& passphrase,
+                   size_t entropy_size,
+                   std::vector<ProvisionedWallet>& wallets)
+    : key_(key), account_path_(account_path), passphrase_(passphrase),
+      entropy_size_(entropy_size), wallets_(wallets) {
+  }
+
+  void Run(size_t index) {
+    ProvisionedWallet& wallet = wallets_[index];
+    wallet.succeeded_ = Provision(wallet);
+    if (!wallet.succeeded_) {
+      failed_.Set();
+    }
+  }
+
+  bool ShouldStop() { return failed_.IsSet(); }
+
+ private:
+  bool Provision(ProvisionedWallet& wallet) {
+    bytes_t entropy(entropy_size_, 0);
+    if (!Crypto::GetRandomBytes(entropy)) {
+      return false;
+    }
+    if (!Mnemonic::EntropyToCode(entropy, wallet.code_)) {
+      return false;
+    }
+    bytes_t seed;
+    if (!Crypto::DeriveBIP0039Seed(wallet.code_, passphrase_, seed)) {
+      return false;
+    }
+
+    std::auto_ptr<Node> master_node(NodeFactory::CreateNodeFromSeed(seed));
+    if (!master_node.get()) {
+      return false;
+    }
+    std::auto_ptr<Node> account_node(NodeFactory::
+                                     DeriveChildNodeWithPath(*master_node,
+                                                             account_path_));
+    if (!account_node.get()) {
+      return false;
+    }
+
+    wallet.account_ext_pub_b58_ =
+      Base58::toBase58Check(account_node->toSerializedPublic());
+    return Crypto::Encrypt(key_, master_node->toSerialized(),
+                           wallet.master_ext_prv_enc_) &&
+      Crypto::Encrypt(key_, account_node->toSerialized(),
+                      wallet.account_ext_prv_enc_);
+  }
+
+  const bytes_t& key_;
+  const std::string& account_path_;
+  const std::string& passphrase_;
+  const size_t entropy_size_;
+  std::vector<ProvisionedWallet>& wallets_;
+  SharedFlag failed_;
+};
+
+WalletProvisioner::WalletProvisioner(Credentials* credentials,
+                                     const std::string& account_path,
+                                     const std::string& passphrase)
+  : credentials_(credentials), account_path_(account_path),
+    passphrase_(passphrase), thread_count_(0),
+    batch_size_(DEFAULT_BATCH_SIZE), entropy_size_(DEFAULT_ENTROPY_SIZE) {
+}
+
+bool WalletProvisioner::Provision(size_t count,
+                                  ProvisioningSink* sink,
+                                  size_t& provisioned) {
+  provisioned = 0;
+  if (credentials_->isLocked()) {
+    return false;
+  }
+  if (entropy_size_ % 4 != 0 || entropy_size_ < 16 || entropy_size_ > 32) {
+    return false;
+  }
+
+  // Take our own copy of the key so that workers never read
+  // Credentials while something else might be locking it.
+  const bytes_t key(credentials_->ephemeral_key());
+  WorkerPool pool(thread_count_);
+  std::vector<ProvisionedWallet> wallets;
+  wallets.reserve(batch_size_);
+
+  while (provisioned < count) {
+    size_t batch_count = count - provisioned;
+    if (batch_count > batch_size_) {
+      batch_count = batch_size_;
+    }
+    wallets.assign(batch_count, ProvisionedWallet());
+    ProvisioningTask task(key, account_path_, passphrase_, entropy_size_,
+                          wallets);
+    pool.Run(&task, batch_count);
+
+    for (size_t i = 0; i < batch_count; ++i) {
+      if (!wallets[i].succeeded()) {
+        return false;
+      }
+      const bool keep_going = sink->OnWalletProvisioned(provisioned,
+                                                        wallets[i]);
+      ++provisioned;
+      if (!keep_going) {
+        return true;
+      }
+    }
+  }
+  return true;
+}
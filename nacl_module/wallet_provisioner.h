@@ -0,0 +1,108 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__WALLET_PROVISIONER_H__)
+#define __WALLET_PROVISIONER_H__
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+class Credentials;
+
+// Everything needed to hand a freshly generated wallet to a customer
+// and to watch and spend from its account.
+class ProvisionedWallet {
+ public:
+  ProvisionedWallet();
+
+  const std::string& code() const { return code_; }
+  const bytes_t& master_ext_prv_enc() const { return master_ext_prv_enc_; }
+  const bytes_t& account_ext_prv_enc() const {
+    return account_ext_prv_enc_;
+  }
+  const std::string& account_ext_pub_b58() const {
+    return account_ext_pub_b58_;
+  }
+  bool succeeded() const { return succeeded_; }
+
+ private:
+  friend class ProvisioningTask;
+
+  std::string code_;
+  bytes_t master_ext_prv_enc_;
+  bytes_t account_ext_prv_enc_;
+  std::string account_ext_pub_b58_;
+  bool succeeded_;
+};
+
+class ProvisioningSink {
+ public:
+  virtual ~ProvisioningSink() {}
+
+  // Called on the thread running Provision(), once per wallet, in
+  // index order. Returning false stops provisioning.
+  virtual bool OnWalletProvisioned(size_t index,
+                                   const ProvisionedWallet& wallet) = 0;
+};
+
+// Generates wallets in bulk: random entropy, its BIP 0039 code, the
+// seed, the master node and the account node at account_path, with
+// both private nodes encrypted under the unlocked credentials. This
+// is the work of a generate-master-node plus derive-child-node round
+// trip per wallet, done without the intermediate Encrypt and
+// RestoreNode steps.
+//
+// Wallets are built batch_size at a time on a WorkerPool and handed
+// to the sink before the next batch starts, so memory stays bounded
+// no matter how many are requested.
+class WalletProvisioner {
+ public:
+  WalletProvisioner(Credentials* credentials,
+                    const std::string& account_path,
+                    const std::string& passphrase);
+
+  void set_thread_count(size_t count) { thread_count_ = count; }
+  void set_batch_size(size_t size) { batch_size_ = size > 0 ? size : 1; }
+  // 16 to 32 in steps of 4, i.e., 12 to 24 code words.
+  void set_entropy_size(size_t size) { entropy_size_ = size; }
+
+  // Produces count wallets. provisioned receives the number delivered
+  // to the sink. Returns false if the credentials are locked, the
+  // parameters are bad, or any derivation fails.
+  bool Provision(size_t count,
+                 ProvisioningSink* sink,
+                 size_t& provisioned);
+
+ private:
+  Credentials* credentials_;
+  const std::string account_path_;
+  const std::string passphrase_;
+  size_t thread_count_;
+  size_t batch_size_;
+  size_t entropy_size_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(WalletProvisioner);
+};
+
+#endif  // #if !defined(__WALLET_PROVISIONER_H__)
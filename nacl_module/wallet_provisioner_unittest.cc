@@ -0,0 +1,131 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "base58.h"
+#include "credentials.h"
+#include "encrypting_node_factory.h"
+#include "mnemonic.h"
+#include "node.h"
+#include "node_factory.h"
+#include "wallet_provisioner.h"
+
+class CollectingSink : public ProvisioningSink {
+ public:
+  CollectingSink(size_t limit) : limit_(limit) {}
+
+  bool OnWalletProvisioned(size_t index, const ProvisionedWallet& wallet) {
+    EXPECT_EQ(wallets_.size(), index);
+    wallets_.push_back(wallet);
+    return wallets_.size() < limit_;
+  }
+
+  size_t limit_;
+  std::vector<ProvisionedWallet> wallets_;
+};
+
+static void UnlockCredentials(Credentials& c) {
+  bytes_t salt, check, encrypted_ephemeral_key;
+  EXPECT_TRUE(c.SetPassphrase("secret", salt, check,
+                              encrypted_ephemeral_key));
+}
+
+TEST(WalletProvisionerTest, HappyPath) {
+  const std::string ACCOUNT_PATH("m/44'/0'/0'");
+  Credentials c;
+  UnlockCredentials(c);
+
+  WalletProvisioner provisioner(&c, ACCOUNT_PATH, "");
+  provisioner.set_batch_size(3);
+  provisioner.set_entropy_size(16);
+  CollectingSink sink(100);
+  size_t provisioned = 0;
+  EXPECT_TRUE(provisioner.Provision(7, &sink, provisioned));
+  EXPECT_EQ(7, (int)provisioned);
+  ASSERT_EQ(7, (int)sink.wallets_.size());
+
+  Mnemonic m;
+  std::set<std::string> codes;
+  for (size_t i = 0; i < sink.wallets_.size(); ++i) {
+    const ProvisionedWallet& w = sink.wallets_[i];
+    codes.insert(w.code());
+
+    // The code should lead to the same account the provisioner saw.
+    bytes_t entropy;
+    EXPECT_TRUE(m.CodeToEntropy(w.code(), entropy));
+    EXPECT_EQ(16, (int)entropy.size());
+    bytes_t seed;
+    EXPECT_TRUE(m.CodeToSeed(w.code(), "", seed));
+    std::auto_ptr<Node> master(NodeFactory::CreateNodeFromSeed(seed));
+    std::auto_ptr<Node> account(NodeFactory::
+                                DeriveChildNodeWithPath(*master,
+                                                        ACCOUNT_PATH));
+    EXPECT_EQ(Base58::toBase58Check(account->toSerializedPublic()),
+              w.account_ext_pub_b58());
+
+    // And the encrypted nodes should restore under the credentials.
+    std::auto_ptr<Node>
+      restored_master(EncryptingNodeFactory::
+                      RestoreNode(&c, w.master_ext_prv_enc()));
+    ASSERT_TRUE(restored_master.get() != NULL);
+    EXPECT_EQ(master->fingerprint(), restored_master->fingerprint());
+    std::auto_ptr<Node>
+      restored_account(EncryptingNodeFactory::
+                       RestoreNode(&c, w.account_ext_prv_enc()));
+    ASSERT_TRUE(restored_account.get() != NULL);
+    EXPECT_EQ(account->secret_key(), restored_account->secret_key());
+  }
+  EXPECT_EQ(7, (int)codes.size());
+}
+
+TEST(WalletProvisionerTest, SinkStopsEarly) {
+  Credentials c;
+  UnlockCredentials(c);
+  WalletProvisioner provisioner(&c, "m/0'", "");
+  provisioner.set_batch_size(4);
+  CollectingSink sink(5);
+  size_t provisioned = 0;
+  EXPECT_TRUE(provisioner.Provision(100, &sink, provisioned));
+  EXPECT_EQ(5, (int)provisioned);
+  EXPECT_EQ(5, (int)sink.wallets_.size());
+  EXPECT_EQ(24, (int)std::count(sink.wallets_[0].code().begin(),
+                                sink.wallets_[0].code().end(), ' ') + 1);
+}
+
+TEST(WalletProvisionerTest, RequiresUnlockedCredentials) {
+  Credentials c;
+  UnlockCredentials(c);
+  c.Lock();
+  WalletProvisioner provisioner(&c, "m/0'", "");
+  CollectingSink sink(100);
+  size_t provisioned = 0;
+  EXPECT_FALSE(provisioner.Provision(1, &sink, provisioned));
+  EXPECT_EQ(0, (int)provisioned);
+  EXPECT_TRUE(sink.wallets_.empty());
+}
@@ -22,6 +22,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 
 #include "gtest/gtest.h"
@@ -31,6 +32,8 @@
 #include "credentials.h"
 #include "encrypting_node_factory.h"
 #include "node.h"
+#include "node_factory.h"
+#include "tx_view.h"
 #include "wallet.h"
 
 class TestWallet: public Wallet {
@@ -38,8 +41,10 @@ public:
   TestWallet(Blockchain* blockchain,
              Credentials* credentials,
              const std::string& ext_pub_b58,
-             const bytes_t& ext_prv_enc)
-    : Wallet(blockchain, credentials, ext_pub_b58, ext_prv_enc) {
+             const bytes_t& ext_prv_enc,
+             const bytes_t& address_cache = bytes_t())
+    : Wallet(blockchain, credentials, ext_pub_b58, ext_prv_enc,
+             address_cache) {
   }
 
   void FakeUpdateAddressBalance(const bytes_t& hash160,
@@ -51,6 +56,9 @@ public:
                                 uint64_t tx_count) {
     UpdateAddressTxCount(hash160, tx_count);
   }
+
+  bool has_signing_session() const { return Wallet::has_signing_session(); }
+  size_t signing_key_count() const { return Wallet::signing_key_count(); }
 };
 
 TEST(WalletTest, HappyPath) {
@@ -114,6 +122,374 @@ TEST(WalletTest, HappyPath) {
   EXPECT_EQ(4 + 4, w->change_address_count());
 }
 
+TEST(WalletTest, ExtendPublicAddresses) {
+  std::auto_ptr<Blockchain> b(new Blockchain);
+  std::auto_ptr<Credentials> c(new Credentials);
+  std::auto_ptr<TestWallet>
+    w(new TestWallet(b.get(),
+                     c.get(),
+                     EXT_3442193E_PUB_B58,
+                     unhexlify(EXT_3442193E_PRV_ENC)));
+  w->set_thread_count(3);
+  EXPECT_TRUE(w->ExtendPublicAddresses(50, NULL));
+  EXPECT_EQ(50, w->public_address_count());
+  EXPECT_EQ(4, w->change_address_count());
+
+  // Never shrinks.
+  EXPECT_TRUE(w->ExtendPublicAddresses(10, NULL));
+  EXPECT_EQ(50, w->public_address_count());
+
+  // The parallel addresses match the sequential ones, in order.
+  std::auto_ptr<Node>
+    watch_only_node(EncryptingNodeFactory::RestoreNode(EXT_3442193E_PUB_B58));
+  Address::addresses_t addresses;
+  w->GetAddresses(addresses);
+  uint32_t public_seen = 0;
+  bytes_t last_hash160;
+  for (Address::addresses_t::const_iterator i = addresses.begin();
+       i != addresses.end();
+       ++i) {
+    if (!(*i)->is_public()) {
+      continue;
+    }
+    std::stringstream path;
+    path << "m/0/" << (*i)->child_num();
+    std::auto_ptr<Node>
+      node(NodeFactory::DeriveChildNodeWithPath(*watch_only_node,
+                                                path.str()));
+    EXPECT_EQ(node->hex_id(), (*i)->hash160());
+    if ((*i)->child_num() == 49) {
+      last_hash160 = (*i)->hash160();
+    }
+    ++public_seen;
+  }
+  EXPECT_EQ(50, public_seen);
+
+  // Sending to the last one extends the gap as usual.
+  w->FakeUpdateAddressTxCount(last_hash160, 1);
+  EXPECT_EQ(54, w->public_address_count());
+}
+
+TEST(WalletTest, LookAhead) {
+  std::auto_ptr<Blockchain> b(new Blockchain);
+  std::auto_ptr<Credentials> c(new Credentials);
+  std::auto_ptr<TestWallet>
+    w(new TestWallet(b.get(),
+                     c.get(),
+                     EXT_3442193E_PUB_B58,
+                     unhexlify(EXT_3442193E_PRV_ENC)));
+  w->set_look_ahead_depth(6);
+
+  // Crossing the gap gives the same addresses with or without the
+  // pool, whether or not it's caught up.
+  const Blockchain::address_t
+    ADDR(Base58::fromAddress("12CL4K2eVqj7hQTix7dM7CVHCkpP17Pry3"));
+  w->FakeUpdateAddressTxCount(ADDR, 1);
+  EXPECT_EQ(4 + 4, w->public_address_count());
+  EXPECT_TRUE(w->ExtendPublicAddresses(20, NULL));
+  EXPECT_EQ(20, w->public_address_count());
+
+  std::auto_ptr<Node>
+    watch_only_node(EncryptingNodeFactory::RestoreNode(EXT_3442193E_PUB_B58));
+  Address::addresses_t addresses;
+  w->GetAddresses(addresses);
+  uint32_t public_seen = 0;
+  for (Address::addresses_t::const_iterator i = addresses.begin();
+       i != addresses.end();
+       ++i) {
+    if (!(*i)->is_public()) {
+      continue;
+    }
+    std::stringstream path;
+    path << "m/0/" << (*i)->child_num();
+    std::auto_ptr<Node>
+      node(NodeFactory::DeriveChildNodeWithPath(*watch_only_node,
+                                                path.str()));
+    EXPECT_EQ(node->hex_id(), (*i)->hash160());
+    ++public_seen;
+  }
+  EXPECT_EQ(20, public_seen);
+}
+
+TEST(WalletTest, AddressCache) {
+  std::auto_ptr<Blockchain> b(new Blockchain);
+  std::auto_ptr<Credentials> c(new Credentials);
+  std::auto_ptr<TestWallet>
+    w(new TestWallet(b.get(),
+                     c.get(),
+                     EXT_3442193E_PUB_B58,
+                     unhexlify(EXT_3442193E_PRV_ENC)));
+  EXPECT_TRUE(w->ExtendPublicAddresses(30, NULL));
+  bytes_t cache;
+  w->ExportAddressCache(cache);
+  EXPECT_EQ(4 + 1 + 4 + 4 + 4 + (30 + 4) * 20 + 4, cache.size());
+
+  // A wallet built from the cache has the same addresses.
+  std::auto_ptr<TestWallet>
+    restored(new TestWallet(b.get(),
+                            c.get(),
+                            EXT_3442193E_PUB_B58,
+                            unhexlify(EXT_3442193E_PRV_ENC),
+                            cache));
+  EXPECT_EQ(30, restored->public_address_count());
+  EXPECT_EQ(4, restored->change_address_count());
+  Address::addresses_t expected;
+  Address::addresses_t actual;
+  w->GetAddresses(expected);
+  restored->GetAddresses(actual);
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i]->hash160(), actual[i]->hash160());
+    EXPECT_EQ(expected[i]->child_num(), actual[i]->child_num());
+    EXPECT_EQ(expected[i]->is_public(), actual[i]->is_public());
+  }
+  bytes_t restored_cache;
+  restored->ExportAddressCache(restored_cache);
+  EXPECT_EQ(cache, restored_cache);
+
+  // Anything off is rejected without touching the wallet.
+  std::auto_ptr<TestWallet>
+    fresh(new TestWallet(b.get(),
+                         c.get(),
+                         EXT_3442193E_PUB_B58,
+                         unhexlify(EXT_3442193E_PRV_ENC)));
+  bytes_t bad(cache);
+  bad[bad.size() / 2] ^= 1;
+  EXPECT_FALSE(fresh->ImportAddressCache(bad));
+  bad = cache;
+  bad[4] = 2;  // version
+  EXPECT_FALSE(fresh->ImportAddressCache(bad));
+  bad = cache;
+  bad.pop_back();
+  EXPECT_FALSE(fresh->ImportAddressCache(bad));
+  EXPECT_FALSE(fresh->ImportAddressCache(bytes_t()));
+  EXPECT_EQ(4, fresh->public_address_count());
+  EXPECT_TRUE(fresh->ImportAddressCache(cache));
+  EXPECT_EQ(30, fresh->public_address_count());
+
+  // So is a cache from another xpub.
+  std::auto_ptr<Node>
+    node(EncryptingNodeFactory::RestoreNode(EXT_3442193E_PUB_B58));
+  std::auto_ptr<Node> child(NodeFactory::DeriveChildNode(*node, 1));
+  std::auto_ptr<TestWallet>
+    other(new TestWallet(b.get(),
+                         c.get(),
+                         Base58::toBase58Check(child->toSerializedPublic()),
+                         bytes_t()));
+  EXPECT_FALSE(other->ImportAddressCache(cache));
+}
+
+TEST(WalletTest, SigningSession) {
+  std::auto_ptr<Blockchain> b(new Blockchain);
+  std::auto_ptr<Credentials> c(new Credentials);
+  bytes_t salt;
+  bytes_t check;
+  bytes_t encrypted_ephemeral_key;
+  EXPECT_TRUE(c->SetPassphrase("secret", salt, check,
+                               encrypted_ephemeral_key));
+  bytes_t ext_prv_enc;
+  EXPECT_TRUE(EncryptingNodeFactory::ImportMasterNode(c.get(),
+                                                      EXT_3442193E_PRV_B58,
+                                                      ext_prv_enc));
+  std::auto_ptr<TestWallet>
+    w(new TestWallet(b.get(), c.get(), EXT_3442193E_PUB_B58, ext_prv_enc));
+  EXPECT_TRUE(w->ExtendPublicAddresses(200, NULL));
+
+  // Fund one public and one change address.
+  std::auto_ptr<Node>
+    watch_only_node(EncryptingNodeFactory::RestoreNode(EXT_3442193E_PUB_B58));
+  std::auto_ptr<Node>
+    public_node(NodeFactory::DeriveChildNodeWithPath(*watch_only_node,
+                                                     "m/0/150"));
+  std::auto_ptr<Node>
+    change_node(NodeFactory::DeriveChildNodeWithPath(*watch_only_node,
+                                                     "m/1/2"));
+  Transaction funding;
+  funding.Add(TxIn("signing session test"));
+  funding.Add(TxOut(50000, public_node->hex_id()));
+  funding.Add(TxOut(50000, change_node->hex_id()));
+  b->AddTransaction(funding.Serialize());
+
+  // Nothing is decrypted or derived until a transaction needs it,
+  // and then only the keys it spends from.
+  EXPECT_FALSE(w->has_signing_session());
+  tx_outs_t recipients;
+  recipients.push_back(TxOut(1000000, ADDR_1A1z));
+  bytes_t tx;
+  EXPECT_FALSE(w->CreateTx(recipients, 0, 0, true, tx));
+  EXPECT_FALSE(w->has_signing_session());
+
+  recipients.clear();
+  recipients.push_back(TxOut(80000, ADDR_1A1z));
+  EXPECT_TRUE(w->CreateTx(recipients, 0, 0, true, tx));
+  EXPECT_TRUE(w->has_signing_session());
+  EXPECT_EQ(2, w->signing_key_count());
+
+  // Later transactions reuse the session.
+  TxView view;
+  ASSERT_TRUE(view.Parse(tx));
+  EXPECT_TRUE(w->ReleaseTx(view.hash()));
+  EXPECT_TRUE(w->CreateTx(recipients, 0, 0, true, tx));
+  EXPECT_EQ(2, w->signing_key_count());
+
+  // Locking ends the session.
+  EXPECT_TRUE(c->Lock());
+  EXPECT_FALSE(w->has_signing_session());
+  EXPECT_EQ(0, w->signing_key_count());
+  EXPECT_FALSE(w->CreateTx(recipients, 0, 0, true, tx));
+  EXPECT_FALSE(w->has_signing_session());
+}
+
+TEST(WalletTest, CreateTxBatch) {
+  std::auto_ptr<Blockchain> b(new Blockchain);
+  std::auto_ptr<Credentials> c(new Credentials);
+  bytes_t salt;
+  bytes_t check;
+  bytes_t encrypted_ephemeral_key;
+  EXPECT_TRUE(c->SetPassphrase("secret", salt, check,
+                               encrypted_ephemeral_key));
+  bytes_t ext_prv_enc;
+  EXPECT_TRUE(EncryptingNodeFactory::ImportMasterNode(c.get(),
+                                                      EXT_3442193E_PRV_B58,
+                                                      ext_prv_enc));
+  std::auto_ptr<TestWallet>
+    w(new TestWallet(b.get(), c.get(), EXT_3442193E_PUB_B58, ext_prv_enc));
+
+  // Six deposits of 10000 across the first three public addresses.
+  std::auto_ptr<Node>
+    watch_only_node(EncryptingNodeFactory::RestoreNode(EXT_3442193E_PUB_B58));
+  Transaction funding;
+  funding.Add(TxIn("batch test"));
+  for (uint32_t i = 0; i < 6; ++i) {
+    std::stringstream path;
+    path << "m/0/" << i % 3;
+    std::auto_ptr<Node>
+      node(NodeFactory::DeriveChildNodeWithPath(*watch_only_node,
+                                                path.str()));
+    funding.Add(TxOut(10000, node->hex_id()));
+  }
+  b->AddTransaction(funding.Serialize());
+
+  std::vector<tx_outs_t> groups(3);
+  groups[0].push_back(TxOut(15000, ADDR_1A1z));
+  groups[1].push_back(TxOut(5000, ADDR_1A1z));
+  groups[1].push_back(TxOut(5000, ADDR_1A1z));
+  groups[2].push_back(TxOut(20000, ADDR_1A1z));
+  std::vector<bytes_t> txs;
+  ASSERT_TRUE(w->CreateTxBatch(groups, 0, 0, 0, txs));
+  ASSERT_EQ(3, txs.size());
+
+  // Five deposits cover 45000, and none is spent twice.
+  std::set<bytes_t> outpoints;
+  size_t input_count = 0;
+  for (size_t i = 0; i < txs.size(); ++i) {
+    TxView view;
+    ASSERT_TRUE(view.Parse(txs[i]));
+    for (size_t j = 0; j < view.inputs().size(); ++j) {
+      const unsigned char* outpoint =
+        view.data() + view.inputs()[j].prev_txo_hash_offset;
+      outpoints.insert(bytes_t(outpoint, outpoint + 36));
+      ++input_count;
+    }
+  }
+  EXPECT_EQ(5, input_count);
+  EXPECT_EQ(5, outpoints.size());
+
+  // Those txs weren't broadcast, so give their inputs back.
+  for (size_t i = 0; i < txs.size(); ++i) {
+    TxView view;
+    ASSERT_TRUE(view.Parse(txs[i]));
+    EXPECT_TRUE(w->ReleaseTx(view.hash()));
+  }
+
+  // One list too big for a single tx gets split.
+  groups.assign(1, tx_outs_t(4, TxOut(5000, ADDR_1A1z)));
+  ASSERT_TRUE(w->CreateTxBatch(groups, 0, 0, 400, txs));
+  EXPECT_EQ(2, txs.size());
+  for (size_t i = 0; i < txs.size(); ++i) {
+    EXPECT_GE(400, txs[i].size());
+  }
+
+  // All or nothing.
+  groups.assign(2, tx_outs_t(1, TxOut(40000, ADDR_1A1z)));
+  EXPECT_FALSE(w->CreateTxBatch(groups, 0, 0, 0, txs));
+  EXPECT_TRUE(txs.empty());
+}
+
+TEST(WalletTest, Reservations) {
+  std::auto_ptr<Blockchain> b(new Blockchain);
+  std::auto_ptr<Credentials> c(new Credentials);
+  bytes_t salt;
+  bytes_t check;
+  bytes_t encrypted_ephemeral_key;
+  EXPECT_TRUE(c->SetPassphrase("secret", salt, check,
+                               encrypted_ephemeral_key));
+  bytes_t ext_prv_enc;
+  EXPECT_TRUE(EncryptingNodeFactory::ImportMasterNode(c.get(),
+                                                      EXT_3442193E_PRV_B58,
+                                                      ext_prv_enc));
+  std::auto_ptr<TestWallet>
+    w(new TestWallet(b.get(), c.get(), EXT_3442193E_PUB_B58, ext_prv_enc));
+
+  std::auto_ptr<Node>
+    watch_only_node(EncryptingNodeFactory::RestoreNode(EXT_3442193E_PUB_B58));
+  Transaction funding;
+  funding.Add(TxIn("reservation test"));
+  for (uint32_t i = 0; i < 2; ++i) {
+    std::stringstream path;
+    path << "m/0/" << i;
+    std::auto_ptr<Node>
+      node(NodeFactory::DeriveChildNodeWithPath(*watch_only_node,
+                                                path.str()));
+    funding.Add(TxOut(50000, node->hex_id()));
+  }
+  b->AddTransaction(funding.Serialize());
+  w->UpdateAddressBalancesAndTxCounts();
+
+  // Two spends before either is reported pick different inputs and
+  // different change addresses.
+  tx_outs_t recipients;
+  recipients.push_back(TxOut(30000, ADDR_1A1z));
+  bytes_t tx_1;
+  bytes_t tx_2;
+  bytes_t tx_3;
+  ASSERT_TRUE(w->CreateTx(recipients, 0, 0, true, tx_1));
+  ASSERT_TRUE(w->CreateTx(recipients, 0, 0, true, tx_2));
+  TxView view_1;
+  TxView view_2;
+  ASSERT_TRUE(view_1.Parse(tx_1));
+  ASSERT_TRUE(view_2.Parse(tx_2));
+  const Transaction transaction_1(view_1);
+  const Transaction transaction_2(view_2);
+  ASSERT_EQ(1, transaction_1.inputs().size());
+  ASSERT_EQ(1, transaction_2.inputs().size());
+  EXPECT_NE(transaction_1.inputs()[0].prev_txo_index(),
+            transaction_2.inputs()[0].prev_txo_index());
+  ASSERT_EQ(2, transaction_1.outputs().size());
+  ASSERT_EQ(2, transaction_2.outputs().size());
+  EXPECT_NE(transaction_1.outputs()[1].GetSigningAddress(),
+            transaction_2.outputs()[1].GetSigningAddress());
+
+  // Everything is spoken for.
+  EXPECT_FALSE(w->CreateTx(recipients, 0, 0, true, tx_3));
+
+  // Abandoning a tx frees its input.
+  EXPECT_TRUE(w->ReleaseTx(view_2.hash()));
+  EXPECT_FALSE(w->ReleaseTx(view_2.hash()));
+  EXPECT_TRUE(w->CreateTx(recipients, 0, 0, true, tx_3));
+
+  // Once reported, the blockchain takes over.
+  b->AddTransaction(tx_1);
+  w->UpdateAddressBalancesAndTxCounts();
+  EXPECT_FALSE(w->ReleaseTx(view_1.hash()));
+
+  // Stale reservations lapse. That frees the second deposit again,
+  // and the first tx's change is now unspent too.
+  w->set_reservation_timeout(0);
+  recipients[0].set_value(60000);
+  EXPECT_TRUE(w->CreateTx(recipients, 0, 0, true, tx_3));
+}
+
 TEST(WalletTest, NodeCreation) {
   const std::string PP1 = "secret";
 
@@ -0,0 +1,140 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "worker_pool.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <openssl/crypto.h>
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+// OpenSSL before 1.1 isn't thread-safe unless the application
+// supplies locking and thread-id callbacks.
+static pthread_mutex_t* openssl_locks = NULL;
+
+static void OpenSSLLockingCallback(int mode, int n,
+                                   const char* /*file*/, int /*line*/) {
+  if (mode & CRYPTO_LOCK) {
+    pthread_mutex_lock(&openssl_locks[n]);
+  } else {
+    pthread_mutex_unlock(&openssl_locks[n]);
+  }
+}
+
+static unsigned long OpenSSLThreadIdCallback() {
+  return (unsigned long)pthread_self();
+}
+#endif
+
+static pthread_once_t openssl_threading_once = PTHREAD_ONCE_INIT;
+
+static void InitOpenSSLThreading() {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  if (CRYPTO_get_locking_callback() != NULL) {
+    return;
+  }
+  const int lock_count = CRYPTO_num_locks();
+  openssl_locks = new pthread_mutex_t[lock_count];
+  for (int i = 0; i < lock_count; ++i) {
+    pthread_mutex_init(&openssl_locks[i], NULL);
+  }
+  CRYPTO_set_id_callback(OpenSSLThreadIdCallback);
+  CRYPTO_set_locking_callback(OpenSSLLockingCallback);
+#endif
+}
+
+namespace {
+
+struct RunState {
+  ParallelTask* task;
+  size_t count;
+  size_t next_index;
+  pthread_mutex_t mutex;
+};
+
+bool TakeNextIndex(RunState* state, size_t& index) {
+  pthread_mutex_lock(&state->mutex);
+  const bool have_index = state->next_index < state->count;
+  if (have_index) {
+    index = state->next_index++;
+  }
+  pthread_mutex_unlock(&state->mutex);
+  return have_index;
+}
+
+void* WorkerMain(void* arg) {
+  RunState* state = static_cast<RunState*>(arg);
+  size_t index;
+  while (!state->task->ShouldStop() && TakeNextIndex(state, index)) {
+    state->task->Run(index);
+  }
+  return NULL;
+}
+
+}  // namespace
+
+WorkerPool::WorkerPool(size_t thread_count)
+  : thread_count_(thread_count == 0 ? GetProcessorCount() : thread_count) {
+  EnableOpenSSLThreading();
+}
+
+void WorkerPool::EnableOpenSSLThreading() {
+  pthread_once(&openssl_threading_once, InitOpenSSLThreading);
+}
+
+size_t WorkerPool::GetProcessorCount() {
+  const long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? count : 1;
+}
+
+void WorkerPool::Run(ParallelTask* task, size_t count) {
+  RunState state;
+  state.task = task;
+  state.count = count;
+  state.next_index = 0;
+  pthread_mutex_init(&state.mutex, NULL);
+
+  // No point in spawning more threads than there are indexes.
+  size_t extra_threads = thread_count_ - 1;
+  if (extra_threads > count) {
+    extra_threads = count;
+  }
+  std::vector<pthread_t> threads;
+  threads.reserve(extra_threads);
+  for (size_t i = 0; i < extra_threads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, WorkerMain, &state) == 0) {
+      threads.push_back(thread);
+    }
+  }
+
+  // If thread creation failed, this still gets everything done.
+  WorkerMain(&state);
+
+  for (size_t i = 0; i < threads.size(); ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_mutex_destroy(&state.mutex);
+}
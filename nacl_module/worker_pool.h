@@ -0,0 +1,92 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#if !defined(__WORKER_POOL_H__)
+#define __WORKER_POOL_H__
+
+#include <stddef.h>
+
+#include "types.h"
+
+// A flag set from one thread and polled from others, such as a cancel
+// or found-it signal. Setting it publishes everything the setter
+// wrote beforehand to any thread that then sees it set.
+class SharedFlag {
+ public:
+  SharedFlag() : value_(0) {}
+
+  void Set() { __atomic_store_n(&value_, 1, __ATOMIC_RELEASE); }
+  void Clear() { __atomic_store_n(&value_, 0, __ATOMIC_RELEASE); }
+  bool IsSet() const {
+    return __atomic_load_n(&value_, __ATOMIC_ACQUIRE) != 0;
+  }
+
+ private:
+  int value_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(SharedFlag);
+};
+
+// One unit of parallelizable work. Run() is called concurrently from
+// several threads with distinct indexes, so implementations must only
+// touch per-index state or guard shared state themselves.
+class ParallelTask {
+ public:
+  virtual ~ParallelTask() {}
+
+  virtual void Run(size_t index) = 0;
+
+  // Polled between indexes. Returning true skips the remaining work.
+  virtual bool ShouldStop() { return false; }
+};
+
+// Spreads a ParallelTask over a fixed number of pthreads. Threads
+// live only for the duration of Run(), which keeps the pool free of
+// any shutdown protocol at the cost of a thread spawn per call.
+// Callers should therefore hand it reasonably large batches.
+class WorkerPool {
+ public:
+  // A thread_count of zero means one thread per online processor.
+  explicit WorkerPool(size_t thread_count);
+
+  size_t thread_count() const { return thread_count_; }
+
+  // Calls task->Run(i) for every i in [0, count) and returns once all
+  // of them have finished. Indexes are handed out in increasing order
+  // but complete in no particular order. The calling thread does its
+  // share of the work.
+  void Run(ParallelTask* task, size_t count);
+
+  static size_t GetProcessorCount();
+
+  // Makes OpenSSL safe to call from several threads. Pools do this
+  // themselves; other code that starts its own threads must call it
+  // first.
+  static void EnableOpenSSLThreading();
+
+ private:
+  size_t thread_count_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(WorkerPool);
+};
+
+#endif  // #if !defined(__WORKER_POOL_H__)
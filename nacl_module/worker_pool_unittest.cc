@@ -0,0 +1,89 @@
+// Copyright 2014 Mike Tsao <mike@sowbug.com>
+
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+// BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+// ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+// CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <pthread.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "worker_pool.h"
+
+class SquaringTask : public ParallelTask {
+ public:
+  SquaringTask(size_t count, size_t stop_after)
+    : results_(count, 0), stop_after_(stop_after), runs_(0) {
+    pthread_mutex_init(&mutex_, NULL);
+  }
+  ~SquaringTask() {
+    pthread_mutex_destroy(&mutex_);
+  }
+
+  void Run(size_t index) {
+    results_[index] = index * index;
+    pthread_mutex_lock(&mutex_);
+    ++runs_;
+    pthread_mutex_unlock(&mutex_);
+  }
+
+  bool ShouldStop() {
+    pthread_mutex_lock(&mutex_);
+    const bool should_stop = runs_ >= stop_after_;
+    pthread_mutex_unlock(&mutex_);
+    return should_stop;
+  }
+
+  std::vector<size_t> results_;
+  size_t stop_after_;
+  size_t runs_;
+  pthread_mutex_t mutex_;
+};
+
+TEST(WorkerPoolTest, RunsEveryIndexOnce) {
+  const size_t COUNT = 10000;
+  for (size_t threads = 0; threads <= 4; ++threads) {
+    WorkerPool pool(threads);
+    EXPECT_LT(0, (int)pool.thread_count());
+    SquaringTask task(COUNT, COUNT);
+    pool.Run(&task, COUNT);
+    EXPECT_EQ(COUNT, task.runs_);
+    for (size_t i = 0; i < COUNT; ++i) {
+      EXPECT_EQ(i * i, task.results_[i]);
+    }
+  }
+}
+
+TEST(WorkerPoolTest, StopsEarly) {
+  WorkerPool pool(4);
+  SquaringTask task(10000, 10);
+  pool.Run(&task, 10000);
+  // Each thread may finish the index it had already taken.
+  EXPECT_LE(10, (int)task.runs_);
+  EXPECT_GE(10 + 4, (int)task.runs_);
+}
+
+TEST(WorkerPoolTest, EmptyRun) {
+  WorkerPool pool(4);
+  SquaringTask task(0, 0);
+  pool.Run(&task, 0);
+  EXPECT_EQ(0, (int)task.runs_);
+}